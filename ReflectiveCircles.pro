@@ -2,20 +2,66 @@
 ##CONFIG += debug
 #CONFIG += release
 CONFIG -= debug_and_release debug_and_release_target
+CONFIG += c++11
+#DEFINES += CIRCLES_PROFILE  # Writes phase timings to circles_trace.json
 
 TARGET = circles
 
 TEMPLATE = app
 
+QT += network
+
 
 SOURCES += src/main.cpp \
            src/ui.cpp \
            src/geometry.cpp \
-           src/renderer.cpp
+           src/renderer.cpp \
+           src/tracker.cpp \
+           src/solutions.cpp \
+           src/scene.cpp \
+           src/cluster.cpp \
+           src/packet.cpp \
+           src/visibility.cpp \
+           src/sink.cpp \
+           src/sampler.cpp \
+           src/snapshot.cpp \
+           src/batch.cpp \
+           src/density.cpp \
+           src/export.cpp \
+           src/generator.cpp \
+           src/daemon.cpp \
+           src/profiler.cpp \
+           src/heatmap.cpp \
+           src/budget.cpp \
+           src/beam.cpp \
+           src/view.cpp \
+           src/tiles.cpp \
+           src/jobs.cpp
 
 HEADERS += src/ui.h \
            src/geometry.h \
-           src/renderer.h
+           src/renderer.h \
+           src/tracker.h \
+           src/solutions.h \
+           src/scene.h \
+           src/cluster.h \
+           src/packet.h \
+           src/visibility.h \
+           src/sink.h \
+           src/sampler.h \
+           src/snapshot.h \
+           src/batch.h \
+           src/density.h \
+           src/export.h \
+           src/generator.h \
+           src/daemon.h \
+           src/profiler.h \
+           src/heatmap.h \
+           src/budget.h \
+           src/beam.h \
+           src/view.h \
+           src/tiles.h \
+           src/jobs.h
 
 #FORMS  += src/ReflectiveCircles.ui
 
@@ -0,0 +1,373 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <fstream>
+#include <iomanip>
+#include <cstdio>
+#include <algorithm>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include "batch.h"
+#include "profiler.h"
+#include "renderer.h"
+#include "scene.h"
+#include "sampler.h"
+#include "heatmap.h"
+
+
+namespace circles
+{
+
+/******************************* PreparedScene ********************************/
+
+PreparedScene::PreparedScene( const std::vector<Figure*>& scene ) :
+        mSnapshot(),
+        mGrid(),
+        mFlat(),
+        mGraph()
+{
+    std::vector<Figure*> circles;
+    for ( std::vector<Figure*>::const_iterator fig=scene.begin();
+          fig != scene.end(); ++fig )
+    {
+        // TODO Replace dynamic_cast<>
+        const Circle *crp = dynamic_cast<const Circle*>(*fig);
+        if ( (NULL != crp) && (crp->R > 0.0f) )
+            circles.push_back(*fig);
+    }
+    mSnapshot = SceneSnapshot::Create(circles, NULL, NULL);
+    mGrid.Build(mSnapshot->Figures());
+
+    // A place for the target of each query, which is left out of the graph.
+    Circle target(0.0f, 0.0f, 1.0f);
+    circles = mSnapshot->Figures();
+    circles.push_back(&target);
+    mFlat.Build(circles, &target, Point(0.0f, 0.0f));
+
+    if ( mFlat.Size() <= VIS_MAX_CIRCLES + 1 )
+    {
+        VisibilityGraph* graph = new VisibilityGraph();
+        graph->Build(mFlat);
+        mGraph = QSharedPointer<const VisibilityGraph>(graph);
+    }
+}
+
+
+void PreparedScene::Solve( const PathQuery& query, const BudgetOptions& budgetOpts,
+                           PathResult* result, PathListener* listener,
+                           FigureCounters* counters ) const
+{
+    PROFILE_SCOPE("PreparedScene::Solve");
+
+    result->solutions.Clear();
+    result->numRays = 0;
+    result->targetR = 0.0f;
+
+    Point A(query.A);
+    Point B(query.B);
+
+    // Only the circles close to A and B can overlap them or limit the target.
+    std::vector<Figure*> nearA, nearB;
+    Near(QRectF(A.x, A.y, 0.0f, 0.0f), &nearA);
+    Near(QRectF(B.x - MAX_TARGET_SIZE, B.y - MAX_TARGET_SIZE,
+                2.0f * MAX_TARGET_SIZE, 2.0f * MAX_TARGET_SIZE), &nearB);
+
+    result->valid = (query.K >= 0) && (A != B) &&
+                    (NULL == FindCollision(nearA, &A)) &&
+                    (NULL == FindCollision(nearB, &B));
+    if ( ! result->valid )
+        return;
+
+    if ( query.K == 0 )
+    {
+        // Only the circles around the segment can block it.
+        std::vector<Figure*> scene;
+        Near(QRectF(QPointF(A.x, A.y), QPointF(B.x, B.y)).normalized(), &scene);
+        scene.push_back(&A);
+        scene.push_back(&B);
+
+        Ray r( A, B );
+        if ( RayTrace(scene, &A, &r, &B, 0) )
+        {
+            result->solutions.Add(r);
+            if ( NULL != listener )
+                listener->Found(result->solutions, 0);
+        }
+        result->numRays = 1;
+        return;
+    }
+
+    // The same search as RenderingThread::run(). The farther circles don't
+    // make the target smaller than MAX_TARGET_SIZE.
+    nearB.push_back(&A);
+    nearB.push_back(&B);
+    float minTargetSize, maxTargetSize;
+    TargetSizeRange(nearB, &B, &minTargetSize, &maxTargetSize);
+
+    Circle target(B, minTargetSize);
+
+    // The shared flat arrays, with this query's target and angular extents
+    // from A, which are the same for all target sizes.
+    std::vector<float> phi, halfW;
+    mFlat.Extents(A, &phi, &halfW);
+    const double covered = RayBudget::Covered(halfW, mFlat.target);
+    const float distB = Module(B.x - A.x, B.y - A.y);
+
+    PacketTracer<PACKET_LANES> tracer(mFlat, mGraph.data(), counters);
+    tracer.SetTarget(&target);
+    tracer.SetExtents(&phi, &halfW);
+    AdaptiveSampler sampler(1);  // The same query gives the same answer.
+    RayBudget budget(budgetOpts);
+
+    float angles[PACKET_LANES];
+    float weights[PACKET_LANES];
+    float misses[PACKET_LANES];
+    bool hits[PACKET_LANES];
+    unsigned long long paths[PACKET_LANES];
+    bool stopped = false;
+    std::vector<Figure*> scene;  // All figures, for re-tracing the first hit
+
+    while ( result->solutions.Empty() && (target.R <= maxTargetSize) &&
+            ! stopped && ! budget.Stopped() )
+    {
+        budget.NewTarget(covered, (distB > target.R)? asin(target.R / distB) :
+                                                      static_cast<float>(M_PI), query.K);
+
+        while ( ! budget.Done() )
+        {
+            if ( (NULL != listener) && listener->Stop() )
+            {
+                stopped = true;
+                break;
+            }
+
+            // Close increasing angles, so the tracer's wedge stays narrow.
+            sampler.NextPacket(angles, PACKET_LANES);
+            for ( int j=0; j<PACKET_LANES; ++j )
+                weights[j] = sampler.Weight(angles[j]);
+
+            int numHits = tracer.Trace(A, angles, query.K, hits, misses, paths);
+            budget.AddRays(PACKET_LANES);
+
+            for ( int j=0; j<PACKET_LANES; ++j )
+                sampler.Record(angles[j], misses[j]);
+
+            if ( 0 == numHits )
+                continue;
+
+            unsigned int first = result->solutions.Size();
+            for ( int j=0; j<PACKET_LANES; ++j )
+            {
+                if ( ! hits[j] )
+                    continue;
+
+                if ( scene.empty() )
+                {
+                    scene = mSnapshot->Figures();
+                    scene.push_back(&A);
+                    scene.push_back(&B);
+                    scene.push_back(&target);
+                }
+
+                Ray r( A, Vector(cos(angles[j]), sin(angles[j])) );
+                if ( RayTrace(scene, &A, &r, &target, query.K) )
+                {
+                    result->solutions.Add(r);
+                    budget.AddHit(paths[j], weights[j]);
+                }
+            }
+
+            if ( (NULL != listener) && (result->solutions.Size() > first) )
+                listener->Found(result->solutions, first);
+        }
+
+        result->numRays += budget.NumRays();
+        result->targetR = target.R;
+        target.R += INC_TARGET_SIZE;  // Bigger target is easier to hit.
+    }
+}
+
+
+// Takes the next query until there are no more.
+class BatchTask : public QRunnable
+{
+  public:
+    BatchTask( const PreparedScene& scene, const std::vector<PathQuery>& queries,
+               const BudgetOptions& budget, std::vector<PathResult>* results,
+               QAtomicInt* next, FigureCounters* counters ) :
+        mScene(scene), mQueries(queries), mBudget(budget), mResults(results),
+        mNext(next), mCounters(counters)
+    {
+    }
+
+    void run()
+    {
+        int q;
+        while ( (q = mNext->fetchAndAddOrdered(1)) < static_cast<int>(mQueries.size()) )
+            mScene.Solve(mQueries[q], mBudget, &(*mResults)[q], NULL, mCounters);
+    }
+
+  private:
+    const PreparedScene&           mScene;
+    const std::vector<PathQuery>&  mQueries;
+    const BudgetOptions&           mBudget;
+    std::vector<PathResult>*       mResults;
+    QAtomicInt*                    mNext;
+    FigureCounters*                mCounters;  // This task's own, or NULL
+};
+
+
+void PreparedScene::SolveBatch( const std::vector<PathQuery>& queries,
+                                const BudgetOptions& budget,
+                                std::vector<PathResult>* results,
+                                FigureCounters* counters ) const
+{
+    results->clear();
+    results->resize(queries.size());
+
+    QAtomicInt next(0);
+    QThreadPool pool;
+    int numTasks = std::min(QThread::idealThreadCount(), static_cast<int>(queries.size()));
+
+    // Each task counts on its own, so the counters are not shared.
+    std::vector<FigureCounters> taskCounters((NULL != counters)? numTasks : 0);
+    for ( unsigned int i=0; i<taskCounters.size(); ++i )
+        taskCounters[i].Reset(mFlat.Size());
+
+    for ( int i=0; i<numTasks; ++i )
+        pool.start(new BatchTask(*this, queries, budget, results, &next,
+                                 taskCounters.empty()? NULL : &taskCounters[i]));  // Auto-deleted
+
+    pool.waitForDone();
+
+    if ( NULL != counters )
+    {
+        counters->Reset(mFlat.Size());
+        for ( unsigned int i=0; i<taskCounters.size(); ++i )
+            counters->Merge(taskCounters[i]);
+    }
+}
+
+
+void PreparedScene::Near( const QRectF& area, std::vector<Figure*>* figures ) const
+{
+    std::vector<unsigned int> found;
+    mGrid.Query(area, &found);
+
+    const std::vector<Figure*>& circles = mSnapshot->Figures();
+    for ( std::vector<unsigned int>::const_iterator f=found.begin(); f != found.end(); ++f )
+        figures->push_back(circles[*f]);
+}
+
+
+/********************************* RunBatch ***********************************/
+
+int RunBatch( const std::string& sceneFile, const std::string& queryFile,
+              const std::string& outputFile, const BudgetOptions& budget,
+              const std::string& statsFile )
+{
+    std::ifstream inFile(sceneFile.c_str(), std::ios::in | std::ios::binary);  // Or a binary scene
+    if ( ! inFile.is_open() )
+    {
+        std::cerr << "Unable to open the input file '" << sceneFile << "'" << std::endl;
+        return 1;
+    }
+
+    std::vector<Figure*> figures;
+    SceneInfo info;
+    std::stringstream errSStr;
+    ReadScene(inFile, &figures, &info, errSStr);
+    if ( errSStr.str() != "" )
+        std::cerr << errSStr.str();
+
+    std::ifstream queryIn(queryFile.c_str());
+    if ( ! queryIn.is_open() )
+    {
+        std::cerr << "Unable to open the query file '" << queryFile << "'" << std::endl;
+        DeleteFigures(&figures);
+        return 1;
+    }
+
+    std::vector<PathQuery> queries;
+    std::string line;
+    while ( std::getline(queryIn, line) )
+    {
+        PathQuery q;
+        if ( line.empty() || (line[0] == '#') )
+            continue;
+        if ( sscanf(line.c_str(), "%f %f %f %f %d", &q.A.x, &q.A.y,
+                    &q.B.x, &q.B.y, &q.K) != 5 )
+        {
+            std::cerr << "Ignored invalid query on this row : " << line << std::endl;
+            continue;
+        }
+        queries.push_back(q);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    PreparedScene prepared(figures);
+    DeleteFigures(&figures);  // The prepared scene has its own copy.
+    qint64 prepareMs = timer.restart();
+
+    std::vector<PathResult> results;
+    FigureCounters counters;
+    prepared.SolveBatch(queries, budget, &results, statsFile.empty()? NULL : &counters);
+    qint64 solveMs = timer.elapsed();
+
+    std::cerr << prepared.NumCircles() << " circles prepared in " << prepareMs
+              << " ms, " << queries.size() << " queries solved in " << solveMs
+              << " ms" << std::endl;
+
+    std::ofstream outFile;
+    if ( ! outputFile.empty() )
+    {
+        outFile.open(outputFile.c_str(), std::ios::out);
+        if ( ! outFile.is_open() )
+            std::cerr << "Unable to open the output file '" << outputFile
+                      << "'" << std::endl;
+    }
+    std::ostream& out = outFile.is_open()? outFile : std::cout;
+
+    std::stringstream statsErr;
+    if ( ! statsFile.empty() &&
+         ! WriteFigureStats(statsFile.c_str(), prepared.Circles(), counters, statsErr) )
+        std::cerr << statsErr.str() << std::endl;
+
+    out << std::setprecision(9);
+    for ( unsigned int q=0; q<queries.size(); ++q )
+    {
+        const PathResult& res = results[q];
+
+        out << "# query " << q << " : A " << queries[q].A.x << " " << queries[q].A.y
+            << " B " << queries[q].B.x << " " << queries[q].B.y << " K "
+            << queries[q].K << " : ";
+        if ( ! res.valid )
+        {
+            out << "invalid" << std::endl;
+            continue;
+        }
+        out << res.solutions.Size() << " solutions, target radius "
+            << res.targetR << std::endl;
+
+        for ( unsigned int s=0; s<res.solutions.Size(); ++s )
+        {
+            const SolutionRecord& rec = res.solutions.Record(s);
+            const TracePoint* points = res.solutions.Points(s);
+
+            out << rec.launchAngle << " " << rec.pathLength << " " << rec.length;
+            for ( unsigned int i=0; i<rec.length; ++i )
+                out << " " << points[i].x << " " << points[i].y;
+            out << std::endl;
+        }
+    }
+
+    return 0;
+}
+
+}  // namespace
@@ -0,0 +1,117 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <vector>
+#include <string>
+
+#include "qglobal.h"
+#include <QSharedPointer>
+
+#include "geometry.h"
+#include "solutions.h"
+#include "snapshot.h"
+#include "packet.h"
+#include "visibility.h"
+#include "budget.h"
+#include "view.h"
+
+
+namespace circles
+{
+
+/******************************* PreparedScene ********************************/
+
+// Find the paths from A to B with exactly K reflections.
+struct PathQuery
+{
+    PathQuery() : A(0, 0), B(0, 0), K(0) {}
+
+    Point A;
+    Point B;
+    int   K;
+};
+
+
+struct PathResult
+{
+    PathResult() : valid(false), targetR(0.0f), numRays(0), solutions() {}
+
+    bool          valid;     // False if A or B overlaps a circle
+    float         targetR;   // The radius, with which the solutions were found
+    unsigned long numRays;   // Traced, for all target sizes
+    SolutionArena solutions;
+};
+
+
+// Is told about the solutions of a query while it is being solved.
+class PathListener
+{
+  public:
+    virtual ~PathListener() {}
+
+    // Solutions first .. Size()-1 are new.
+    virtual void Found(const SolutionArena& solutions, unsigned int first) = 0;
+
+    // Polled between the packets of rays. True stops the query.
+    virtual bool Stop() { return false; }
+};
+
+
+/* The circles of a scene with everything about them, which doesn't depend on
+ * A and B: a snapshot of the circles, a grid for finding the ones near A and
+ * B, their flat arrays and the visibility graph. Built once, it answers any
+ * number of queries - also from several threads at once, as it is not changed
+ * by them. A query doesn't copy any of it, only the angular extents of the
+ * circles from its A are its own. */
+class PreparedScene
+{
+  public:
+    // Only the circles of the scene are used.
+    explicit PreparedScene(const std::vector<Figure*>& scene);
+
+    // Searches like the GUI does, until the budget says so. The listener, if
+    // any, is called from this thread. The counters, if any, must be Reset()
+    // for Circles() and are added to.
+    void Solve(const PathQuery& query, const BudgetOptions& budget,
+               PathResult* result, PathListener* listener = NULL,
+               FigureCounters* counters = NULL) const;
+
+    // Solves the queries on all cores. results[i] is the answer to queries[i].
+    // If counters is not NULL, it gets the sum of all queries' counts.
+    void SolveBatch(const std::vector<PathQuery>& queries, const BudgetOptions& budget,
+                    std::vector<PathResult>* results,
+                    FigureCounters* counters = NULL) const;
+
+    unsigned int NumCircles() const { return mSnapshot->Figures().size(); }
+    // The circles and, last, the place of the target.
+    const FlatScene& Circles() const { return mFlat; }
+    unsigned long long Hash() const { return mFlat.Hash(); }
+
+  private:
+    // Appends the circles, whose bounding boxes intersect the area.
+    void Near(const QRectF& area, std::vector<Figure*>* figures) const;
+
+    SnapshotPtr                            mSnapshot;  // The circles only
+    FigureGrid                             mGrid;      // Of mSnapshot's figures
+    FlatScene                              mFlat;      // The target is the last one
+    QSharedPointer<const VisibilityGraph>  mGraph;     // NULL for big scenes
+};
+
+
+/* Reads a scene and a file with one query per row: "Ax Ay Bx By K", solves
+ * them all and writes for each query a header row and the solutions:
+ *   # query <i> : A <x> <y> B <x> <y> K <K> : <n> solutions, target radius <r>
+ *   <launch angle> <path length> <number of points> <x y>*
+ * If statsFile is not empty, the work per circle is written to it - see
+ * WriteFigureStats(). */
+int RunBatch(const std::string& sceneFile, const std::string& queryFile,
+             const std::string& outputFile, const BudgetOptions& budget,
+             const std::string& statsFile = std::string());
+
+}  // namespace
+
+#endif // BATCH_H
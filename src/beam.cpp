@@ -0,0 +1,418 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <cmath>
+#include <algorithm>
+#include "beam.h"
+
+
+namespace circles
+{
+
+const int    BEAM_START     = 64;      // Beams around the source to start with
+const double BEAM_MIN_WIDTH = 1e-9;    // Narrower beams are given up, rad
+const double BEAM_EXACT     = 1e-13;   // Precision of the launch angles, rad
+const double BEAM_WINDOW    = 64.0;    // Width of a beam over that of its event window
+const double BEAM_MAX_SPAN  = 0.5 * M_PI;  // Of the directions of a coherent beam, rad
+
+
+// Twice the signed area of the triangle a, b, c.
+static inline double Cross( double ax, double ay, double bx, double by,
+                            double cx, double cy )
+{
+    return (bx - ax)*(cy - ay) - (by - ay)*(cx - ax);
+}
+
+
+static bool InTriangle( double ax, double ay, double bx, double by,
+                        double cx, double cy, double x, double y )
+{
+    if ( fabs(Cross(ax, ay, bx, by, cx, cy)) < 1e-12 )
+        return false;  // Degenerate - the first leg from the source
+
+    double d1 = Cross(ax, ay, bx, by, x, y);
+    double d2 = Cross(bx, by, cx, cy, x, y);
+    double d3 = Cross(cx, cy, ax, ay, x, y);
+    bool neg = (d1 < 0.0) || (d2 < 0.0) || (d3 < 0.0);
+    bool pos = (d1 > 0.0) || (d2 > 0.0) || (d3 > 0.0);
+    return ! (neg && pos);
+}
+
+
+static double SegmentDistance( double ax, double ay, double bx, double by,
+                               double x, double y )
+{
+    double vx = bx - ax, vy = by - ay;
+    double len2 = vx*vx + vy*vy;
+    double u = (len2 > 0.0)? ((x - ax)*vx + (y - ay)*vy) / len2 : 0.0;
+    u = std::max(0.0, std::min(u, 1.0));
+    return hypot(ax + u*vx - x, ay + u*vy - y);
+}
+
+
+/********************************* BeamTracer *********************************/
+
+BeamTracer::BeamTracer( const FlatScene& scene ) :
+        mScene(scene),
+        mCancel(NULL),
+        mReach(NULL),
+        mListener(NULL),
+        mFar(0.0),
+        mSrcX(0.0), mSrcY(0.0), mDstX(0.0), mDstY(0.0),
+        mBudget(NULL),
+        mSolutions(NULL),
+        mNumBeams(0),
+        mNumLost(0),
+        mStopped(false)
+{
+}
+
+
+bool BeamTracer::Trace( const Point& src, const Point& dst, int K,
+                        RayBudget* budget, std::vector<Ray>* solutions )
+{
+    mSrcX = src.x;
+    mSrcY = src.y;
+    mDstX = dst.x;
+    mDstY = dst.y;
+    mBudget = budget;
+    mSolutions = solutions;
+    mNumBeams = mNumLost = 0;
+    mStopped = false;
+
+    // A leg starts inside the bounding box, so this gets out of it.
+    double minX = std::min(mSrcX, mDstX), maxX = std::max(mSrcX, mDstX);
+    double minY = std::min(mSrcY, mDstY), maxY = std::max(mSrcY, mDstY);
+    for ( unsigned int c=0; c<mScene.Size(); ++c )
+    {
+        minX = std::min(minX, static_cast<double>(mScene.cx[c] - mScene.r[c]));
+        maxX = std::max(maxX, static_cast<double>(mScene.cx[c] + mScene.r[c]));
+        minY = std::min(minY, static_cast<double>(mScene.cy[c] - mScene.r[c]));
+        maxY = std::max(maxY, static_cast<double>(mScene.cy[c] + mScene.r[c]));
+    }
+    mFar = 2.0 * hypot(maxX - minX, maxY - minY) + 1.0;
+
+    // The first legs change their circle only at the silhouettes seen from the
+    // source, so the beams start between these. A sliver of BEAM_MIN_WIDTH
+    // around each one is given up - the rays there graze the circle. A beam
+    // from the center to a silhouette is reflected into less than half a turn.
+    std::vector<double> starts;
+    for ( int i=0; i<=BEAM_START; ++i )
+        starts.push_back(2.0 * M_PI * i / BEAM_START - M_PI);
+    for ( unsigned int c=0; c<mScene.Size(); ++c )
+    {
+        if ( static_cast<int>(c) == mScene.target )
+            continue;
+        double phi = atan2(mScene.cy[c] - mSrcY, mScene.cx[c] - mSrcX);
+        double halfW = asin(std::min(1.0, mScene.r[c] /
+                                     hypot(mScene.cx[c] - mSrcX, mScene.cy[c] - mSrcY)));
+        for ( int side=-1; side<=1; side+=2 )
+        {
+            double a = remainder(phi + side*halfW, 2.0 * M_PI);
+            starts.push_back(a - BEAM_MIN_WIDTH);
+            starts.push_back(a + BEAM_MIN_WIDTH);
+        }
+        starts.push_back(phi);
+    }
+    std::sort(starts.begin(), starts.end());
+
+    std::vector<Leg> l0(K + 1), l1(K + 1);
+    TraceRay(starts[0], K, &l0[0]);
+    for ( unsigned int i=1; (i<starts.size()) && ! Stopped(); ++i )
+    {
+        TraceRay(starts[i], K, &l1[0]);
+        if ( (starts[i] - starts[i-1] > BEAM_MIN_WIDTH) &&
+             (starts[i] - starts[i-1] < M_PI) && (starts[i] <= M_PI) )
+            Split(starts[i-1], &l0[0], starts[i], &l1[0], K, 0);
+        l0.swap(l1);
+
+        if ( NULL != mListener )
+            mListener->Progress( (std::min(starts[i], M_PI) + M_PI) / (2.0 * M_PI) );
+    }
+
+    return ! mStopped;
+}
+
+
+void BeamTracer::TraceRay( double angle, int K, Leg* legs )
+{
+    double sx = mSrcX, sy = mSrcY;
+    double dx = cos(angle), dy = sin(angle);
+    int on = -1;
+
+    if ( NULL != mBudget )
+        mBudget->AddRays(1);
+
+    for ( int k=0; k<=K; ++k )
+    {
+        Leg& leg = legs[k];
+        leg.sx = sx;
+        leg.sy = sy;
+        leg.dx = dx;
+        leg.dy = dy;
+        leg.t = mFar;
+        leg.hit = -1;
+
+        for ( unsigned int c=0; c<mScene.Size(); ++c )
+        {
+            if ( (static_cast<int>(c) == on) || (static_cast<int>(c) == mScene.target) )
+                continue;
+
+            double smcx = sx - mScene.cx[c];
+            double smcy = sy - mScene.cy[c];
+            double h = dx*smcx + dy*smcy;
+            double disc = h*h - (smcx*smcx + smcy*smcy - mScene.r2[c]);
+            if ( disc < 0.0 )
+                continue;
+            double t = -h - sqrt(disc);
+            if ( (t > 0.0) && (t < leg.t) )
+            {
+                leg.t = t;
+                leg.hit = c;
+            }
+        }
+
+        if ( leg.hit < 0 )
+            return;  // Escaped
+
+        // Reflect: r = Dir - 2(n.Dir)n
+        const int c = leg.hit;
+        double px = sx + leg.t*dx;
+        double py = sy + leg.t*dy;
+        double nx = (px - mScene.cx[c]) / mScene.r[c];
+        double ny = (py - mScene.cy[c]) / mScene.r[c];
+        double ndot = 2.0 * (nx*dx + ny*dy);
+        dx -= ndot * nx;
+        dy -= ndot * ny;
+        double len = hypot(dx, dy);
+        dx /= len;
+        dy /= len;
+        sx = px;
+        sy = py;
+        on = c;
+    }
+}
+
+
+void BeamTracer::Split( double a0, const Leg* l0, double a1, const Leg* l1,
+                        int K, int first )
+{
+    if ( Stopped() )
+        return;
+
+    // Of the directions of legs k.
+    double span = a1 - a0;
+
+    for ( int k=0; k<=K; ++k )
+    {
+        if ( k < first )
+        {
+            span = ReflectedSpan(l0, l1, k, span);
+            continue;
+        }
+
+        const int from = (k > 0)? l0[k-1].hit : -1;
+        const bool wide = fabs(span) > BEAM_MAX_SPAN;
+        if ( wide || (l0[k].hit != l1[k].hit) || Blocked(l0[k], l1[k], from, l0[k].hit) )
+        {
+            if ( a1 - a0 < BEAM_MIN_WIDTH )
+            {
+                ++mNumLost;  // Grazing a silhouette
+                return;
+            }
+
+            double w0, w1;
+            if ( ! wide && (l0[k].hit != l1[k].hit) &&
+                 EventWindow(a0, l0[k], a1, l1[k], &w0, &w1) )
+            {
+                // Split off a narrow beam around the estimated silhouette.
+                std::vector<Leg> lw0(K + 1), lw1(K + 1);
+                TraceRay(w0, K, &lw0[0]);
+                TraceRay(w1, K, &lw1[0]);
+                Split(a0, l0, w0, &lw0[0], K, k);
+                Split(w0, &lw0[0], w1, &lw1[0], K, k);
+                Split(w1, &lw1[0], a1, l1, K, k);
+                return;
+            }
+
+            double am = 0.5 * (a0 + a1);
+            std::vector<Leg> lm(K + 1);
+            TraceRay(am, K, &lm[0]);
+            Split(a0, l0, am, &lm[0], K, k);
+            Split(am, &lm[0], a1, l1, K, k);
+            return;
+        }
+
+        if ( k == K )
+            break;
+
+        if ( l0[k].hit < 0 )
+            return;  // The whole beam escapes
+
+        span = ReflectedSpan(l0, l1, k, span);
+
+        if ( (NULL != mReach) && (fabs(span) < 2.0 * M_PI) )
+        {
+            // The directions the beam leaves the circle in, counterclockwise.
+            float from = atan2(l0[k+1].dy, l0[k+1].dx);
+            float to = atan2(l1[k+1].dy, l1[k+1].dx);
+            if ( span < 0.0 )
+                std::swap(from, to);
+            if ( ! mReach->Reaches(l0[k].hit, K-k-1, from, to) )
+                return;  // The whole beam is doomed
+        }
+    }
+
+    ++mNumBeams;
+    if ( ! Inside(l0[K], l1[K], mDstX, mDstY) )
+        return;
+
+    mSolutions->push_back(Refine(a0, a1, K));
+
+    if ( NULL != mBudget )
+    {
+        unsigned long long path = 14695981039346656037ULL;  // FNV-1a
+        for ( int k=0; k<K; ++k )
+            path = (path ^ static_cast<unsigned int>(l0[k].hit)) * 1099511628211ULL;
+        mBudget->AddHit(path, 1.0f);
+    }
+}
+
+
+double BeamTracer::ReflectedSpan( const Leg* l0, const Leg* l1, int k, double span ) const
+{
+    // The reflection turns the span around and adds twice the turn of the
+    // normal between the hit points.
+    const int c = l0[k].hit;
+    double n0 = atan2(l0[k+1].sy - mScene.cy[c], l0[k+1].sx - mScene.cx[c]);
+    double n1 = atan2(l1[k+1].sy - mScene.cy[c], l1[k+1].sx - mScene.cx[c]);
+    return 2.0 * remainder(n1 - n0, 2.0 * M_PI) - span;
+}
+
+
+bool BeamTracer::EventWindow( double a0, const Leg& l0, double a1, const Leg& l1,
+                              double* w0, double* w1 ) const
+{
+    // The clearance of the line of the leg from a circle, which one edge hits
+    // and the other doesn't, changes its sign at the silhouette. Unless the
+    // circle is hidden behind the other one - then try that one.
+    for ( int i=0; i<2; ++i )
+    {
+        const int c = (0 == i)? l0.hit : l1.hit;
+        if ( c < 0 )
+            continue;
+
+        const double g0 = fabs(Cross(l0.sx, l0.sy, l0.sx + l0.dx, l0.sy + l0.dy,
+                                     mScene.cx[c], mScene.cy[c])) - mScene.r[c];
+        const double g1 = fabs(Cross(l1.sx, l1.sy, l1.sx + l1.dx, l1.sy + l1.dy,
+                                     mScene.cx[c], mScene.cy[c])) - mScene.r[c];
+        if ( (g0 < 0.0) == (g1 < 0.0) )
+            continue;
+
+        const double width = a1 - a0;
+        const double am = a0 + width * g0 / (g0 - g1);
+        const double half = std::max(width / BEAM_WINDOW, BEAM_MIN_WIDTH);
+        *w0 = std::max(am - half, a0 + half);
+        *w1 = std::min(am + half, a1 - half);
+        return *w0 < *w1;
+    }
+
+    return false;
+}
+
+
+bool BeamTracer::Blocked( const Leg& l0, const Leg& l1, int skip1, int skip2 ) const
+{
+    // The region is the quadrangle of the two legs.
+    const double x[4] = { l0.sx, l1.sx, l1.sx + l1.t*l1.dx, l0.sx + l0.t*l0.dx };
+    const double y[4] = { l0.sy, l1.sy, l1.sy + l1.t*l1.dy, l0.sy + l0.t*l0.dy };
+    const double minX = std::min(std::min(x[0], x[1]), std::min(x[2], x[3]));
+    const double maxX = std::max(std::max(x[0], x[1]), std::max(x[2], x[3]));
+    const double minY = std::min(std::min(y[0], y[1]), std::min(y[2], y[3]));
+    const double maxY = std::max(std::max(y[0], y[1]), std::max(y[2], y[3]));
+
+    for ( unsigned int c=0; c<mScene.Size(); ++c )
+    {
+        if ( (static_cast<int>(c) == skip1) || (static_cast<int>(c) == skip2) ||
+             (static_cast<int>(c) == mScene.target) )
+            continue;
+
+        const double cx = mScene.cx[c];
+        const double cy = mScene.cy[c];
+        const double r = mScene.r[c];
+        if ( (cx + r < minX) || (cx - r > maxX) || (cy + r < minY) || (cy - r > maxY) )
+            continue;
+
+        if ( Inside(l0, l1, cx, cy) )
+            return true;
+
+        for ( int e=0; e<4; ++e )
+            if ( SegmentDistance(x[e], y[e], x[(e+1)%4], y[(e+1)%4], cx, cy) < r )
+                return true;
+    }
+
+    return false;
+}
+
+
+bool BeamTracer::Inside( const Leg& l0, const Leg& l1, double x, double y )
+{
+    const double e0x = l0.sx + l0.t*l0.dx, e0y = l0.sy + l0.t*l0.dy;
+    const double e1x = l1.sx + l1.t*l1.dx, e1y = l1.sy + l1.t*l1.dy;
+
+    return InTriangle(l0.sx, l0.sy, l1.sx, l1.sy, e1x, e1y, x, y) ||
+           InTriangle(l0.sx, l0.sy, e1x, e1y, e0x, e0y, x, y);
+}
+
+
+Ray BeamTracer::Refine( double a0, double a1, int K )
+{
+    // The side of the K-th leg the destination is on changes in the beam.
+    std::vector<Leg> legs(K + 1);
+    TraceRay(a0, K, &legs[0]);
+    const bool left0 = Cross(legs[K].sx, legs[K].sy, legs[K].sx + legs[K].dx,
+                             legs[K].sy + legs[K].dy, mDstX, mDstY) > 0.0;
+
+    while ( a1 - a0 > BEAM_EXACT )
+    {
+        double am = 0.5 * (a0 + a1);
+        TraceRay(am, K, &legs[0]);
+        bool left = Cross(legs[K].sx, legs[K].sy, legs[K].sx + legs[K].dx,
+                          legs[K].sy + legs[K].dy, mDstX, mDstY) > 0.0;
+        if ( left == left0 )
+            a0 = am;
+        else
+            a1 = am;
+    }
+
+    // Made of the legs - tracing it again in floats could miss the target.
+    const double angle = 0.5 * (a0 + a1);
+    TraceRay(angle, K, &legs[0]);
+    Ray ray( Point(mSrcX, mSrcY), Vector(cos(angle), sin(angle)) );
+    for ( int k=0; k<K; ++k )
+    {
+        ray.Propagate(Point(legs[k].sx + legs[k].t*legs[k].dx,
+                            legs[k].sy + legs[k].t*legs[k].dy));
+        ray.SetDir(Vector(legs[k+1].dx, legs[k+1].dy));
+    }
+    ray.Propagate(Point(mDstX, mDstY));
+
+    return ray;
+}
+
+
+bool BeamTracer::Stopped()
+{
+    if ( mStopped )
+        return true;
+
+    if ( ((NULL != mCancel) && mCancel->loadAcquire()) ||
+         ((NULL != mBudget) && (mBudget->Stopped() ||
+                                (mBudget->NumRays() >= mBudget->Options().maxRays))) )
+        mStopped = true;
+
+    return mStopped;
+}
+
+}  // namespace
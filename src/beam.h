@@ -0,0 +1,143 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef BEAM_H
+#define BEAM_H
+
+#include <vector>
+
+#include "qglobal.h"
+#include <QAtomicInt>
+
+#include "geometry.h"
+#include "packet.h"
+#include "budget.h"
+
+
+namespace circles
+{
+
+extern const int    BEAM_START;
+extern const double BEAM_MIN_WIDTH;
+extern const double BEAM_EXACT;
+extern const double BEAM_WINDOW;
+extern const double BEAM_MAX_SPAN;
+
+
+// Told how far a BeamTracer is, e.g. to show the progress.
+class BeamListener
+{
+  public:
+    virtual ~BeamListener() {}
+
+    // The share of the launch angles done, 0 to 1.
+    virtual void Progress(double share) = 0;
+};
+
+
+/********************************* BeamTracer *********************************/
+
+/* Traces wedges of launch angles from the source (beams) instead of single
+ * rays. A beam is bounded by two traced rays. It is coherent if both edges hit
+ * the same circles and no other circle is inside any of its legs - the region
+ * between the two edge legs. Then every ray in between takes the same path:
+ * the rays leaving a convex mirror diverge, so they stay between the edges
+ * and end on the chord between the edges' hit points, which is inside the hit
+ * circle. A beam, which is not coherent, is split in two at the middle angle,
+ * down to BEAM_MIN_WIDTH, which brings the split points to the silhouettes
+ * and the tangent points of the circles. So is a beam, whose directions span
+ * more than BEAM_MAX_SPAN after a reflection - the region between its legs is
+ * then not the quadrangle of their ends. A circle reflects the beam hitting
+ * the whole of it all around, so the beams start at the circles' centers too.
+ * Beams, which escape the scene before K reflections, are dropped. If the K-th
+ * leg of a coherent beam sweeps over the destination, the exact ray through it
+ * is found by bisection. So the work grows with the number of distinct paths,
+ * not with the number of rays. */
+class BeamTracer
+{
+  public:
+    // The target of the scene, if any, is skipped - the destination is a
+    // point.
+    explicit BeamTracer(const FlatScene& scene);
+
+    // Trace() gives up at the next beam once the flag is set. NULL for none.
+    void SetCancel(const QAtomicInt* cancel) { mCancel = cancel; }
+
+    // Beams, which reflect from a circle, from which the destination (the
+    // scene's target) can't be reached with the reflections left, are
+    // dropped. NULL for none.
+    void SetReach(const ReachSets* reach) { mReach = reach; }
+
+    // Called by Trace() as it goes. NULL for none.
+    void SetListener(BeamListener* listener) { mListener = listener; }
+
+    // Appends the rays from src, which pass through dst after exactly K
+    // reflections, one per distinct path. The traced rays and the paths are
+    // added to the budget; the search gives up when it is stopped or maxRays
+    // are traced. Returns false if it gave up.
+    bool Trace(const Point& src, const Point& dst, int K, RayBudget* budget,
+               std::vector<Ray>* solutions);
+
+    // Of the last Trace().
+    unsigned long NumBeams() const { return mNumBeams; }  // Coherent ones
+    unsigned long NumLost() const { return mNumLost; }    // Narrower than BEAM_MIN_WIDTH
+
+  private:
+    // A straight part of a ray: the start, the direction and the circle hit
+    // at distance t. Or -1 and mFar, if the ray escapes.
+    struct Leg
+    {
+        double sx, sy, dx, dy, t;
+        int    hit;
+    };
+
+    // Traces a ray up to K reflections into K+1 legs. The legs after an
+    // escape are not set.
+    void TraceRay(double angle, int K, Leg* legs);
+
+    // Splits the beam between the two traced rays until its parts are
+    // coherent. The legs before the first one are known to be.
+    void Split(double a0, const Leg* l0, double a1, const Leg* l1, int K, int first);
+
+    // The oriented angle from the direction of l0[k+1] to that of l1[k+1],
+    // from the same for legs k, which hit the same circle.
+    double ReflectedSpan(const Leg* l0, const Leg* l1, int k, double span) const;
+
+    // Where the legs of a beam, which hit different circles, change it: a
+    // window around the silhouette's launch angle, interpolated from how far
+    // each edge passes from the circle. The error of the estimate drops with
+    // the square of the beam's width, so the windows quickly get narrow.
+    // False if there is no estimate.
+    bool EventWindow(double a0, const Leg& l0, double a1, const Leg& l1,
+                     double* w0, double* w1) const;
+
+    // True if a circle other than skip1 and skip2 is in the region between
+    // the two legs.
+    bool Blocked(const Leg& l0, const Leg& l1, int skip1, int skip2) const;
+
+    // True if the point is in the region between the two legs.
+    static bool Inside(const Leg& l0, const Leg& l1, double x, double y);
+
+    // The exact ray through the destination, between the launch angles of a
+    // coherent beam.
+    Ray Refine(double a0, double a1, int K);
+
+    bool Stopped();
+
+    const FlatScene&  mScene;
+    const QAtomicInt* mCancel;
+    const ReachSets*  mReach;
+    BeamListener*     mListener;
+    double            mFar;    // Longer than any leg inside the scene
+    double            mSrcX, mSrcY, mDstX, mDstY;
+    RayBudget*        mBudget;
+    std::vector<Ray>* mSolutions;
+    unsigned long     mNumBeams;
+    unsigned long     mNumLost;
+    bool              mStopped;
+};
+
+}  // namespace
+
+#endif // BEAM_H
@@ -0,0 +1,112 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <cmath>
+#include <algorithm>
+#include "budget.h"
+#include "sampler.h"
+
+
+namespace circles
+{
+
+const unsigned long MIN_NUM_RAYS = 2 * PACKET_LANES;  // Per target size
+const float BUDGET_CONFIDENCE = 0.99f;  // Of finding each path
+
+
+/********************************* RayBudget **********************************/
+
+RayBudget::RayBudget( const BudgetOptions& opts ) :
+        mOpts(opts),
+        mTimer(),
+        mNumRays(0),
+        mPrior(0.0),
+        mPaths(),
+        mSum(0.0),
+        mRarest(0.0)
+{
+    mTimer.start();
+}
+
+
+void RayBudget::NewTarget( const FlatScene& flat, int K )
+{
+    if ( flat.target < 0 )
+    {
+        NewTarget(0.0, 0.0f, K);
+        return;
+    }
+
+    NewTarget(Covered(flat.halfW, flat.target), flat.halfW[flat.target], K);
+}
+
+
+void RayBudget::NewTarget( double covered, float targetHalfW, int K )
+{
+    mNumRays = 0;
+    mPaths.clear();
+    mSum = mRarest = 0.0;
+    mPrior = targetHalfW / M_PI * pow(covered, K);
+}
+
+
+double RayBudget::Covered( const std::vector<float>& halfW, int target )
+{
+    double covered = 0.0;
+    for ( unsigned int c=0; c<halfW.size(); ++c )
+        if ( static_cast<int>(c) != target )
+            covered += halfW[c] / M_PI;
+
+    return std::min(covered, 1.0);
+}
+
+
+void RayBudget::AddHit( unsigned long long path, float weight )
+{
+    mPaths[path] += weight;
+    mSum += weight;
+
+    // Hits are rare, so this doesn't need to be fast.
+    mRarest = mSum;
+    for ( std::map<unsigned long long, double>::const_iterator p=mPaths.begin();
+          p != mPaths.end(); ++p )
+        mRarest = std::min(mRarest, p->second);
+}
+
+
+unsigned long RayBudget::Predicted() const
+{
+    if ( mOpts.confidence <= 0.0f )
+        return mOpts.maxRays;
+
+    double p = mPrior;
+    if ( ! mPaths.empty() && (mNumRays > 0) )
+        p = mRarest / mNumRays;
+
+    // A path not found yet is hit only by the uniform part of the sampling.
+    p *= SAMPLER_MIN_EXPLORE;
+    if ( (p <= 0.0) || (p >= 1.0) )
+        return mOpts.maxRays;
+
+    double n = log(1.0 - std::min(mOpts.confidence, 0.999999f)) / log1p(-p);
+    return static_cast<unsigned long>( std::min(ceil(n), static_cast<double>(mOpts.maxRays)) );
+}
+
+
+bool RayBudget::Done() const
+{
+    return (mNumRays >= mOpts.maxRays) || Stopped() ||
+           (! mPaths.empty() && (mNumRays >= Predicted()));
+}
+
+
+bool RayBudget::Stopped() const
+{
+    if ( (mOpts.maxMs > 0) && (mTimer.elapsed() >= mOpts.maxMs) )
+        return true;
+
+    return (mOpts.maxPaths > 0) && (mPaths.size() >= mOpts.maxPaths);
+}
+
+}  // namespace
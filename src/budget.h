@@ -0,0 +1,102 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef BUDGET_H
+#define BUDGET_H
+
+#include <map>
+#include <vector>
+
+#include "qglobal.h"
+#include <QElapsedTimer>
+
+#include "packet.h"
+
+
+namespace circles
+{
+
+extern unsigned long MAX_NUM_RAYS;
+extern const unsigned long MIN_NUM_RAYS;
+extern const float BUDGET_CONFIDENCE;
+
+
+/********************************* RayBudget **********************************/
+
+// When a search stops. Whatever comes first.
+struct BudgetOptions
+{
+    BudgetOptions() : maxRays(MAX_NUM_RAYS), maxMs(0), maxPaths(0),
+                      confidence(BUDGET_CONFIDENCE) {}
+
+    unsigned long maxRays;     // Per target size, at least MIN_NUM_RAYS
+    qint64        maxMs;       // For the whole search. 0 for no limit
+    unsigned int  maxPaths;    // Distinct paths wanted. 0 for all
+    float         confidence;  // That no path is missed, see RayBudget. 0 to
+                               // trace maxRays
+};
+
+
+/* Decides how many rays a search traces for each target size. A path is
+ * missed by n rays with probability (1 - p)^n, where p is its share of the
+ * launch directions, so n = log(1 - confidence) / log(1 - p) rays find it
+ * with the asked confidence. p is estimated from the hits so far: the share
+ * of the rarest distinct path found (paths less likely than it are given up).
+ * The hits are weighted by the uniform over the sampler's density, and only
+ * the sampler's uniform part is counted on for the paths not found yet.
+ * Before the first hit p is guessed from the angular size of the target seen
+ * from A, times the share of A's view covered by circles for each reflection.
+ * The guess is too rough to stop on, so a target size without hits is traced
+ * with maxRays rays, but it gives the progress an ETA until then. */
+class RayBudget
+{
+  public:
+    explicit RayBudget(const BudgetOptions& opts);
+
+    // Starts counting for a new target size. The flat scene has the target.
+    void NewTarget(const FlatScene& flat, int K);
+
+    // The same with the share of the directions from A covered by the other
+    // circles (see Covered()) and the target's angular half width from A.
+    void NewTarget(double covered, float targetHalfW, int K);
+
+    // The share of the directions from the source, which the circles except
+    // the target cover with these angular half widths, up to 1.
+    static double Covered(const std::vector<float>& halfW, int target);
+
+    void AddRays(unsigned long numRays) { mNumRays += numRays; }
+
+    // A hit on the distinct path with this hash. The weight is the uniform
+    // density over the one, from which the ray was drawn.
+    void AddHit(unsigned long long path, float weight);
+
+    // The rays this target size needs for the confidence, up to maxRays.
+    // Before the first hit, the rays to find a path by the guess.
+    unsigned long Predicted() const;
+
+    // True if this target size is done: maxRays are traced, the search is
+    // stopped, or there are hits and Predicted() rays are traced.
+    bool Done() const;
+
+    // True if the whole search is done - no more target sizes.
+    bool Stopped() const;
+
+    unsigned long NumRays() const { return mNumRays; }
+    unsigned int NumPaths() const { return mPaths.size(); }
+    qint64 ElapsedMs() const { return mTimer.elapsed(); }
+    const BudgetOptions& Options() const { return mOpts; }
+
+  private:
+    BudgetOptions                         mOpts;
+    QElapsedTimer                         mTimer;
+    unsigned long                         mNumRays;  // For this target size
+    double                                mPrior;    // Hit probability guess
+    std::map<unsigned long long, double>  mPaths;    // Weighted hits per path
+    double                                mSum;      // Of all paths
+    double                                mRarest;   // Of the rarest path
+};
+
+}  // namespace
+
+#endif // BUDGET_H
@@ -0,0 +1,869 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <cstdio>
+#include <csignal>
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <QCoreApplication>
+#include <QTimer>
+#include "cluster.h"
+#include "renderer.h"
+#include "scene.h"
+
+
+namespace circles
+{
+
+const unsigned long SHARD_SIZE   = 65536;  // Rays per shard
+const int MAX_WORKER_RESTARTS    = 10;     // Per worker slot
+const int CHECKPOINT_INTERVAL    = 60;     // Seconds between checkpoints
+const int SIGNAL_POLL_MS         = 200;    // How soon an interrupt is handled
+
+
+// Set by SIGINT or SIGTERM, polled by the coordinator.
+static volatile sig_atomic_t gInterrupted = 0;
+
+static void OnInterrupt( int )
+{
+    gInterrupted = 1;
+}
+
+
+static inline unsigned long long SplitMix64( unsigned long long z )
+{
+    z += 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+
+unsigned long long HashText( const std::string& text )
+{
+    unsigned long long h = 14695981039346656037ULL;
+    for ( std::string::const_iterator c=text.begin(); c != text.end(); ++c )
+        h = (h ^ static_cast<unsigned char>(*c)) * 1099511628211ULL;
+    return h;
+}
+
+
+float SampleAngle( unsigned long i, unsigned long n, unsigned int seed )
+{
+    unsigned long long h = SplitMix64( (static_cast<unsigned long long>(seed) << 40) ^ i );
+    double jitter = (h >> 11) * (1.0 / 9007199254740992.0);  // In [0, 1)
+    return static_cast<float>( 2.0 * M_PI * (i + jitter) / n - M_PI );
+}
+
+
+std::vector<int> HitSequence( const std::vector<Figure*>& scene, const Ray& ray )
+{
+    const std::vector<Point>& trace = ray.GetTrace();
+    std::vector<int> seq;
+
+    // trace[0] is the source, the rest are reflection points.
+    for ( unsigned int k=1; k<trace.size(); ++k )
+    {
+        int best = -1;
+        float bestDist = INF_DIST;
+        for ( unsigned int f=0; f<scene.size(); ++f )
+        {
+            float dist = fabs(trace[k].Distance(scene[f]));
+            if ( dist < bestDist )
+            {
+                bestDist = dist;
+                best = f;
+            }
+        }
+        seq.push_back(best);
+    }
+
+    return seq;
+}
+
+
+/********************************** Worker ************************************/
+
+int RunWorker( int failEvery )
+{
+    std::vector<Figure*> scene;
+    SceneInfo info;
+    std::string line;
+    int shardsStarted = 0;
+
+    std::ios::sync_with_stdio(false);
+    std::cout << std::setprecision(9);
+
+    while ( std::getline(std::cin, line) )
+    {
+        if ( line == "SCENE" )
+        {
+            std::stringstream text;
+            while ( std::getline(std::cin, line) && (line != "SCENE_END") )
+                text << line << std::endl;
+
+            DeleteFigures(&scene);
+            info = SceneInfo();
+            std::stringstream errSStr;
+            ReadScene(text, &scene, &info, errSStr);
+            if ( errSStr.str() != "" )
+                std::cerr << errSStr.str();
+        }
+
+        else if ( line.compare(0, 6, "SHARD ") == 0 )
+        {
+            unsigned long id, first, count, total;
+            unsigned int seed;
+            float targetR;
+            if ( sscanf(line.c_str() + 6, "%lu %lu %lu %lu %u %f",
+                        &id, &first, &count, &total, &seed, &targetR) != 6 )
+            {
+                std::cerr << "Worker: invalid command : " << line << std::endl;
+                continue;
+            }
+
+            if ( (NULL == info.A) || (NULL == info.B) || (info.K < 1) )
+            {
+                std::cerr << "Worker: no valid scene" << std::endl;
+                return 1;
+            }
+
+            ++shardsStarted;
+            bool fail = (failEvery > 0) && (0 == shardsStarted % failEvery);
+
+            Circle target(*info.B, targetR);
+            scene.push_back(&target);
+
+            for ( unsigned long i=first; i<first+count; ++i )
+            {
+                if ( fail && (i == first + count/2) )
+                {
+                    std::cout.flush();
+                    abort();  // Simulate a crash in the middle of a shard.
+                }
+
+                float angle = SampleAngle(i, total, seed);
+                Ray r( *info.A, Vector(cos(angle), sin(angle)) );
+
+                if ( RayTrace(scene, info.A, &r, &target, info.K) )
+                {
+                    std::vector<int> seq = HitSequence(scene, r);
+                    std::cout << "HIT " << id << " " << i << " " << angle
+                              << " " << seq.size();
+                    for ( unsigned int k=0; k<seq.size(); ++k )
+                        std::cout << " " << seq[k];
+
+                    const std::vector<Point>& trace = r.GetTrace();
+                    std::cout << " " << trace.size() + 1;
+                    for ( unsigned int k=0; k<trace.size(); ++k )
+                        std::cout << " " << trace[k].x << " " << trace[k].y;
+                    std::cout << " " << r.GetSrc().x << " " << r.GetSrc().y
+                              << "\n";
+                }
+            }
+
+            scene.pop_back();
+
+            std::cout << "DONE " << id << " " << count << std::endl;  // Flush
+        }
+
+        else if ( line == "QUIT" )
+        {
+            break;
+        }
+    }
+
+    DeleteFigures(&scene);
+    return 0;
+}
+
+
+/******************************** Coordinator *********************************/
+
+CoordinatorOptions::CoordinatorOptions() :
+        sceneFile(),
+        outputFile(),
+        K(-1),
+        numWorkers(QThread::idealThreadCount()),
+        numRays(MAX_NUM_RAYS),
+        shardSize(SHARD_SIZE),
+        seed(1),
+        workerCommand(),
+        failEvery(0),
+        checkpointFile(),
+        checkpointSeconds(CHECKPOINT_INTERVAL),
+        resume(false)
+{
+}
+
+
+Coordinator::Coordinator( const CoordinatorOptions& opts ) :
+        QObject(),
+        mOpts(opts),
+        mSceneText(),
+        mScene(),
+        mA(NULL),
+        mB(NULL),
+        mK(0),
+        mTargetR(0.0f),
+        mMaxTargetR(0.0f),
+        mNumShards(0),
+        mWorkers(),
+        mQueue(),
+        mShardDone(),
+        mShardsLeft(0),
+        mSeen(),
+        mPaths(),
+        mFinished(false),
+        mSceneHash(0),
+        mCheckpointTimer(NULL),
+        mSignalTimer(NULL)
+{
+}
+
+
+Coordinator::~Coordinator()
+{
+    for ( unsigned int w=0; w<mWorkers.size(); ++w )
+    {
+        if ( (NULL != mWorkers[w].proc) &&
+             (mWorkers[w].proc->state() != QProcess::NotRunning) )
+        {
+            mWorkers[w].proc->kill();
+            mWorkers[w].proc->waitForFinished(1000);
+        }
+    }
+
+    DeleteFigures(&mScene);
+}
+
+
+bool Coordinator::Start()
+{
+    unsigned long long savedHash = 0;
+    if ( mOpts.resume && ! ReadCheckpoint(&savedHash) )
+        return false;
+    float savedTargetR = mTargetR;
+
+    std::ifstream inFile(mOpts.sceneFile.c_str(), std::ios::in | std::ios::binary);  // Or a binary scene
+    if ( ! inFile.is_open() )
+    {
+        std::cerr << "Unable to open the input file '" << mOpts.sceneFile
+                  << "'" << std::endl;
+        return false;
+    }
+
+    SceneInfo info;
+    std::stringstream errSStr;
+    ReadScene(inFile, &mScene, &info, errSStr);
+    if ( errSStr.str() != "" )
+        std::cerr << errSStr.str();
+
+    mA = info.A;
+    mB = info.B;
+    mK = (mOpts.K >= 0)? mOpts.K : ((info.K >= 0)? info.K : 0);
+
+    if ( (NULL == mA) || (NULL == mB) )
+    {
+        std::cerr << "Point A or B is missing." << std::endl;
+        return false;
+    }
+
+    TargetSizeRange(mScene, mB, &mTargetR, &mMaxTargetR);
+
+    if ( mK == 0 )
+    {
+        // Nothing to split - trace the only candidate here.
+        Ray r( *mA, *mB );
+        if ( RayTrace(mScene, mA, &r, mB, mK) )
+        {
+            Path p;
+            p.angle = r.GetLaunchAngle();
+            p.miss = 0.0f;
+            p.hits = 1;
+            SolutionArena arena;
+            arena.Add(r);
+            p.points.assign(arena.Points(0), arena.Points(0) + arena.Record(0).length);
+            mPaths[std::vector<int>()] = p;
+        }
+        WriteResults();
+        Finish(0);
+        return true;
+    }
+
+    std::stringstream sceneText;
+    WriteScene(sceneText, mScene, mA, mB, mK, errSStr);
+    mSceneText = sceneText.str();
+    mSceneHash = HashText(mSceneText);
+
+    if ( mOpts.shardSize == 0 )
+        mOpts.shardSize = SHARD_SIZE;
+    mNumShards = (mOpts.numRays + mOpts.shardSize - 1) / mOpts.shardSize;
+
+    if ( mOpts.resume )
+    {
+        if ( (savedHash != mSceneHash) || (mShardDone.size() != mNumShards) )
+        {
+            std::cerr << "The scene '" << mOpts.sceneFile << "' has changed"
+                      << " since the checkpoint" << std::endl;
+            return false;
+        }
+
+        // Issue only the shards, which were not done.
+        mTargetR = savedTargetR;
+        mQueue.clear();
+        mShardsLeft = 0;
+        for ( unsigned long s=0; s<mNumShards; ++s )
+        {
+            if ( ! mShardDone[s] )
+            {
+                mQueue.push_back(s);
+                ++mShardsLeft;
+            }
+        }
+
+        std::cerr << "Resuming: " << (mNumShards - mShardsLeft) << "/"
+                  << mNumShards << " shards done, " << mPaths.size()
+                  << " paths, target radius " << mTargetR << std::endl;
+
+        if ( mShardsLeft == 0 )
+        {
+            WriteResults();
+            Finish(0);
+            return true;
+        }
+    }
+    else
+    {
+        StartRound();
+    }
+
+    if ( ! mOpts.checkpointFile.empty() )
+    {
+        mCheckpointTimer = new QTimer(this);
+        connect(mCheckpointTimer, &QTimer::timeout, this, [this]() { WriteCheckpoint(); });
+        mCheckpointTimer->start(1000 * std::max(1, mOpts.checkpointSeconds));
+
+        // Save the checkpoint when interrupted, not only periodically. The
+        // handler only sets a flag - the rest is done in the event loop.
+        gInterrupted = 0;
+        std::signal(SIGINT, OnInterrupt);
+        std::signal(SIGTERM, OnInterrupt);
+        mSignalTimer = new QTimer(this);
+        connect(mSignalTimer, &QTimer::timeout, this, [this]() { CheckInterrupted(); });
+        mSignalTimer->start(SIGNAL_POLL_MS);
+    }
+
+    mWorkers.resize( (mOpts.numWorkers > 0)? mOpts.numWorkers : 1 );
+    for ( unsigned int w=0; w<mWorkers.size(); ++w )
+    {
+        mWorkers[w].proc = NULL;
+        mWorkers[w].restarts = 0;
+        mWorkers[w].alive = false;
+        StartWorker(w);
+    }
+
+    Dispatch();
+    return true;
+}
+
+
+void Coordinator::StartWorker( int w )
+{
+    Worker& wk = mWorkers[w];
+
+    QString program;
+    QStringList args;
+    if ( mOpts.workerCommand.isEmpty() )
+    {
+        program = QCoreApplication::applicationFilePath();
+    }
+    else
+    {
+#if QT_VERSION >= 0x050e00
+        args = mOpts.workerCommand.split(' ', Qt::SkipEmptyParts);
+#else
+        args = mOpts.workerCommand.split(' ', QString::SkipEmptyParts);
+#endif  // QT_VERSION
+        program = args.takeFirst();
+    }
+    args << "--worker";
+    if ( mOpts.failEvery > 0 )
+        args << "--fail-every" << QString::number(mOpts.failEvery);
+
+    wk.proc = new QProcess(this);
+    wk.proc->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+    wk.shard = -1;
+    wk.buffer.clear();
+
+    connect(wk.proc, &QProcess::readyReadStandardOutput,
+            this, [this, w]() { OnOutput(w); });
+    connect(wk.proc, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+            this, [this, w](int, QProcess::ExitStatus) { OnFinished(w); });
+
+    wk.proc->start(program, args);
+    if ( ! wk.proc->waitForStarted() )
+    {
+        std::cerr << "Unable to start worker " << w << " : "
+                  << program.toStdString() << std::endl;
+        wk.alive = false;
+        return;
+    }
+
+    wk.alive = true;
+    wk.proc->write("SCENE\n");
+    wk.proc->write(mSceneText.c_str(), mSceneText.size());
+    wk.proc->write("SCENE_END\n");
+}
+
+
+void Coordinator::StartRound()
+{
+    mQueue.clear();
+    for ( unsigned long s=0; s<mNumShards; ++s )
+        mQueue.push_back(s);
+
+    mShardDone.assign(mNumShards, false);
+    mShardsLeft = mNumShards;
+    mSeen.clear();
+}
+
+
+void Coordinator::Dispatch()
+{
+    for ( unsigned int w=0; w<mWorkers.size(); ++w )
+    {
+        Worker& wk = mWorkers[w];
+        if ( (! wk.alive) || (wk.shard >= 0) )
+            continue;
+
+        while ( (! mQueue.empty()) && mShardDone[mQueue.front()] )
+            mQueue.pop_front();
+        if ( mQueue.empty() )
+            return;
+
+        unsigned long s = mQueue.front();
+        mQueue.pop_front();
+
+        unsigned long first = s * mOpts.shardSize;
+        unsigned long count = std::min(mOpts.shardSize, mOpts.numRays - first);
+
+        std::stringstream cmd;
+        cmd << std::setprecision(9) << "SHARD " << s << " " << first << " "
+            << count << " " << mOpts.numRays << " " << mOpts.seed << " "
+            << mTargetR << "\n";
+        wk.proc->write(cmd.str().c_str());
+        wk.shard = s;
+    }
+}
+
+
+void Coordinator::OnOutput( int w )
+{
+    Worker& wk = mWorkers[w];
+    wk.buffer.append(wk.proc->readAllStandardOutput());
+
+    int eol;
+    while ( (eol = wk.buffer.indexOf('\n')) >= 0 )
+    {
+        std::string line(wk.buffer.constData(), eol);
+        wk.buffer.remove(0, eol + 1);
+        HandleLine(w, line);
+        if ( mFinished )
+            return;
+    }
+}
+
+
+void Coordinator::HandleLine( int w, const std::string& line )
+{
+    std::istringstream in(line);
+    std::string cmd;
+    in >> cmd;
+
+    if ( cmd == "HIT" )
+    {
+        unsigned long shard, sample;
+        float angle;
+        unsigned int k, n;
+        in >> shard >> sample >> angle >> k;
+
+        std::vector<int> seq(k);
+        for ( unsigned int i=0; i<k; ++i )
+            in >> seq[i];
+
+        in >> n;
+        std::vector<TracePoint> points(n);
+        for ( unsigned int i=0; i<n; ++i )
+            in >> points[i].x >> points[i].y;
+
+        // A re-issued shard sends its solutions again. Only the samples of the
+        // shards in progress are kept, the done ones are skipped.
+        if ( (! in) || (n < 2) || (shard >= mNumShards) || mShardDone[shard] ||
+             (! mSeen.insert(sample).second) )
+            return;
+
+        // Distance from B to the line of the last leg.
+        Vector leg( Point(points[n-2].x, points[n-2].y), Point(points[n-1].x, points[n-1].y) );
+        Vector toB( Point(points[n-2].x, points[n-2].y), *mB );
+        leg.Normalize();
+        float miss = fabs( leg.GetX() * toB.GetY() - leg.GetY() * toB.GetX() );
+
+        std::map<std::vector<int>, Path>::iterator p = mPaths.find(seq);
+        if ( p == mPaths.end() )
+        {
+            Path path = { angle, miss, 1, points };
+            mPaths[seq] = path;
+        }
+        else
+        {
+            ++p->second.hits;
+            if ( miss < p->second.miss )
+            {
+                p->second.angle = angle;
+                p->second.miss = miss;
+                p->second.points.swap(points);
+            }
+        }
+    }
+
+    else if ( cmd == "DONE" )
+    {
+        unsigned long shard;
+        in >> shard;
+
+        mWorkers[w].shard = -1;
+
+        if ( (shard < mNumShards) && (! mShardDone[shard]) )
+        {
+            mShardDone[shard] = true;
+            --mShardsLeft;
+
+            // Its samples can't come again.
+            unsigned long first = shard * mOpts.shardSize;
+            unsigned long count = std::min(mOpts.shardSize, mOpts.numRays - first);
+            mSeen.erase(mSeen.lower_bound(first), mSeen.lower_bound(first + count));
+            std::cerr << "\rShards: " << (mNumShards - mShardsLeft) << "/"
+                      << mNumShards << ", paths: " << mPaths.size()
+                      << "   " << std::flush;
+        }
+
+        if ( mShardsLeft == 0 )
+        {
+            std::cerr << std::endl;
+
+            if ( mPaths.empty() && (mTargetR + INC_TARGET_SIZE <= mMaxTargetR) )
+            {
+                mTargetR += INC_TARGET_SIZE;  // Bigger target is easier to hit.
+                StartRound();
+            }
+            else
+            {
+                WriteResults();
+                Finish(0);
+                return;
+            }
+        }
+
+        Dispatch();
+    }
+}
+
+
+void Coordinator::OnFinished( int w )
+{
+    if ( mFinished )
+        return;
+
+    // Ctrl+C reaches the local workers too - don't restart them.
+    if ( gInterrupted && (NULL != mSignalTimer) )
+    {
+        CheckInterrupted();
+        return;
+    }
+
+    Worker& wk = mWorkers[w];
+    wk.alive = false;
+    wk.proc->deleteLater();
+    wk.proc = NULL;
+
+    if ( (wk.shard >= 0) && (! mShardDone[wk.shard]) )
+    {
+        std::cerr << "Worker " << w << " died, shard " << wk.shard
+                  << " is issued again" << std::endl;
+        mQueue.push_front(wk.shard);
+    }
+    wk.shard = -1;
+
+    if ( wk.restarts < MAX_WORKER_RESTARTS )
+    {
+        ++wk.restarts;
+        StartWorker(w);
+    }
+
+    bool anyAlive = false;
+    for ( unsigned int i=0; i<mWorkers.size(); ++i )
+        anyAlive = anyAlive || mWorkers[i].alive;
+
+    if ( ! anyAlive )
+    {
+        std::cerr << "All workers died" << std::endl;
+        WriteResults();
+        Finish(1);
+        return;
+    }
+
+    Dispatch();
+}
+
+
+void Coordinator::CheckInterrupted()
+{
+    if ( ! gInterrupted || mFinished )
+        return;
+
+    std::cerr << std::endl << "Interrupted" << std::endl;
+    WriteResults();
+    Finish(1);
+}
+
+
+void Coordinator::Finish( int code )
+{
+    mFinished = true;
+
+    if ( NULL != mSignalTimer )
+        mSignalTimer->stop();
+
+    if ( NULL != mCheckpointTimer )
+    {
+        mCheckpointTimer->stop();
+        WriteCheckpoint();  // Also if the workers died - resume later.
+    }
+
+    for ( unsigned int w=0; w<mWorkers.size(); ++w )
+    {
+        if ( mWorkers[w].alive )
+        {
+            mWorkers[w].proc->write("QUIT\n");
+            mWorkers[w].proc->waitForFinished(1000);
+        }
+    }
+
+    // The event loop may not be running yet.
+    QTimer::singleShot(0, [code]() { QCoreApplication::exit(code); });
+}
+
+
+void Coordinator::WriteResults() const
+{
+    std::ofstream outFile;
+    if ( ! mOpts.outputFile.empty() )
+    {
+        outFile.open(mOpts.outputFile.c_str(), std::ios::out);
+        if ( ! outFile.is_open() )
+            std::cerr << "Unable to open the output file '"
+                      << mOpts.outputFile << "'" << std::endl;
+    }
+    std::ostream& out = outFile.is_open()? outFile : std::cout;
+
+    out << std::setprecision(9);
+    out << "# " << mPaths.size() << " distinct paths, K=" << mK
+        << ", target radius " << mTargetR << std::endl;
+    out << "# launch_angle hits miss n x0 y0 ... xn-1 yn-1" << std::endl;
+
+    for ( std::map<std::vector<int>, Path>::const_iterator p=mPaths.begin();
+          p != mPaths.end(); ++p )
+    {
+        out << p->second.angle << " " << p->second.hits << " "
+            << p->second.miss << " " << p->second.points.size();
+        for ( unsigned int i=0; i<p->second.points.size(); ++i )
+            out << " " << p->second.points[i].x << " " << p->second.points[i].y;
+        out << std::endl;
+    }
+
+    if ( mPaths.empty() )
+        std::cerr << "No solutions found" << std::endl;
+}
+
+
+/* The checkpoint is a text file:
+ *   # ReflectiveCircles checkpoint
+ *   version 1
+ *   scene <scene file>
+ *   hash <scene hash> K <K>
+ *   rays <samples> shard <shard size> seed <seed>
+ *   target <target radius>
+ *   done <n> <first>-<last>*n      (ranges of done shards)
+ *   seen <n> <sample>*n            (merged solution samples of the shards
+ *                                   in progress)
+ *   path <angle> <hits> <miss> <k> <figure index>*k <n> <x y>*n
+ *   end */
+void Coordinator::WriteCheckpoint() const
+{
+    if ( mOpts.checkpointFile.empty() || (mNumShards == 0) )
+        return;
+
+    // Write a new file and replace the old one, so a crash meanwhile doesn't
+    // leave a broken checkpoint.
+    std::string tmpName = mOpts.checkpointFile + ".tmp";
+    std::ofstream out(tmpName.c_str(), std::ios::out | std::ios::trunc);
+    if ( ! out.is_open() )
+    {
+        std::cerr << "Unable to write the checkpoint '" << tmpName << "'" << std::endl;
+        return;
+    }
+
+    out << std::setprecision(9);
+    out << "# ReflectiveCircles checkpoint" << std::endl;
+    out << "version 1" << std::endl;
+    out << "scene " << mOpts.sceneFile << std::endl;
+    out << "hash " << mSceneHash << " K " << mK << std::endl;
+    out << "rays " << mOpts.numRays << " shard " << mOpts.shardSize
+        << " seed " << mOpts.seed << std::endl;
+    out << "target " << mTargetR << std::endl;
+
+    std::vector<std::pair<unsigned long, unsigned long> > ranges;
+    for ( unsigned long s=0; s<mNumShards; ++s )
+    {
+        if ( ! mShardDone[s] )
+            continue;
+        if ( (! ranges.empty()) && (ranges.back().second + 1 == s) )
+            ranges.back().second = s;
+        else
+            ranges.push_back(std::make_pair(s, s));
+    }
+    out << "done " << ranges.size();
+    for ( unsigned int r=0; r<ranges.size(); ++r )
+        out << " " << ranges[r].first << "-" << ranges[r].second;
+    out << std::endl;
+
+    out << "seen " << mSeen.size();
+    for ( std::set<unsigned long>::const_iterator s=mSeen.begin(); s != mSeen.end(); ++s )
+        out << " " << *s;
+    out << std::endl;
+
+    for ( std::map<std::vector<int>, Path>::const_iterator p=mPaths.begin();
+          p != mPaths.end(); ++p )
+    {
+        out << "path " << p->second.angle << " " << p->second.hits << " "
+            << p->second.miss << " " << p->first.size();
+        for ( unsigned int i=0; i<p->first.size(); ++i )
+            out << " " << p->first[i];
+        out << " " << p->second.points.size();
+        for ( unsigned int i=0; i<p->second.points.size(); ++i )
+            out << " " << p->second.points[i].x << " " << p->second.points[i].y;
+        out << std::endl;
+    }
+
+    out << "end" << std::endl;
+    out.close();
+
+    if ( out.fail() || (0 != std::rename(tmpName.c_str(), mOpts.checkpointFile.c_str())) )
+        std::cerr << "Unable to write the checkpoint '" << mOpts.checkpointFile
+                  << "'" << std::endl;
+}
+
+
+bool Coordinator::ReadCheckpoint( unsigned long long* sceneHash )
+{
+    std::ifstream in(mOpts.checkpointFile.c_str());
+    if ( ! in.is_open() )
+    {
+        std::cerr << "Unable to open the checkpoint '" << mOpts.checkpointFile
+                  << "'" << std::endl;
+        return false;
+    }
+
+    std::string line;
+    bool complete = false;
+    unsigned long numShards = 0;
+
+    while ( std::getline(in, line) )
+    {
+        std::istringstream row(line);
+        std::string key, word;
+        row >> key;
+
+        if ( key.empty() || (key[0] == '#') )
+            continue;
+
+        if ( key == "version" )
+        {
+            int version = 0;
+            row >> version;
+            if ( version != 1 )
+                break;
+        }
+        else if ( key == "scene" )
+        {
+            std::getline(row >> std::ws, mOpts.sceneFile);
+        }
+        else if ( key == "hash" )
+        {
+            row >> *sceneHash >> word >> mOpts.K;
+        }
+        else if ( key == "rays" )
+        {
+            row >> mOpts.numRays >> word >> mOpts.shardSize >> word >> mOpts.seed;
+            numShards = (mOpts.shardSize > 0)?
+                        (mOpts.numRays + mOpts.shardSize - 1) / mOpts.shardSize : 0;
+            mShardDone.assign(numShards, false);
+        }
+        else if ( key == "target" )
+        {
+            row >> mTargetR;
+        }
+        else if ( key == "done" )
+        {
+            unsigned long n, first, last;
+            char dash;
+            row >> n;
+            for ( unsigned long r=0; (r<n) && (row >> first >> dash >> last); ++r )
+            {
+                for ( unsigned long s=first; (s<=last) && (s<numShards); ++s )
+                    mShardDone[s] = true;
+            }
+        }
+        else if ( key == "seen" )
+        {
+            unsigned long n, sample;
+            row >> n;
+            for ( unsigned long i=0; (i<n) && (row >> sample); ++i )
+                mSeen.insert(sample);
+        }
+        else if ( key == "path" )
+        {
+            Path path;
+            unsigned int k, n;
+            row >> path.angle >> path.hits >> path.miss >> k;
+            std::vector<int> seq(k);
+            for ( unsigned int i=0; i<k; ++i )
+                row >> seq[i];
+            row >> n;
+            path.points.resize(n);
+            for ( unsigned int i=0; i<n; ++i )
+                row >> path.points[i].x >> path.points[i].y;
+            if ( row )
+                mPaths[seq] = path;
+        }
+        else if ( key == "end" )
+        {
+            complete = true;
+            break;
+        }
+    }
+
+    if ( (! complete) || mOpts.sceneFile.empty() || (numShards == 0) )
+    {
+        std::cerr << "Invalid checkpoint '" << mOpts.checkpointFile << "'" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+}  // namespace
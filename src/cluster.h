@@ -0,0 +1,155 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+
+#include "qglobal.h"
+#include <QObject>
+#include <QProcess>
+#include <QThread>
+#include <QStringList>
+#include <QTimer>
+
+#include "geometry.h"
+#include "solutions.h"
+
+
+namespace circles
+{
+
+extern const unsigned long SHARD_SIZE;
+extern const int MAX_WORKER_RESTARTS;
+extern const int CHECKPOINT_INTERVAL;
+extern const int SIGNAL_POLL_MS;
+
+
+// Deterministic launch angle of sample i out of n - a jittered stratified
+// sample, so a shard gives the same rays wherever and whenever it runs.
+float SampleAngle(unsigned long i, unsigned long n, unsigned int seed);
+
+// FNV-1a hash of a text.
+unsigned long long HashText(const std::string& text);
+
+// Indexes of the figures, on which the reflection points of the ray lie.
+std::vector<int> HitSequence(const std::vector<Figure*>& scene, const Ray& ray);
+
+
+/********************************** Worker ************************************/
+
+/* A worker reads commands from stdin and writes results to stdout, so it can
+ * run locally or be started through a remote shell:
+ *   SCENE / <scene file rows> / SCENE_END
+ *   SHARD <id> <first sample> <count> <total samples> <seed> <target radius>
+ *   QUIT
+ * For each solution it writes
+ *   HIT <shard> <sample> <angle> <k> <figure index>*k <n> <x y>*n
+ * and at the end of each shard
+ *   DONE <shard> <count>
+ * failEvery > 0 makes the worker abort after that many shards (for testing). */
+int RunWorker(int failEvery);
+
+
+/******************************** Coordinator *********************************/
+
+struct CoordinatorOptions
+{
+    CoordinatorOptions();
+
+    std::string   sceneFile;
+    std::string   outputFile;    // Empty for stdout
+    int           K;             // -1 to take it from the scene file
+    int           numWorkers;
+    unsigned long numRays;
+    unsigned long shardSize;
+    unsigned int  seed;
+    QString       workerCommand; // Empty for this binary; e.g. "ssh host circles"
+    int           failEvery;     // Passed to the workers
+    std::string   checkpointFile;    // Empty for no checkpoints
+    int           checkpointSeconds;
+    bool          resume;        // Continue from checkpointFile
+};
+
+
+/* Splits the launch angle samples into shards, sends them to worker processes
+ * and merges the solutions streamed back, one per distinct hit sequence. A
+ * shard of a crashed worker is issued again, and the worker is restarted.
+ *
+ * The state can be saved periodically in a checkpoint file, and when the
+ * coordinator is stopped with SIGINT or SIGTERM. The samples are fixed by the
+ * seed, so the done shards are all of the sampler's position. A resumed run
+ * reloads the scene file, checks its hash and issues only the shards, which
+ * were not done. */
+class Coordinator : public QObject
+{
+    Q_OBJECT
+
+  public:
+    Coordinator(const CoordinatorOptions& opts);
+    ~Coordinator();
+
+    // Loads the scene and starts the workers. Returns false on error.
+    bool Start();
+
+  private:
+    struct Worker
+    {
+        QProcess*   proc;
+        int         shard;     // In progress or -1
+        QByteArray  buffer;    // Incomplete output line
+        int         restarts;
+        bool        alive;
+    };
+
+    struct Path
+    {
+        float                    angle;  // Of the best ray so far
+        float                    miss;   // Distance from B to its last leg
+        unsigned long            hits;
+        std::vector<TracePoint>  points;
+    };
+
+    void StartWorker(int w);
+    void OnOutput(int w);
+    void OnFinished(int w);
+    void HandleLine(int w, const std::string& line);
+    void Dispatch();
+    void StartRound();
+    // Writes the results and the checkpoint after SIGINT or SIGTERM.
+    void CheckInterrupted();
+    void Finish(int code);
+    void WriteResults() const;
+    bool ReadCheckpoint(unsigned long long* sceneHash);
+    void WriteCheckpoint() const;
+
+    CoordinatorOptions          mOpts;
+    std::string                 mSceneText;  // Shipped to the workers
+    std::vector<Figure*>        mScene;      // To measure the misses
+    Point*                      mA;
+    Point*                      mB;
+    int                         mK;
+    float                       mTargetR;
+    float                       mMaxTargetR;
+    unsigned long               mNumShards;
+    std::vector<Worker>         mWorkers;
+    std::deque<unsigned long>   mQueue;      // Shards to do
+    std::vector<bool>           mShardDone;
+    unsigned long               mShardsLeft;
+    std::set<unsigned long>     mSeen;       // Merged samples of the shards in progress
+    std::map<std::vector<int>, Path> mPaths;
+    bool                        mFinished;
+    unsigned long long          mSceneHash;
+    QTimer*                     mCheckpointTimer;
+    QTimer*                     mSignalTimer;  // Polls for SIGINT and SIGTERM
+};
+
+}  // namespace
+
+#endif // CLUSTER_H
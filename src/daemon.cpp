@@ -0,0 +1,446 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <QCoreApplication>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QJsonValue>
+#include <QRunnable>
+#include "daemon.h"
+#include "scene.h"
+#include "cluster.h"
+
+
+namespace circles
+{
+
+const int DAEMON_MAX_SCENES = 8;  // Prepared scenes kept by default
+
+
+static QString SceneId( unsigned long long id )
+{
+    return QString("%1").arg(static_cast<qulonglong>(id), 16, 16, QChar('0'));
+}
+
+
+static QJsonArray SolutionsToJson( const SolutionArena& solutions, unsigned int first )
+{
+    QJsonArray array;
+    for ( unsigned int s=first; s<solutions.Size(); ++s )
+    {
+        const SolutionRecord& rec = solutions.Record(s);
+        const TracePoint* points = solutions.Points(s);
+
+        QJsonArray coords;
+        for ( unsigned int i=0; i<rec.length; ++i )
+        {
+            coords.append(points[i].x);
+            coords.append(points[i].y);
+        }
+
+        QJsonObject sol;
+        sol["angle"] = rec.launchAngle;
+        sol["length"] = rec.pathLength;
+        sol["points"] = coords;
+        array.append(sol);
+    }
+    return array;
+}
+
+
+static bool JsonToPoint( const QJsonValue& value, Point* point )
+{
+    QJsonArray xy = value.toArray();
+    if ( (xy.size() != 2) || ! xy[0].isDouble() || ! xy[1].isDouble() )
+        return false;
+
+    point->x = xy[0].toDouble();
+    point->y = xy[1].toDouble();
+    return true;
+}
+
+
+// Sends the solutions of a query as they are found, if asked to, and stops it
+// when the client is gone.
+class DaemonListener : public PathListener
+{
+  public:
+    DaemonListener( SolverDaemon* daemon, quint64 client, const QJsonValue& tag,
+                    bool stream, const QSharedPointer<QAtomicInt>& cancelled ) :
+        mDaemon(daemon), mClient(client), mTag(tag), mStream(stream),
+        mCancelled(cancelled)
+    {
+    }
+
+    void Found( const SolutionArena& solutions, unsigned int first )
+    {
+        if ( ! mStream )
+            return;
+
+        QJsonObject partial;
+        if ( ! mTag.isUndefined() )
+            partial["tag"] = mTag;
+        partial["partial"] = SolutionsToJson(solutions, first);
+        mDaemon->Send(mClient, partial);
+    }
+
+    bool Stop()
+    {
+        return mCancelled->loadAcquire() != 0;
+    }
+
+  private:
+    SolverDaemon*               mDaemon;
+    quint64                     mClient;
+    QJsonValue                  mTag;
+    bool                        mStream;
+    QSharedPointer<QAtomicInt>  mCancelled;
+};
+
+
+// Runs one request on the daemon's pool.
+class DaemonTask : public QRunnable
+{
+  public:
+    DaemonTask( SolverDaemon* daemon, quint64 client, const QJsonObject& request,
+                const QSharedPointer<QAtomicInt>& cancelled ) :
+        mDaemon(daemon), mClient(client), mRequest(request), mCancelled(cancelled)
+    {
+    }
+
+    void run()
+    {
+        mDaemon->Execute(mClient, mRequest, mCancelled);
+    }
+
+  private:
+    SolverDaemon*               mDaemon;
+    quint64                     mClient;
+    QJsonObject                 mRequest;
+    QSharedPointer<QAtomicInt>  mCancelled;
+};
+
+
+/******************************** SolverDaemon ********************************/
+
+SolverDaemon::SolverDaemon( const DaemonOptions& opts ) :
+        QObject(),
+        mOpts(opts),
+        mServer(NULL),
+        mPool(),
+        mClients(),
+        mNextClient(0),
+        mMutex(),
+        mScenes(),
+        mRunning(0)
+{
+    if ( mOpts.numThreads > 0 )
+        mPool.setMaxThreadCount(mOpts.numThreads);
+    if ( mOpts.maxScenes < 1 )
+        mOpts.maxScenes = 1;
+}
+
+
+SolverDaemon::~SolverDaemon()
+{
+    for ( std::map<quint64, Client>::iterator c=mClients.begin();
+          c != mClients.end(); ++c )
+        c->second.cancelled->storeRelease(1);
+
+    mPool.waitForDone();
+}
+
+
+bool SolverDaemon::Start()
+{
+    mServer = new QLocalServer(this);
+    QLocalServer::removeServer(mOpts.socketName);  // Left by a killed daemon
+
+    if ( ! mServer->listen(mOpts.socketName) )
+    {
+        std::cerr << "Unable to listen on '" << mOpts.socketName.toStdString()
+                  << "' : " << mServer->errorString().toStdString() << std::endl;
+        return false;
+    }
+
+    connect(mServer, &QLocalServer::newConnection, this, [this]() { OnConnection(); });
+
+    std::cerr << "Listening on " << mServer->fullServerName().toStdString()
+              << " with " << mPool.maxThreadCount() << " threads" << std::endl;
+    return true;
+}
+
+
+void SolverDaemon::OnConnection()
+{
+    while ( mServer->hasPendingConnections() )
+    {
+        quint64 id = mNextClient++;
+        Client client;
+        client.socket = mServer->nextPendingConnection();
+        client.cancelled = QSharedPointer<QAtomicInt>(new QAtomicInt(0));
+        mClients[id] = client;
+
+        connect(client.socket, &QLocalSocket::readyRead, this, [this, id]() { OnReadyRead(id); });
+        connect(client.socket, &QLocalSocket::disconnected, this, [this, id]() { OnDisconnected(id); });
+    }
+}
+
+
+void SolverDaemon::OnReadyRead( quint64 id )
+{
+    std::map<quint64, Client>::iterator c = mClients.find(id);
+    if ( c == mClients.end() )
+        return;
+
+    while ( c->second.socket->canReadLine() )
+    {
+        QByteArray line = c->second.socket->readLine().trimmed();
+        if ( line.isEmpty() )
+            continue;
+
+        QJsonParseError err;
+        QJsonDocument doc = QJsonDocument::fromJson(line, &err);
+        if ( (err.error != QJsonParseError::NoError) || ! doc.isObject() )
+        {
+            QJsonObject response;
+            response["error"] = QString("Invalid JSON: ") + err.errorString();
+            Send(id, response);
+            continue;
+        }
+
+        mRunning.ref();
+        mPool.start(new DaemonTask(this, id, doc.object(), c->second.cancelled));  // Auto-deleted
+    }
+}
+
+
+void SolverDaemon::OnDisconnected( quint64 id )
+{
+    std::map<quint64, Client>::iterator c = mClients.find(id);
+    if ( c == mClients.end() )
+        return;
+
+    c->second.cancelled->storeRelease(1);  // Stops its queries.
+    c->second.socket->deleteLater();
+    mClients.erase(c);
+}
+
+
+void SolverDaemon::Send( quint64 client, const QJsonObject& response )
+{
+    // The socket belongs to the main thread.
+    QByteArray line = QJsonDocument(response).toJson(QJsonDocument::Compact);
+    line.append('\n');
+    QMetaObject::invokeMethod(this, "sendLine", Qt::QueuedConnection,
+                              Q_ARG(quint64, client), Q_ARG(QByteArray, line));
+}
+
+
+void SolverDaemon::sendLine( quint64 client, const QByteArray& line )
+{
+    std::map<quint64, Client>::iterator c = mClients.find(client);
+    if ( c != mClients.end() )
+        c->second.socket->write(line);
+}
+
+
+void SolverDaemon::Execute( quint64 client, const QJsonObject& request,
+                            const QSharedPointer<QAtomicInt>& cancelled )
+{
+    QJsonObject response;
+    QString op = request["op"].toString();
+
+    if ( op == "load" )
+        Load(request, &response);
+    else if ( op == "query" )
+        Query(client, request, cancelled, &response);
+    else if ( op == "stats" )
+    {
+        QJsonArray ids;
+        QMutexLocker lock(&mMutex);
+        for ( std::list<CachedScene>::const_iterator s=mScenes.begin();
+              s != mScenes.end(); ++s )
+            ids.append(SceneId(s->id));
+        response["scenes"] = ids;
+        response["running"] = mRunning.loadAcquire();
+    }
+    else
+        response["error"] = QString("Unknown op '") + op + "'";
+
+    if ( request.contains("tag") )
+        response["tag"] = request["tag"];
+    Send(client, response);
+
+    mRunning.deref();
+}
+
+
+QSharedPointer<const PreparedScene> SolverDaemon::FindScene( unsigned long long id )
+{
+    QMutexLocker lock(&mMutex);
+    return FindSceneLocked(id);
+}
+
+
+QSharedPointer<const PreparedScene> SolverDaemon::FindSceneLocked( unsigned long long id )
+{
+    for ( std::list<CachedScene>::iterator s=mScenes.begin(); s != mScenes.end(); ++s )
+    {
+        if ( s->id == id )
+        {
+            mScenes.splice(mScenes.begin(), mScenes, s);
+            return mScenes.front().scene;
+        }
+    }
+    return QSharedPointer<const PreparedScene>();
+}
+
+
+void SolverDaemon::Load( const QJsonObject& request, QJsonObject* response )
+{
+    std::string text;
+    if ( request.contains("text") )
+        text = request["text"].toString().toStdString();
+    else
+    {
+        std::string fileName = request["file"].toString().toStdString();
+        std::ifstream inFile(fileName.c_str(), std::ios::in | std::ios::binary);
+        if ( ! inFile.is_open() )
+        {
+            (*response)["error"] = QString::fromStdString("Unable to open the input file '" + fileName + "'");
+            return;
+        }
+        std::stringstream content;
+        content << inFile.rdbuf();
+        text = content.str();
+    }
+
+    unsigned long long id = HashText(text);
+    QSharedPointer<const PreparedScene> scene = FindScene(id);
+    (*response)["cached"] = ! scene.isNull();
+
+    if ( scene.isNull() )
+    {
+        // Prepared outside of the lock - the other requests go on meanwhile.
+        std::istringstream in(text);
+        std::vector<Figure*> figures;
+        SceneInfo info;
+        std::stringstream errSStr;
+        if ( ! ReadScene(in, &figures, &info, errSStr) )
+        {
+            DeleteFigures(&figures);
+            (*response)["error"] = QString::fromStdString(errSStr.str());
+            return;
+        }
+        scene = QSharedPointer<const PreparedScene>(new PreparedScene(figures));
+        DeleteFigures(&figures);
+
+        // Another request may have prepared the same scene meanwhile.
+        QMutexLocker lock(&mMutex);
+        QSharedPointer<const PreparedScene> other = FindSceneLocked(id);
+        if ( ! other.isNull() )
+            scene = other;
+        else
+        {
+            CachedScene cached;
+            cached.id = id;
+            cached.scene = scene;
+            mScenes.push_front(cached);
+            while ( static_cast<int>(mScenes.size()) > mOpts.maxScenes )
+                mScenes.pop_back();  // Its running queries keep it alive.
+        }
+
+        if ( errSStr.str() != "" )
+            (*response)["warning"] = QString::fromStdString(errSStr.str());
+    }
+
+    (*response)["id"] = SceneId(id);
+    (*response)["circles"] = static_cast<int>(scene->NumCircles());
+}
+
+
+void SolverDaemon::Query( quint64 client, const QJsonObject& request,
+                          const QSharedPointer<QAtomicInt>& cancelled,
+                          QJsonObject* response )
+{
+    bool ok = false;
+    unsigned long long id = request["id"].toString().toULongLong(&ok, 16);
+    QSharedPointer<const PreparedScene> scene;
+    if ( ok )
+        scene = FindScene(id);
+    if ( scene.isNull() )
+    {
+        (*response)["error"] = QString("Unknown scene id - load the scene first");
+        return;
+    }
+
+    PathQuery query;
+    if ( ! JsonToPoint(request["A"], &query.A) || ! JsonToPoint(request["B"], &query.B) ||
+         ! request["K"].isDouble() )
+    {
+        (*response)["error"] = QString("A, B or K is missing or invalid");
+        return;
+    }
+    query.K = request["K"].toInt();
+
+    // Negative numbers can't be cast to the unsigned counts.
+    if ( request.contains("rays") && (request["rays"].toDouble() < MIN_NUM_RAYS) )
+    {
+        (*response)["error"] = QString("Invalid rays, at least %1 are traced").arg(static_cast<int>(MIN_NUM_RAYS));
+        return;
+    }
+    if ( (request["ms"].toDouble() < 0.0) || (request["paths"].toDouble() < 0.0) )
+    {
+        (*response)["error"] = QString("Invalid ms or paths");
+        return;
+    }
+
+    BudgetOptions budget;
+    if ( request.contains("rays") )
+        budget.maxRays = static_cast<unsigned long>( request["rays"].toDouble() );
+    if ( request.contains("ms") )
+        budget.maxMs = static_cast<qint64>( request["ms"].toDouble() );
+    if ( request.contains("paths") )
+        budget.maxPaths = static_cast<unsigned int>( request["paths"].toDouble() );
+    if ( request.contains("confidence") )
+        budget.confidence = request["confidence"].toDouble();
+    if ( (budget.maxRays == 0) || (budget.confidence >= 1.0f) )
+    {
+        (*response)["error"] = QString("Invalid rays or confidence");
+        return;
+    }
+
+    bool stream = request["stream"].toBool();
+    DaemonListener listener(this, client, request["tag"], stream, cancelled);
+    PathResult result;
+    scene->Solve(query, budget, &result, &listener);
+
+    (*response)["done"] = true;
+    (*response)["valid"] = result.valid;
+    (*response)["targetR"] = result.targetR;
+    (*response)["rays"] = static_cast<double>(result.numRays);
+    (*response)["count"] = static_cast<int>(result.solutions.Size());
+    if ( ! stream )
+        (*response)["solutions"] = SolutionsToJson(result.solutions, 0);
+}
+
+
+/********************************* RunDaemon **********************************/
+
+int RunDaemon( const DaemonOptions& opts )
+{
+    SolverDaemon daemon(opts);
+    if ( ! daemon.Start() )
+        return 1;
+
+    return QCoreApplication::exec();
+}
+
+}  // namespace
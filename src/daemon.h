@@ -0,0 +1,126 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "qglobal.h"
+#include <QObject>
+#include <QString>
+#include <QByteArray>
+#include <QJsonObject>
+#include <QSharedPointer>
+#include <QThreadPool>
+#include <QMutex>
+#include <QAtomicInt>
+
+#include "batch.h"
+
+class QLocalServer;
+class QLocalSocket;
+
+
+namespace circles
+{
+
+extern const int DAEMON_MAX_SCENES;
+
+
+/******************************** SolverDaemon ********************************/
+
+struct DaemonOptions
+{
+    DaemonOptions() : socketName(), maxScenes(DAEMON_MAX_SCENES), numThreads(0) {}
+
+    QString socketName;  // A path, or a name in the temp dir
+    int     maxScenes;   // Prepared scenes kept in memory
+    int     numThreads;  // 0 for one per core
+};
+
+
+/* Serves queries over a local (Unix domain) socket and keeps the prepared
+ * scenes in memory between them. Each request is a line of JSON and each
+ * response is one or more lines of JSON, with the request's "tag" copied:
+ *   {"op":"load", "file":"scene.txt"}  or  {"op":"load", "text":"<scene>"}
+ *     -> {"id":"<scene id>", "circles":N, "cached":true|false}
+ *   {"op":"query", "id":"<scene id>", "A":[x,y], "B":[x,y], "K":N,
+ *    "rays":N, "ms":N, "paths":N, "confidence":C, "stream":true|false}
+ *     -> {"partial":[<solution>...]}...  only if streamed, then
+ *        {"done":true, "valid":..., "targetR":..., "rays":..., "count":N,
+ *         "solutions":[<solution>...]}  (without the solutions if streamed)
+ *   {"op":"stats"} -> {"scenes":["<scene id>"...], "running":N}
+ * The budget fields are optional, see BudgetOptions. A solution is
+ * {"angle":a, "length":l, "points":[x0,y0,x1,y1,...]}. Errors
+ * are {"error":"<text>"}. The scene id is the hash of the scene text, so a
+ * scene, which is loaded again, is found in memory. The least recently used
+ * scenes are dropped beyond maxScenes. All requests run concurrently on one
+ * thread pool; the queries of a client, which disconnects, are stopped. */
+class SolverDaemon : public QObject
+{
+    Q_OBJECT
+
+  public:
+    explicit SolverDaemon(const DaemonOptions& opts);
+    ~SolverDaemon();
+
+    // Starts listening. Returns false on error.
+    bool Start();
+
+    // Runs a request and sends the responses. Called from the pool's threads.
+    void Execute(quint64 client, const QJsonObject& request,
+                 const QSharedPointer<QAtomicInt>& cancelled);
+
+    // Queues a response line to the client, from any thread.
+    void Send(quint64 client, const QJsonObject& response);
+
+  public slots:
+    void sendLine(quint64 client, const QByteArray& line);
+
+  private:
+    struct Client
+    {
+        QLocalSocket*               socket;
+        QSharedPointer<QAtomicInt>  cancelled;  // Set when it disconnects
+    };
+
+    struct CachedScene
+    {
+        unsigned long long                   id;
+        QSharedPointer<const PreparedScene>  scene;
+    };
+
+    void OnConnection();
+    void OnReadyRead(quint64 client);
+    void OnDisconnected(quint64 client);
+
+    void Load(const QJsonObject& request, QJsonObject* response);
+    void Query(quint64 client, const QJsonObject& request,
+               const QSharedPointer<QAtomicInt>& cancelled, QJsonObject* response);
+
+    // The scene, which becomes the most recently used one, or NULL.
+    QSharedPointer<const PreparedScene> FindScene(unsigned long long id);
+    // The same, with mMutex locked by the caller.
+    QSharedPointer<const PreparedScene> FindSceneLocked(unsigned long long id);
+
+    DaemonOptions                 mOpts;
+    QLocalServer*                 mServer;
+    QThreadPool                   mPool;
+    std::map<quint64, Client>     mClients;   // Only used by the main thread
+    quint64                       mNextClient;
+    QMutex                        mMutex;     // Guards mScenes
+    std::list<CachedScene>        mScenes;    // The most recently used first
+    QAtomicInt                    mRunning;   // Requests
+};
+
+
+// Runs the daemon until it is killed.
+int RunDaemon(const DaemonOptions& opts);
+
+}  // namespace
+
+#endif // DAEMON_H
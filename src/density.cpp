@@ -0,0 +1,314 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <cmath>
+#include <algorithm>
+#include <QThreadPool>
+#include <QRunnable>
+#include "density.h"
+#include "cluster.h"
+#include "scene.h"
+
+
+namespace circles
+{
+
+const unsigned long DENSITY_NUM_RAYS = 4000000;  // Traced for a density image
+const unsigned long DENSITY_BATCH    = 4096;     // Rays taken by a task at once
+const float DENSITY_WHITE_POINT      = 0.999f;   // Quantile shown at full brightness
+const float DENSITY_MARGIN           = 0.1f;     // Around the scene, of its size
+
+
+/******************************** DensityField ********************************/
+
+void DensityField::Bounds( const std::vector<Figure*>& figures, int width, int height,
+                           QRectF* area, int* fieldWidth, int* fieldHeight )
+{
+    SceneInfo info;
+    SceneBounds(figures, &info);
+    if ( info.minX > info.maxX )
+        info.minX = info.minY = info.maxX = info.maxY = 0.0f;  // No figures
+
+    float w = info.maxX - info.minX;
+    float h = info.maxY - info.minY;
+    float margin = std::max(DENSITY_MARGIN * std::max(w, h), 1.0f);
+    w += 2.0f * margin;
+    h += 2.0f * margin;
+    *area = QRectF(info.minX - margin, info.minY - margin, w, h);
+
+    float scale = sqrt(std::max(width, 1) * std::max(height, 1) / (w * h));
+    *fieldWidth = std::max(1, static_cast<int>( ceil(w * scale) ));
+    *fieldHeight = std::max(1, static_cast<int>( ceil(h * scale) ));
+}
+
+
+void DensityField::AddSegment( float x0, float y0, float x1, float y1 )
+{
+    // To the pixels of the field.
+    x0 = (x0 - mArea.left()) * mScaleX;
+    y0 = (y0 - mArea.top()) * mScaleY;
+    x1 = (x1 - mArea.left()) * mScaleX;
+    y1 = (y1 - mArea.top()) * mScaleY;
+
+    // Liang-Barsky clipping to [0, width) x [0, height).
+    const float xMax = mWidth - 0.001f;
+    const float yMax = mHeight - 0.001f;
+    float dx = x1 - x0;
+    float dy = y1 - y0;
+    float t0 = 0.0f, t1 = 1.0f;
+
+    const float p[4] = { -dx, dx, -dy, dy };
+    const float q[4] = { x0, xMax - x0, y0, yMax - y0 };
+    for ( int i=0; i<4; ++i )
+    {
+        if ( p[i] == 0.0f )
+        {
+            if ( q[i] < 0.0f )
+                return;  // Parallel and outside
+            continue;
+        }
+        float t = q[i] / p[i];
+        if ( p[i] < 0.0f )
+            t0 = std::max(t0, t);
+        else
+            t1 = std::min(t1, t);
+    }
+    if ( t0 >= t1 )
+        return;
+
+    float ax = x0 + t0*dx, ay = y0 + t0*dy;
+    float bx = x0 + t1*dx, by = y0 + t1*dy;
+
+    // DDA with one sample per pixel along the longer axis. Each sample gets
+    // its share of the segment's length.
+    float len = Module(bx - ax, by - ay);
+    int n = static_cast<int>( ceil(std::max(fabs(bx - ax), fabs(by - ay))) );
+    if ( n < 1 )
+        n = 1;
+    float sx = (bx - ax) / n, sy = (by - ay) / n;
+    float w = len / n;
+
+    // Not accumulated, so the rounding doesn't drift off the field.
+    for ( int i=0; i<n; ++i )
+    {
+        int x = static_cast<int>( ax + (i + 0.5f)*sx );
+        int y = static_cast<int>( ay + (i + 0.5f)*sy );
+        x = std::min(std::max(x, 0), mWidth - 1);
+        y = std::min(std::max(y, 0), mHeight - 1);
+        mData[y * mWidth + x] += w;
+    }
+}
+
+
+void DensityField::Merge( const DensityField& other )
+{
+    for ( unsigned int i=0; i<mData.size(); ++i )
+        mData[i] += other.mData[i];
+}
+
+
+QImage DensityField::ToneMap() const
+{
+    QImage image(mWidth, mHeight, QImage::Format_ARGB32);
+    image.fill(0);
+
+    // The pixels next to A are far brighter than the rest - saturate the
+    // brightest ones instead of scaling by the maximum.
+    std::vector<float> lit;
+    lit.reserve(mData.size());
+    for ( unsigned int i=0; i<mData.size(); ++i )
+        if ( mData[i] > 0.0f )
+            lit.push_back(mData[i]);
+    if ( lit.empty() )
+        return image;
+
+    std::vector<float>::iterator white = lit.begin() +
+        static_cast<unsigned int>( DENSITY_WHITE_POINT * (lit.size() - 1) );
+    std::nth_element(lit.begin(), white, lit.end());
+    const float scale = 1.0f / log1p(*white);
+
+    for ( int y=0; y<mHeight; ++y )
+    {
+        QRgb* line = reinterpret_cast<QRgb*>( image.scanLine(y) );
+        const float* row = &mData[y * mWidth];
+        for ( int x=0; x<mWidth; ++x )
+        {
+            if ( row[x] <= 0.0f )
+                continue;
+
+            float v = std::min(1.0f, static_cast<float>(log1p(row[x]) * scale));
+            // From dark red through orange to pale yellow.
+            int alpha = static_cast<int>(255.0f * sqrt(v));
+            int g = static_cast<int>(64.0f + 191.0f * v);
+            int b = static_cast<int>(160.0f * v * v);
+            line[x] = qRgba(255, g, b, alpha);
+        }
+    }
+
+    return image;
+}
+
+
+/******************************* DensityThread ********************************/
+
+// Takes the next batch of rays until there are no more.
+class DensityTask : public QRunnable
+{
+  public:
+    DensityTask( const DensityThread& thread, const FlatScene& flat,
+                 const VisibilityGraph* graph, QAtomicInt* next,
+                 DensityField* field ) :
+        mThread(thread), mFlat(flat), mGraph(graph), mNext(next), mField(field),
+        mWedge()
+    {
+        mWedge.reserve(flat.Size());
+    }
+
+    void run()
+    {
+        const unsigned long numBatches = (DENSITY_NUM_RAYS + DENSITY_BATCH - 1) / DENSITY_BATCH;
+        unsigned long b;
+        while ( ((b = mNext->fetchAndAddOrdered(1)) < numBatches) &&
+                ! mThread.isInterruptionRequested() )
+        {
+            unsigned long first = b * DENSITY_BATCH;
+            unsigned long last = std::min(first + DENSITY_BATCH, DENSITY_NUM_RAYS);
+            mThread.TraceRays(mFlat, mGraph, first, last, DENSITY_NUM_RAYS,
+                              &mWedge, mField);
+        }
+    }
+
+  private:
+    const DensityThread&    mThread;
+    const FlatScene&        mFlat;
+    const VisibilityGraph*  mGraph;
+    QAtomicInt*             mNext;
+    DensityField*           mField;
+    std::vector<int>        mWedge;
+};
+
+
+void DensityThread::TraceRays( const FlatScene& flat, const VisibilityGraph* graph,
+                               unsigned long first, unsigned long last,
+                               unsigned long numRays, std::vector<int>* wedge,
+                               DensityField* field ) const
+{
+    const Point* A = mSnapshot->A();
+    // Longer than any leg inside the field, which has A inside.
+    const float escape = 2.0f * (field->Area().width() + field->Area().height());
+
+    // The rays are in a narrow wedge - find the circles in it for the first
+    // leg once, like PacketTracer does for a packet.
+    const float twoPi = 2.0f * static_cast<float>(M_PI);
+    const float wedgeMin = SampleAngle(first, numRays, 1);
+    const float wedgeMax = SampleAngle(last - 1, numRays, 1);
+    wedge->clear();
+    for ( unsigned int c=0; c<flat.Size(); ++c )
+    {
+        float d = remainder(flat.phi[c] - 0.5f*(wedgeMin + wedgeMax), twoPi);
+        if ( fabs(d) <= 0.5f*(wedgeMax - wedgeMin) + flat.halfW[c] )
+            wedge->push_back(c);  // Reserved - doesn't allocate
+    }
+
+    for ( unsigned long i=first; i<last; ++i )
+    {
+        float angle = SampleAngle(i, numRays, 1);
+        float sx = A->x, sy = A->y;
+        float dx = cos(angle), dy = sin(angle);
+        int on = -1;
+
+        for ( int k=0; k<=mK; ++k )
+        {
+            float best = INF_DIST;
+            int bestIdx = -1;
+
+            // The same test as PacketTracer::TestLane().
+            // The wedge first, then the graph's candidates or all circles.
+            int count = wedge->size();
+            const int* cand = wedge->empty()? NULL : &(*wedge)[0];
+            if ( k > 0 )
+            {
+                if ( graph != NULL )
+                    cand = graph->Candidates(on, atan2(dy, dx), &count);
+                else
+                {
+                    count = flat.Size();
+                    cand = NULL;
+                }
+            }
+
+            for ( int n=0; n<count; ++n )
+            {
+                int c = (cand != NULL)? cand[n] : n;
+                float smcx = sx - flat.cx[c];
+                float smcy = sy - flat.cy[c];
+                float h = dx*smcx + dy*smcy;
+                float disc = h*h - (smcx*smcx + smcy*smcy - flat.r2[c]);
+                float t = (disc < 0.25f*EPSILON)? -h : -h - sqrt(fabs(disc));
+                if ( (disc >= 0.0f) && (t > 0.0f) && (on != c) && (t < best) )
+                {
+                    best = t;
+                    bestIdx = c;
+                }
+            }
+
+            if ( bestIdx < 0 )
+            {
+                field->AddSegment(sx, sy, sx + escape*dx, sy + escape*dy);
+                break;
+            }
+
+            float px = sx + best*dx;
+            float py = sy + best*dy;
+            field->AddSegment(sx, sy, px, py);
+
+            // Reflect: r = Dir - 2(n.Dir)n
+            float nx = (px - flat.cx[bestIdx]) / flat.r[bestIdx];
+            float ny = (py - flat.cy[bestIdx]) / flat.r[bestIdx];
+            float ndot = 2.0f * (nx*dx + ny*dy);
+            dx -= ndot * nx;
+            dy -= ndot * ny;
+            float len = sqrt(dx*dx + dy*dy);
+            dx /= len;
+            dy /= len;
+            sx = px;
+            sy = py;
+            on = bestIdx;
+        }
+    }
+}
+
+
+void DensityThread::run()
+{
+    FlatScene flat;
+    flat.Build(mSnapshot->Figures(), NULL, *mSnapshot->A());
+    QSharedPointer<const VisibilityGraph> graph = VisibilityGraph::Cached(flat);
+
+    // A field per task, allocated before tracing.
+    QRectF area;
+    int fieldWidth, fieldHeight;
+    DensityField::Bounds(mSnapshot->Figures(), mWidth, mHeight, &area, &fieldWidth, &fieldHeight);
+    int numTasks = std::max(1, QThread::idealThreadCount());
+    std::vector<DensityField*> fields;
+    for ( int i=0; i<numTasks; ++i )
+        fields.push_back(new DensityField(area, fieldWidth, fieldHeight));
+
+    QAtomicInt next(0);
+    QThreadPool pool;
+    for ( int i=0; i<numTasks; ++i )
+        pool.start(new DensityTask(*this, flat, graph.data(), &next, fields[i]));  // Auto-deleted
+    pool.waitForDone();
+
+    // Show what was traced, even if interrupted.
+    for ( int i=1; i<numTasks; ++i )
+        fields[0]->Merge(*fields[i]);
+
+    Q_EMIT sendDensity(new QImage(fields[0]->ToneMap()), area);
+
+    for ( int i=0; i<numTasks; ++i )
+        delete fields[i];
+}
+
+}  // namespace
@@ -0,0 +1,112 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef DENSITY_H
+#define DENSITY_H
+
+#include <vector>
+
+#include "qglobal.h"
+#include <QThread>
+#include <QImage>
+#include <QRectF>
+#include <QAtomicInt>
+
+#include "geometry.h"
+#include "snapshot.h"
+#include "packet.h"
+#include "visibility.h"
+
+
+namespace circles
+{
+
+extern const unsigned long DENSITY_NUM_RAYS;
+extern const unsigned long DENSITY_BATCH;
+extern const float DENSITY_MARGIN;
+
+
+/******************************** DensityField ********************************/
+
+/* A float accumulation buffer over an area of the scene. Every ray segment
+ * adds its length to the pixels it crosses, so the values are light density.
+ * The image is drawn into the same area, so it follows the view. */
+class DensityField
+{
+  public:
+    // Width x height pixels over the area.
+    DensityField(const QRectF& area, int width, int height) :
+        mArea(area), mWidth(width), mHeight(height),
+        mScaleX(width / area.width()), mScaleY(height / area.height()),
+        mData(width * height, 0.0f) {}
+
+    // The bounding box of the figures with a margin of DENSITY_MARGIN of its
+    // size for the rays leaving it, and a field size over it with about as
+    // many square pixels as width x height.
+    static void Bounds(const std::vector<Figure*>& figures, int width, int height,
+                       QRectF* area, int* fieldWidth, int* fieldHeight);
+
+    // Rasterizes the segment (in scene coordinates), clipped to the area.
+    // Doesn't allocate.
+    void AddSegment(float x0, float y0, float x1, float y1);
+
+    void Merge(const DensityField& other);
+
+    // Maps log(1 + density) to the alpha of a warm light color.
+    QImage ToneMap() const;
+
+    const QRectF& Area() const { return mArea; }
+    int Width() const { return mWidth; }
+    int Height() const { return mHeight; }
+
+  private:
+    QRectF             mArea;
+    int                mWidth;
+    int                mHeight;
+    float              mScaleX;  // Pixels per scene unit
+    float              mScaleY;
+    std::vector<float> mData;  // Row by row
+};
+
+
+/******************************* DensityThread ********************************/
+
+/* Traces DENSITY_NUM_RAYS rays from A in stratified directions through up to K
+ * reflections and accumulates all their segments (the last one up to the edge
+ * of the field) over the scene's bounds, at about the resolution of a width x
+ * height view. The rays are split between the cores; each task has its own
+ * DensityField, which are merged at the end. Only the circles reflect. */
+class DensityThread : public QThread
+{
+    Q_OBJECT
+
+  public:
+    DensityThread(const SnapshotPtr& snapshot, int K, int width, int height) :
+        mSnapshot(snapshot), mK(K), mWidth(width), mHeight(height) {}
+
+    void run();
+
+  Q_SIGNALS:
+    // When done, the image of the scene's area. The receiver deletes it.
+    void sendDensity(QImage* image, QRectF area);
+
+  private:
+    friend class DensityTask;
+
+    // Traces rays first..last-1 of numRays into the field. The wedge must
+    // have capacity for all circles.
+    void TraceRays(const FlatScene& flat, const VisibilityGraph* graph,
+                   unsigned long first, unsigned long last,
+                   unsigned long numRays, std::vector<int>* wedge,
+                   DensityField* field) const;
+
+    SnapshotPtr mSnapshot;
+    const int   mK;
+    const int   mWidth;
+    const int   mHeight;
+};
+
+}  // namespace
+
+#endif // DENSITY_H
@@ -0,0 +1,467 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <algorithm>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QPainter>
+#include "export.h"
+#include "scene.h"
+
+
+namespace circles
+{
+
+const int EXPORT_TILE_SIZE        = 1024;     // Pixels, both ways
+const int EXPORT_MAX_SIZE         = 65536;    // Of each side of the image
+const unsigned int PNG_IDAT_SIZE  = 1 << 20;  // Compressed bytes per chunk
+
+
+/********************************* PngWriter **********************************/
+
+static const unsigned char PNG_SIGNATURE[8] = { 137, 'P', 'N', 'G', '\r', '\n', 26, '\n' };
+
+// Lengths 3..257 of the deflate length codes 257..284. 258 is code 285.
+static const int LENGTH_BASE[28]  = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23,
+                                      27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131,
+                                      163, 195, 227 };
+static const int LENGTH_EXTRA[28] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2,
+                                      2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5,
+                                      5, 5, 5 };
+
+
+// Built before main(), so the export threads only read it.
+struct CrcTable
+{
+    CrcTable()
+    {
+        for ( unsigned int n=0; n<256; ++n )
+        {
+            unsigned int c = n;
+            for ( int k=0; k<8; ++k )
+                c = (c & 1)? (0xedb88320u ^ (c >> 1)) : (c >> 1);
+            entry[n] = c;
+        }
+    }
+
+    unsigned int entry[256];
+};
+
+static const CrcTable CRC_TABLE;
+
+
+static unsigned int Crc32( unsigned int crc, const unsigned char* data,
+                           unsigned int size )
+{
+    crc = ~crc;
+    for ( unsigned int i=0; i<size; ++i )
+        crc = CRC_TABLE.entry[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+
+static void PutUInt32( std::vector<unsigned char>* out, unsigned int v )
+{
+    out->push_back(v >> 24);
+    out->push_back((v >> 16) & 0xff);
+    out->push_back((v >> 8) & 0xff);
+    out->push_back(v & 0xff);
+}
+
+
+PngWriter::PngWriter() :
+        mFile(),
+        mWidth(0),
+        mHeight(0),
+        mRows(0),
+        mPrev(),
+        mFiltered(),
+        mLast(-1),
+        mRun(0),
+        mAdlerA(1),
+        mAdlerB(0),
+        mBitBuf(0),
+        mBitCount(0),
+        mIdat()
+{
+}
+
+
+bool PngWriter::Open( const char* fileName, int width, int height,
+                      std::stringstream& errSStr )
+{
+    mFile.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+    if ( ! mFile.is_open() )
+    {
+        errSStr << "Unable to open the output file '" << fileName << "'";
+        return false;
+    }
+
+    mWidth = width;
+    mHeight = height;
+    mRows = 0;
+    mPrev.assign(3 * width, 0);
+    mFiltered.resize(3 * width);
+    mIdat.clear();
+    mIdat.reserve(PNG_IDAT_SIZE + 1024);
+
+    mFile.write(reinterpret_cast<const char*>(PNG_SIGNATURE), sizeof(PNG_SIGNATURE));
+
+    std::vector<unsigned char> ihdr;
+    PutUInt32(&ihdr, width);
+    PutUInt32(&ihdr, height);
+    ihdr.push_back(8);  // Bits per sample
+    ihdr.push_back(2);  // RGB
+    ihdr.push_back(0);  // Deflate
+    ihdr.push_back(0);  // Adaptive filtering
+    ihdr.push_back(0);  // No interlace
+    WriteChunk("IHDR", &ihdr[0], ihdr.size());
+
+    // Zlib header, then a single final block with the fixed Huffman codes.
+    mIdat.push_back(0x78);
+    mIdat.push_back(0x01);
+    PutBits(1, 1);
+    PutBits(1, 2);
+
+    return mFile.good();
+}
+
+
+void PngWriter::WriteRow( const QRgb* row )
+{
+    // The "Up" filter - the white background becomes runs of zeros.
+    for ( int x=0; x<mWidth; ++x )
+    {
+        unsigned char rgb[3] = { static_cast<unsigned char>(qRed(row[x])),
+                                 static_cast<unsigned char>(qGreen(row[x])),
+                                 static_cast<unsigned char>(qBlue(row[x])) };
+        for ( int c=0; c<3; ++c )
+        {
+            mFiltered[3*x + c] = rgb[c] - mPrev[3*x + c];
+            mPrev[3*x + c] = rgb[c];
+        }
+    }
+
+    Deflate(2);
+    for ( unsigned int i=0; i<mFiltered.size(); ++i )
+        Deflate(mFiltered[i]);
+
+    ++mRows;
+
+    if ( mIdat.size() >= PNG_IDAT_SIZE )
+    {
+        WriteChunk("IDAT", &mIdat[0], mIdat.size());
+        mIdat.clear();
+    }
+}
+
+
+bool PngWriter::Close()
+{
+    if ( ! mFile.is_open() )
+        return false;
+
+    // The pending run, the end of the block and the checksum.
+    FlushRun();
+    PutCode(256);
+    FlushBits();
+    PutUInt32(&mIdat, (mAdlerB << 16) | mAdlerA);
+
+    WriteChunk("IDAT", &mIdat[0], mIdat.size());
+    WriteChunk("IEND", NULL, 0);
+
+    bool result = mFile.good() && (mRows == mHeight);
+    mFile.close();
+    return result;
+}
+
+
+void PngWriter::Deflate( unsigned char byte )
+{
+    mAdlerA += byte;
+    if ( mAdlerA >= 65521 ) mAdlerA -= 65521;
+    mAdlerB += mAdlerA;
+    if ( mAdlerB >= 65521 ) mAdlerB -= 65521;
+
+    if ( (byte == mLast) && (mRun < 258) )
+    {
+        ++mRun;
+        return;
+    }
+
+    FlushRun();
+    if ( byte == mLast )
+    {
+        mRun = 1;  // After a run of 258
+        return;
+    }
+    PutCode(byte);
+    mLast = byte;
+}
+
+
+void PngWriter::FlushRun()
+{
+    // The run of the last byte is a match at distance 1.
+    if ( mRun >= 3 )
+        PutMatch(mRun);
+    else
+        for ( int i=0; i<mRun; ++i )
+            PutCode(mLast);
+    mRun = 0;
+}
+
+
+void PngWriter::PutBits( unsigned int bits, int count )
+{
+    mBitBuf |= static_cast<unsigned long long>(bits) << mBitCount;
+    mBitCount += count;
+    while ( mBitCount >= 8 )
+    {
+        mIdat.push_back(mBitBuf & 0xff);
+        mBitBuf >>= 8;
+        mBitCount -= 8;
+    }
+}
+
+
+void PngWriter::PutCode( int code )
+{
+    unsigned int bits;
+    int count;
+
+    if ( code < 144 )      { bits = 0x30 + code;         count = 8; }
+    else if ( code < 256 ) { bits = 0x190 + code - 144;  count = 9; }
+    else if ( code < 280 ) { bits = code - 256;          count = 7; }
+    else                   { bits = 0xc0 + code - 280;   count = 8; }
+
+    // Huffman codes go from their most significant bit.
+    unsigned int reversed = 0;
+    for ( int i=0; i<count; ++i )
+        reversed |= ((bits >> i) & 1) << (count - 1 - i);
+    PutBits(reversed, count);
+}
+
+
+void PngWriter::PutMatch( int length )
+{
+    if ( length == 258 )
+        PutCode(285);
+    else
+    {
+        int i = 27;
+        while ( LENGTH_BASE[i] > length )
+            --i;
+        PutCode(257 + i);
+        PutBits(length - LENGTH_BASE[i], LENGTH_EXTRA[i]);
+    }
+
+    PutBits(0, 5);  // Distance code 0 is distance 1.
+}
+
+
+void PngWriter::FlushBits()
+{
+    if ( mBitCount > 0 )
+        PutBits(0, 8 - mBitCount);
+}
+
+
+void PngWriter::WriteChunk( const char* type, const unsigned char* data,
+                            unsigned int size )
+{
+    std::vector<unsigned char> head;
+    PutUInt32(&head, size);
+    head.insert(head.end(), type, type + 4);
+
+    unsigned int crc = Crc32(0, &head[4], 4);
+    if ( size > 0 )
+        crc = Crc32(crc, data, size);
+
+    std::vector<unsigned char> tail;
+    PutUInt32(&tail, crc);
+
+    mFile.write(reinterpret_cast<const char*>(&head[0]), head.size());
+    if ( size > 0 )
+        mFile.write(reinterpret_cast<const char*>(data), size);
+    mFile.write(reinterpret_cast<const char*>(&tail[0]), tail.size());
+}
+
+
+/********************************** Export ************************************/
+
+// Renders one tile of a strip.
+class ExportTask : public QRunnable
+{
+  public:
+    ExportTask( const std::vector<Figure*>& figures,
+                const std::vector<QLineF>& lines, const QRect& rect,
+                QImage* tile ) :
+        mFigures(figures), mLines(lines), mRect(rect), mTile(tile)
+    {
+    }
+
+    void run()
+    {
+        *mTile = QImage(mRect.width(), mRect.height(), QImage::Format_RGB32);
+        mTile->fill(Qt::white);
+
+        QPainter painter(mTile);
+        painter.setRenderHint(QPainter::Antialiasing, true);
+        painter.translate(-mRect.x(), -mRect.y());
+
+        // Leave out what is far from the tile, with room for the pens.
+        QRectF area(mRect.x() - 4, mRect.y() - 4, mRect.width() + 8, mRect.height() + 8);
+
+        for ( std::vector<Figure*>::const_iterator fig=mFigures.begin();
+              fig != mFigures.end(); ++fig )
+        {
+            // TODO Replace dynamic_cast<>
+            const Circle *crp = dynamic_cast<const Circle*>(*fig);
+            const Point *ptp = dynamic_cast<const Point*>(*fig);
+            QRectF box = (NULL != crp)?
+                QRectF(crp->C.x - crp->R, crp->C.y - crp->R, 2*crp->R, 2*crp->R) :
+                QRectF(ptp->x, ptp->y, 0, 0);
+            if ( ! area.intersects(box.adjusted(-2, -2, 2, 2)) )
+                continue;
+
+            (*fig)->Draw(&painter);
+        }
+
+        std::vector<QLineF> visible;
+        for ( std::vector<QLineF>::const_iterator l=mLines.begin();
+              l != mLines.end(); ++l )
+        {
+            QRectF box = QRectF(l->p1(), l->p2()).normalized();
+            if ( area.intersects(box.adjusted(-1, -1, 1, 1)) )
+                visible.push_back(*l);
+        }
+
+        if ( ! visible.empty() )
+        {
+            // The same pen as SolutionArena::Draw().
+            painter.setPen(QPen(Qt::darkYellow, 1, Qt::SolidLine));
+            painter.drawLines(&visible[0], visible.size());
+        }
+    }
+
+  private:
+    const std::vector<Figure*>& mFigures;
+    const std::vector<QLineF>&  mLines;
+    QRect                       mRect;
+    QImage*                     mTile;
+};
+
+
+bool ExportImage( const char* fileName, const std::vector<Figure*>& scene,
+                  const SolutionArena& solutions, int width, int height,
+                  std::stringstream& errSStr )
+{
+    SceneInfo info;
+    SceneBounds(scene, &info);
+    if ( info.minX > info.maxX )
+    {
+        errSStr << "The scene is empty";
+        return false;
+    }
+
+    float scale;
+    int margin;
+    if ( height <= 0 )
+    {
+        // As high as the box needs at this width.
+        FitScene(info, width, EXPORT_MAX_SIZE, &scale, &margin);
+        height = static_cast<int>( ceil((info.maxY - info.minY) * scale) ) + 2*margin;
+    }
+
+    if ( (width < 1) || (height < 1) ||
+         (width > EXPORT_MAX_SIZE) || (height > EXPORT_MAX_SIZE) )
+    {
+        errSStr << "The image size " << width << " x " << height
+                << " is not in 1 .. " << EXPORT_MAX_SIZE;
+        return false;
+    }
+
+    FitScene(info, width, height, &scale, &margin);
+
+    // Scaled copies of the figures, and the solutions' segments the same way.
+    std::vector<Figure*> figures;
+    for ( std::vector<Figure*>::const_iterator fig=scene.begin();
+          fig != scene.end(); ++fig )
+        figures.push_back((*fig)->Clone());
+    ScaleScene(figures, info, width, height);
+
+    std::vector<QLineF> lines;
+    lines.reserve(solutions.NumPoints());
+    for ( unsigned int s=0; s<solutions.Size(); ++s )
+    {
+        const TracePoint* points = solutions.Points(s);
+        for ( unsigned int i=1; i<solutions.Record(s).length; ++i )
+            lines.push_back(QLineF( (points[i-1].x - info.minX)*scale + margin,
+                                    (points[i-1].y - info.minY)*scale + margin,
+                                    (points[i].x - info.minX)*scale + margin,
+                                    (points[i].y - info.minY)*scale + margin ));
+    }
+
+    PngWriter png;
+    if ( ! png.Open(fileName, width, height, errSStr) )
+    {
+        DeleteFigures(&figures);
+        return false;
+    }
+
+    const int numTiles = (width + EXPORT_TILE_SIZE - 1) / EXPORT_TILE_SIZE;
+    std::vector<QImage> tiles(numTiles);
+    std::vector<QRgb> row(width);
+    QThreadPool pool;
+
+    for ( int y0=0; y0<height; y0+=EXPORT_TILE_SIZE )
+    {
+        int h = std::min(EXPORT_TILE_SIZE, height - y0);
+        for ( int t=0; t<numTiles; ++t )
+        {
+            int x0 = t * EXPORT_TILE_SIZE;
+            QRect rect(x0, y0, std::min(EXPORT_TILE_SIZE, width - x0), h);
+            pool.start(new ExportTask(figures, lines, rect, &tiles[t]));  // Auto-deleted
+        }
+        pool.waitForDone();
+
+        for ( int y=0; y<h; ++y )
+        {
+            for ( int t=0; t<numTiles; ++t )
+            {
+                const QRgb* line = reinterpret_cast<const QRgb*>( tiles[t].constScanLine(y) );
+                std::copy(line, line + tiles[t].width(), &row[t * EXPORT_TILE_SIZE]);
+            }
+            png.WriteRow(&row[0]);
+        }
+    }
+
+    DeleteFigures(&figures);
+
+    if ( ! png.Close() )
+    {
+        errSStr << "Failed writing the image to '" << fileName << "'";
+        return false;
+    }
+    return true;
+}
+
+
+/******************************** ExportThread ********************************/
+
+void ExportThread::run()
+{
+    // The traces are rebuilt only for this.
+    SolutionArena traces;
+    mSolutions.Replay(&traces);
+
+    std::stringstream errSStr;
+    bool result = ExportImage(mFileName.c_str(), mSnapshot->Figures(), traces,
+                              mWidth, 0, errSStr);
+
+    Q_EMIT sendExported(result, QString::fromUtf8(errSStr.str().c_str()));
+}
+
+}  // namespace
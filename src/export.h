@@ -0,0 +1,116 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+
+#include "qglobal.h"
+#include <QImage>
+#include <QThread>
+#include <QString>
+
+#include "geometry.h"
+#include "solutions.h"
+#include "snapshot.h"
+
+
+namespace circles
+{
+
+extern const int EXPORT_TILE_SIZE;
+extern const int EXPORT_MAX_SIZE;
+
+
+/********************************* PngWriter **********************************/
+
+/* Writes an RGB PNG file row by row, so the image doesn't have to be in memory.
+ * The rows are filtered against the previous one and compressed with run
+ * lengths only (one fixed Huffman deflate block), which is fast and enough for
+ * the mostly white renders. */
+class PngWriter
+{
+  public:
+    PngWriter();
+
+    bool Open(const char* fileName, int width, int height,
+              std::stringstream& errSStr);
+
+    // Rows go from the top down. The alpha is ignored.
+    void WriteRow(const QRgb* row);
+
+    // Returns false if writing failed or not all rows were written.
+    bool Close();
+
+  private:
+    void Deflate(unsigned char byte);
+    void FlushRun();
+    void PutBits(unsigned int bits, int count);
+    void PutCode(int code);  // From the fixed literal/length alphabet
+    void PutMatch(int length);  // Distance 1
+    void FlushBits();
+    void WriteChunk(const char* type, const unsigned char* data, unsigned int size);
+
+    std::ofstream              mFile;
+    int                        mWidth;
+    int                        mHeight;
+    int                        mRows;     // Written
+    std::vector<unsigned char> mPrev;     // The previous row, unfiltered
+    std::vector<unsigned char> mFiltered;
+    int                        mLast;     // The last byte deflated, -1 first
+    int                        mRun;      // Bytes equal to mLast, not coded yet
+    unsigned int               mAdlerA;
+    unsigned int               mAdlerB;
+    unsigned long long         mBitBuf;
+    int                        mBitCount;
+    std::vector<unsigned char> mIdat;     // Compressed, not written yet
+};
+
+
+/********************************** Export ************************************/
+
+/* Renders the figures and the solutions into a width x height PNG file. They
+ * are fitted in the image by their bounding box, like ScaleScene() does. If
+ * height is 0 it follows from the box's aspect ratio. The image is rendered in
+ * strips of EXPORT_TILE_SIZE rows, with each tile of a strip on its own thread,
+ * and each strip is written before the next one is rendered. */
+bool ExportImage(const char* fileName, const std::vector<Figure*>& scene,
+                 const SolutionArena& solutions, int width, int height,
+                 std::stringstream& errSStr);
+
+
+/******************************** ExportThread ********************************/
+
+/* Exports a snapshot of the scene and a copy of the solutions off the GUI
+ * thread. The traces are rebuilt here too. The height of the image follows
+ * from the scene. */
+class ExportThread : public QThread
+{
+    Q_OBJECT
+
+  public:
+    ExportThread(const SnapshotPtr& snapshot, const SolutionLog& solutions,
+                 const std::string& fileName, int width) :
+        mSnapshot(snapshot), mSolutions(solutions), mFileName(fileName),
+        mWidth(width) {}
+
+    void run();
+
+  Q_SIGNALS:
+    void sendExported(bool result, QString error);  // When done
+
+  private:
+    SnapshotPtr       mSnapshot;
+    SolutionLog       mSolutions;
+    const std::string mFileName;
+    const int         mWidth;
+};
+
+}  // namespace
+
+#endif // EXPORT_H
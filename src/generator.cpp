@@ -0,0 +1,240 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <functional>
+#include <QElapsedTimer>
+#include "generator.h"
+#include "scene.h"
+
+
+namespace circles
+{
+
+const int GEN_MAX_TRIES   = 100;   // Random places tried for each circle
+const float GEN_GAP       = 1.0f;  // Min free space between the figures
+const unsigned long GEN_MAX_CIRCLES = 100000000;  // Asked for
+const unsigned long GEN_MAX_CELLS   = 1 << 22;    // Of the grid
+
+
+/******************************* SceneGenerator *******************************/
+
+SceneGenerator::SceneGenerator( const GeneratorOptions& opts ) :
+        mOpts(opts),
+        mRandom(0x9e3779b97f4a7c15ULL ^ opts.seed),
+        mCell(0.0f),
+        mCols(0),
+        mRows(0),
+        mHead(),
+        mNext(),
+        mX(),
+        mY(),
+        mR(),
+        mFigures(),
+        mA(NULL),
+        mB(NULL)
+{
+}
+
+
+SceneGenerator::~SceneGenerator()
+{
+    DeleteFigures(&mFigures);
+}
+
+
+float SceneGenerator::Uniform()
+{
+    // xorshift64*, in [0, 1)
+    mRandom ^= mRandom >> 12;
+    mRandom ^= mRandom << 25;
+    mRandom ^= mRandom >> 27;
+    return ((mRandom * 2685821657736338717ULL) >> 40) * (1.0f / 16777216.0f);
+}
+
+
+unsigned long SceneGenerator::Generate()
+{
+    DeleteFigures(&mFigures);
+    mA = mB = NULL;
+    mX.clear();
+    mY.clear();
+    mR.clear();
+
+    const float minR = std::max(mOpts.minR, 0.5f);
+    const float maxR = std::max(mOpts.maxR, minR);
+    const float e = mOpts.exponent;
+
+    // Radiuses by the inverse of the distribution's CDF, the biggest first.
+    std::vector<float> radiuses(mOpts.numCircles);
+    double area = 0.0;
+    for ( unsigned long i=0; i<radiuses.size(); ++i )
+    {
+        float u = Uniform();
+        float r;
+        if ( maxR - minR < EPSILON )
+            r = minR;
+        else if ( fabs(e - 1.0f) < EPSILON )
+            r = minR * pow(maxR / minR, u);
+        else
+            r = pow( pow(minR, 1.0f - e) +
+                     u * (pow(maxR, 1.0f - e) - pow(minR, 1.0f - e)), 1.0f / (1.0f - e) );
+        radiuses[i] = r;
+        area += M_PI * r * r;
+    }
+    std::sort(radiuses.begin(), radiuses.end(), std::greater<float>());
+
+    float width = mOpts.width;
+    float height = mOpts.height;
+    if ( width <= 0.0f )
+        width = sqrt( area / std::max(mOpts.density, 0.01f) * 4.0 / 3.0 );
+    if ( height <= 0.0f )
+        height = 0.75f * width;
+    mOpts.width = width;
+    mOpts.height = height;
+
+    // Circles closer than a cell can be only in the neighbouring cells. A
+    // field much wider than the circles gets fewer, bigger cells.
+    mCell = std::max( 2.0f * maxR + GEN_GAP,
+                      std::max( static_cast<float>(sqrt(width * height / GEN_MAX_CELLS)),
+                                std::max(width, height) / GEN_MAX_CELLS ) );
+    mCols = static_cast<int>(width / mCell) + 1;
+    mRows = static_cast<int>(height / mCell) + 1;
+    mHead.assign(static_cast<size_t>(mCols) * mRows, -1);
+    mNext.clear();
+    mNext.reserve(radiuses.size());
+    mX.reserve(radiuses.size());
+    mY.reserve(radiuses.size());
+    mR.reserve(radiuses.size());
+
+    for ( unsigned long i=0; i<radiuses.size(); ++i )
+    {
+        const float r = radiuses[i];
+        if ( (width <= 2.0f*r) || (height <= 2.0f*r) )
+            continue;
+
+        for ( int t=0; t<GEN_MAX_TRIES; ++t )
+        {
+            float x = r + Uniform() * (width - 2.0f*r);
+            float y = r + Uniform() * (height - 2.0f*r);
+            if ( Fits(x, y, r) )
+            {
+                Insert(x, y, r);
+                break;
+            }
+        }
+    }
+
+    mFigures.reserve(mX.size() + 2);
+    mA = PlacePoint(0.0f, 0.25f * width);
+    mB = PlacePoint(0.75f * width, width);
+    for ( unsigned int i=0; i<mX.size(); ++i )
+        mFigures.push_back(new Circle(mX[i], mY[i], mR[i]));
+
+    return mX.size();
+}
+
+
+bool SceneGenerator::Fits( float x, float y, float r ) const
+{
+    int col = static_cast<int>(x / mCell);
+    int row = static_cast<int>(y / mCell);
+
+    for ( int j=std::max(row-1, 0); j<=std::min(row+1, mRows-1); ++j )
+    {
+        for ( int i=std::max(col-1, 0); i<=std::min(col+1, mCols-1); ++i )
+        {
+            for ( int c=mHead[j*mCols + i]; c>=0; c=mNext[c] )
+            {
+                float dx = x - mX[c];
+                float dy = y - mY[c];
+                float d = r + mR[c] + GEN_GAP;
+                if ( dx*dx + dy*dy < d*d )
+                    return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+void SceneGenerator::Insert( float x, float y, float r )
+{
+    int cell = static_cast<int>(y / mCell) * mCols + static_cast<int>(x / mCell);
+    mX.push_back(x);
+    mY.push_back(y);
+    mR.push_back(r);
+    mNext.push_back(mHead[cell]);
+    mHead[cell] = mX.size() - 1;
+}
+
+
+Point* SceneGenerator::PlacePoint( float x0, float x1 )
+{
+    for ( int t=0; t<GEN_MAX_TRIES; ++t )
+    {
+        float x = x0 + Uniform() * (x1 - x0);
+        float y = Uniform() * mOpts.height;
+        if ( Fits(x, y, 0.0f) )
+        {
+            Point* p = new Point(x, y);
+            mFigures.push_back(p);
+            return p;
+        }
+    }
+    return NULL;
+}
+
+
+/******************************** RunGenerator ********************************/
+
+int RunGenerator( const GeneratorOptions& opts )
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    SceneGenerator generator(opts);
+    unsigned long placed = generator.Generate();
+    qint64 generateMs = timer.restart();
+
+    const std::string& name = opts.outputFile;
+    bool binary = (name.size() >= 4) && (name.compare(name.size() - 4, 4, ".bin") == 0);
+
+    std::ofstream outFile(name.c_str(), binary? (std::ios::out | std::ios::binary) : std::ios::out);
+    if ( ! outFile.is_open() )
+    {
+        std::cerr << "Unable to open the output file '" << name << "'" << std::endl;
+        return 1;
+    }
+
+    std::stringstream errSStr;
+    if ( binary )
+        WriteSceneBinary(outFile, generator.Figures(), generator.A(), generator.B(),
+                         opts.K, errSStr);
+    else
+        WriteScene(outFile, generator.Figures(), generator.A(), generator.B(),
+                   opts.K, errSStr);
+    outFile.close();
+
+    if ( errSStr.str() != "" )
+        std::cerr << errSStr.str();
+    if ( ! outFile )
+    {
+        std::cerr << "Failed writing the output file '" << name << "'" << std::endl;
+        return 1;
+    }
+
+    std::cerr << placed << " of " << opts.numCircles << " circles placed in "
+              << generateMs << " ms, written in " << timer.elapsed() << " ms";
+    if ( (NULL == generator.A()) || (NULL == generator.B()) )
+        std::cerr << ", no free space for A or B";
+    std::cerr << std::endl;
+
+    return 0;
+}
+
+}  // namespace
@@ -0,0 +1,97 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <vector>
+#include <string>
+
+#include "geometry.h"
+
+
+namespace circles
+{
+
+extern const int GEN_MAX_TRIES;
+extern const float GEN_GAP;
+extern const unsigned long GEN_MAX_CIRCLES;
+extern const unsigned long GEN_MAX_CELLS;
+
+
+/******************************* SceneGenerator *******************************/
+
+struct GeneratorOptions
+{
+    GeneratorOptions() : numCircles(1000), width(0.0f), height(0.0f),
+                         minR(2.0f), maxR(10.0f), exponent(0.0f), density(0.3f),
+                         seed(1), K(1), outputFile() {}
+
+    unsigned long numCircles;  // Up to GEN_MAX_CIRCLES
+    float         width;     // Of the field. 0 to fit the circles at density
+    float         height;    // 0 for 3/4 of the width
+    float         minR;      // Radiuses are in [minR, maxR] with probability
+    float         maxR;      // density proportional to r^-exponent
+    float         exponent;  // 0 for uniform, 3 for a lot of small circles
+    float         density;   // Part of the area covered by the circles
+    unsigned int  seed;      // The same seed gives the same scene
+    int           K;         // Written in the scene
+    std::string   outputFile;  // Binary if it ends with ".bin"
+};
+
+
+/* Places non-overlapping circles by dart throwing: the radiuses are drawn
+ * first and the circles are placed from the biggest down, each at up to
+ * GEN_MAX_TRIES random places. A uniform grid with cells as big as the biggest
+ * circle keeps the overlap test to the neighbouring cells, so the time is
+ * linear in the number of circles. The cells are made bigger, if there would
+ * be more than GEN_MAX_CELLS of them. Circles, which don't fit, are left out.
+ * A and B are put in free space on the left and the right side. */
+class SceneGenerator
+{
+  public:
+    explicit SceneGenerator(const GeneratorOptions& opts);
+
+    // Returns the number of circles placed.
+    unsigned long Generate();
+
+    // The generated figures, owned by the generator.
+    const std::vector<Figure*>& Figures() const { return mFigures; }
+    const Point* A() const { return mA; }
+    const Point* B() const { return mB; }
+
+    ~SceneGenerator();
+
+  private:
+    bool Fits(float x, float y, float r) const;
+    void Insert(float x, float y, float r);
+    // A free point in [x0, x1] x [0, height].
+    Point* PlacePoint(float x0, float x1);
+    float Uniform();
+
+    GeneratorOptions     mOpts;
+    unsigned long long   mRandom;  // State of the generator
+    float                mCell;    // Grid cell size
+    int                  mCols;
+    int                  mRows;
+    std::vector<int>     mHead;    // First circle in each cell or -1
+    std::vector<int>     mNext;    // Next circle in the same cell or -1
+    std::vector<float>   mX;
+    std::vector<float>   mY;
+    std::vector<float>   mR;
+    std::vector<Figure*> mFigures;
+    Point*               mA;
+    Point*               mB;
+
+    SceneGenerator(const SceneGenerator&);
+    SceneGenerator& operator=(const SceneGenerator&);
+};
+
+
+// Generates a scene and writes it to opts.outputFile.
+int RunGenerator(const GeneratorOptions& opts);
+
+}  // namespace
+
+#endif // GENERATOR_H
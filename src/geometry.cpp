@@ -21,9 +21,12 @@ void Point::Draw(QPainter *painter) const
     painter->setPen(Qt::black);
     painter->drawPoint(x, y);
 #else
-    painter->setPen(QPen(Qt::black, 1, Qt::SolidLine));
+    QPen pen(Qt::black, 1, Qt::SolidLine);
+    pen.setCosmetic(true);  // The same in pixels at any zoom
+    painter->setPen(pen);
     painter->setBrush(QBrush(Qt::black, Qt::SolidPattern));
-    painter->drawEllipse(QPointF(x, y), 2, 2);
+    const float r = 2.0f / painter->transform().m11();  // 2 pixels
+    painter->drawEllipse(QPointF(x, y), r, r);
 #endif // 0
 }
 
@@ -114,9 +117,12 @@ void Point::Reflect( Ray* ray ) const
 
 void Circle::Draw(QPainter *painter) const
 {
-    painter->setPen(Qt::blue);
+    QPen pen(Qt::blue, 1, Qt::SolidLine);
+    pen.setCosmetic(true);  // The same in pixels at any zoom
+    painter->setPen(pen);
     painter->drawPoint(C);
-    painter->setPen(QPen(Qt::blue, 2, Qt::SolidLine));
+    pen.setWidth(2);
+    painter->setPen(pen);
     painter->setBrush(QBrush());  // Or fill it?
     if ( R > 0 )
     {
@@ -233,7 +239,9 @@ void Ray::Draw(QPainter *painter) const
     if ( trace.size() == 0 )
         return;
 
-    painter->setPen(QPen(Qt::darkYellow, 1, Qt::SolidLine));
+    QPen pen(Qt::darkYellow, 1, Qt::SolidLine);
+    pen.setCosmetic(true);
+    painter->setPen(pen);
 
     unsigned int i;
     for ( i=1; i<trace.size(); ++i )
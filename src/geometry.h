@@ -45,6 +45,12 @@ struct Figure
     // Reflects an intersecting ray.
     virtual void Reflect( Ray* ray /*, float distance */ ) const = 0;
 
+    // Moves the figure by (dx, dy).
+    virtual void Translate( float dx, float dy ) = 0;
+
+    // Returns a deep copy, which is owned by the caller.
+    virtual Figure* Clone() const = 0;
+
     // Add Scale(minX, minY, scale, margin) method?
 
     // Add Serialize(ostream) method?
@@ -71,6 +77,8 @@ struct Point : public Figure
     float Distance( const Figure* other ) const;
     bool Intersect( const Ray* ray, float* distance ) const;
     void Reflect( Ray* ray ) const;
+    void Translate( float dx, float dy ) { x += dx; y += dy; }
+    Figure* Clone() const { return new Point(*this); }
  
     float x;
     float y;
@@ -104,6 +112,8 @@ struct Circle : public Figure
     float Distance( const Figure* other ) const;
     bool Intersect( const Ray* ray, float* distance ) const;
     void Reflect( Ray* ray ) const;
+    void Translate( float dx, float dy ) { C.Translate(dx, dy); }
+    Figure* Clone() const { return new Circle(*this); }
 
     Point C;  // Center
     float  R;  // Radius
@@ -224,27 +234,30 @@ class Ray
   public:
     /* Default values are only to satisfy Qt's requirement for signal arguments
      * to have default constructor! */
-    Ray ( Point s=Point(0,0), Vector d=Vector(1,0) ) : src(s), dir(d), onFig(NULL), trace()
+    Ray ( Point s=Point(0,0), Vector d=Vector(1,0) ) : src(s), dir(d), onFig(NULL), trace(), origDir(d)
     {
         if ( dir.Norm() < EPSILON )
             throw std::runtime_error("Ray with no direction!");
 
         dir.Normalize();
+        origDir = dir;
     }
 
-    Ray ( Point s, Point d ) : src(s), dir(Vector(s,d)), onFig(NULL), trace()  // From point S to D.
+    Ray ( Point s, Point d ) : src(s), dir(Vector(s,d)), onFig(NULL), trace(), origDir(dir)  // From point S to D.
     {
         if ( dir.Norm() < EPSILON )
             throw std::runtime_error("Ray with no direction!");
 
         dir.Normalize();
+        origDir = dir;
     }
 
     Ray ( const Ray& other ) : 
             src(other.src), 
             dir(other.dir), 
             onFig(other.onFig),
-            trace(other.trace)
+            trace(other.trace),
+            origDir(other.origDir)
     {
     }
 
@@ -258,6 +271,7 @@ class Ray
             dir = rhs.dir;  // Normalize?
             onFig = rhs.onFig;
             trace = rhs.trace;
+            origDir = rhs.origDir;
         }
         return *this;
     }
@@ -268,6 +282,11 @@ class Ray
     const Figure* OnFig() { return onFig; }
     void SetOnFig( const Figure* fig ) { onFig = fig; }
     int GetNumberOfReflections() const { return trace.size(); }
+    const std::vector<Point>& GetTrace() const { return trace; }
+    Vector GetOrigDir() const { return origDir; }
+
+    // The launch direction as an angle in radians, in (-PI, PI].
+    float GetLaunchAngle() const { return atan2(origDir.GetY(), origDir.GetX()); }
 
     Point GetPointAt( float t ) const
     {
@@ -289,7 +308,7 @@ class Ray
     Vector              dir;   // Current direction
     const Figure*       onFig; // The last reflection figure (src is on it now)
     std::vector<Point>  trace; // Initial source and the next reflection points
-//  const Vector        origDir; // Initial direction
+    Vector              origDir; // Initial direction
 };
 
 }  // namespace
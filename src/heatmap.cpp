@@ -0,0 +1,112 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <cmath>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include "heatmap.h"
+
+
+namespace circles
+{
+
+/******************************** FigureStats *********************************/
+
+void DrawHeatmap( const FigureStats& stats, const QRectF& area, QPainter* painter )
+{
+    const FlatScene& flat = stats.circles;
+    const FigureCounters& cnt = stats.counters;
+    if ( (0 == flat.Size()) || (cnt.Size() != flat.Size()) )
+        return;
+
+    unsigned long long maxTests = 0, maxSolutions = 0;
+    for ( unsigned int c=0; c<flat.Size(); ++c )
+    {
+        if ( static_cast<int>(c) == flat.target )
+            continue;
+        maxTests = std::max(maxTests, cnt.tests[c]);
+        maxSolutions = std::max(maxSolutions, cnt.solutions[c]);
+    }
+    if ( 0 == maxTests )
+        return;
+
+    const double scale = 1.0 / log1p(static_cast<double>(maxTests));
+
+    for ( unsigned int c=0; c<flat.Size(); ++c )
+    {
+        if ( (static_cast<int>(c) == flat.target) ||
+             ! area.intersects(QRectF(flat.cx[c] - flat.r[c], flat.cy[c] - flat.r[c],
+                                      2*flat.r[c], 2*flat.r[c])) )
+            continue;
+
+        float v = log1p(static_cast<double>(cnt.tests[c])) * scale;
+        painter->setBrush(QBrush(QColor(static_cast<int>(255.0f * v), 0,
+                                        static_cast<int>(255.0f * (1.0f - v)), 160)));
+
+        if ( cnt.solutions[c] > 0 )
+        {
+            QPen pen(QColor(0, 200, 0), 1.0 + 4.0 * cnt.solutions[c] / maxSolutions);
+            pen.setCosmetic(true);
+            painter->setPen(pen);
+        }
+        else
+            painter->setPen(Qt::NoPen);
+
+        painter->drawEllipse(QPointF(flat.cx[c], flat.cy[c]), flat.r[c], flat.r[c]);
+    }
+
+    painter->setBrush(QBrush());
+}
+
+
+bool WriteFigureStats( const char* fileName, const FlatScene& circles,
+                       const FigureCounters& counters, std::stringstream& errSStr )
+{
+    std::string name(fileName);
+    bool csv = (name.size() >= 4) && (name.compare(name.size() - 4, 4, ".csv") == 0);
+
+    std::ofstream out(fileName);
+    if ( ! out.is_open() )
+    {
+        errSStr << "Unable to open the output file '" << fileName << "'";
+        return false;
+    }
+
+    if ( csv )
+        out << "index,x,y,r,tests,hits,solutions" << std::endl;
+    else
+        out << "[" << std::endl;
+
+    unsigned int index = 0;
+    for ( unsigned int c=0; (c<circles.Size()) && (c<counters.Size()); ++c )
+    {
+        if ( static_cast<int>(c) == circles.target )
+            continue;
+
+        if ( csv )
+            out << index << "," << circles.cx[c] << "," << circles.cy[c] << ","
+                << circles.r[c] << "," << counters.tests[c] << "," << counters.hits[c]
+                << "," << counters.solutions[c] << std::endl;
+        else
+            out << (index? ",\n" : "") << "{\"index\":" << index << ",\"x\":" << circles.cx[c]
+                << ",\"y\":" << circles.cy[c] << ",\"r\":" << circles.r[c]
+                << ",\"tests\":" << counters.tests[c] << ",\"hits\":" << counters.hits[c]
+                << ",\"solutions\":" << counters.solutions[c] << "}";
+        ++index;
+    }
+
+    if ( ! csv )
+        out << std::endl << "]" << std::endl;
+    out.close();
+
+    if ( ! out )
+    {
+        errSStr << "Failed writing the output file '" << fileName << "'";
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
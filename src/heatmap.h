@@ -0,0 +1,45 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include <sstream>
+
+#include "qglobal.h"
+#include <QPainter>
+
+#include "packet.h"
+
+
+namespace circles
+{
+
+/******************************** FigureStats *********************************/
+
+// The counters of a search with the circles they are for.
+struct FigureStats
+{
+    FigureStats() : circles(), counters() {}
+
+    FlatScene       circles;   // As traced. The target is B
+    FigureCounters  counters;
+};
+
+
+/* Fills each circle with a color from blue (the least intersection tests) to
+ * red (the most), on a log scale, so the circles taking the most work stand
+ * out. The circles on the path of a solution get a green rim, as thick as
+ * their share of the solutions. Only the circles, which may be in the area. */
+void DrawHeatmap(const FigureStats& stats, const QRectF& area, QPainter* painter);
+
+/* Writes a row per circle (not the target): its index among the circles of
+ * the scene, x, y, r, tests, hits and solutions. As CSV if the file name ends
+ * with ".csv", as a JSON array of objects otherwise. */
+bool WriteFigureStats(const char* fileName, const FlatScene& circles,
+                      const FigureCounters& counters, std::stringstream& errSStr);
+
+}  // namespace
+
+#endif // HEATMAP_H
@@ -0,0 +1,354 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include "jobs.h"
+#include "sink.h"
+#include "heatmap.h"
+
+
+namespace circles
+{
+
+const int VIEW_JOB_PRIORITY     = 10;  // Of "Find Path", above the queued jobs by default
+const unsigned int JOBS_HISTORY = 32;  // Ended jobs kept for showing
+const int JOBS_UPDATE_MS        = 250; // Between the queue changes on progress
+
+
+RenderQueue::RenderQueue( int numWorkers, QObject *parent ) :
+        QObject(parent),
+        mNumWorkers(numWorkers > 0 ? numWorkers : std::max(1, QThread::idealThreadCount())),
+        mNextId(1),
+        mJobs(),
+        mUpdateTimer()
+{
+    qRegisterMetaType<SolutionLogPtr>("SolutionLogPtr");
+    qRegisterMetaType<FigureStats*>("FigureStats*");
+}
+
+
+RenderQueue::~RenderQueue()
+{
+    // Nobody listens any more. Their last signals are dropped.
+    for ( std::list<RenderJob>::iterator job=mJobs.begin(); job != mJobs.end(); ++job )
+    {
+        if ( NULL != job->thread )
+        {
+            job->thread->Cancel();
+            job->thread->wait();
+            delete job->thread;
+        }
+        if ( NULL != job->sink )
+        {
+            job->sink->Close();
+            delete job->sink;
+        }
+    }
+}
+
+
+int RenderQueue::Submit( const SnapshotPtr& snapshot, int K, const BudgetOptions& budget,
+                         SearchMode mode, int priority, bool toView,
+                         const std::string& solutionsFile )
+{
+    Trim();
+
+    mJobs.push_back(RenderJob());
+    RenderJob& job = mJobs.back();
+    job.id = mNextId++;
+    job.snapshot = snapshot;
+    job.K = K;
+    job.budget = budget;
+    job.mode = mode;
+    job.priority = priority;
+    job.toView = toView;
+    job.solutionsFile = solutionsFile;
+
+    const int id = job.id;
+    Schedule();
+    Q_EMIT sendQueueChanged();
+    return id;
+}
+
+
+void RenderQueue::Cancel( int id )
+{
+    RenderJob* job = FindJob(id);
+    if ( NULL == job )
+        return;
+
+    if ( NULL != job->thread )
+    {
+        // Ends in noteRenderFinished().
+        job->thread->Cancel();
+        job->state = JS_CANCELLED;
+    }
+    else if ( JS_QUEUED == job->state )
+    {
+        job->state = JS_CANCELLED;
+        job->snapshot.clear();
+        Q_EMIT sendJobFinished(id, false, QString());
+    }
+
+    Q_EMIT sendQueueChanged();
+}
+
+
+void RenderQueue::CancelAll()
+{
+    // Cancel() signals, which may change the list.
+    std::vector<int> ids;
+    for ( std::list<RenderJob>::const_iterator job=mJobs.begin(); job != mJobs.end(); ++job )
+        if ( (JS_QUEUED == job->state) || (JS_RUNNING == job->state) )
+            ids.push_back(job->id);
+
+    for ( std::vector<int>::const_iterator id=ids.begin(); id != ids.end(); ++id )
+        Cancel(*id);
+}
+
+
+const RenderJob* RenderQueue::Job( int id ) const
+{
+    for ( std::list<RenderJob>::const_iterator job=mJobs.begin(); job != mJobs.end(); ++job )
+        if ( job->id == id )
+            return &*job;
+    return NULL;
+}
+
+
+RenderJob* RenderQueue::FindJob( int id )
+{
+    return const_cast<RenderJob*>(Job(id));
+}
+
+
+int RenderQueue::NumQueued() const
+{
+    int n = 0;
+    for ( std::list<RenderJob>::const_iterator job=mJobs.begin(); job != mJobs.end(); ++job )
+        if ( JS_QUEUED == job->state )
+            ++n;
+    return n;
+}
+
+
+int RenderQueue::NumRunning() const
+{
+    // The cancelled ones too, until their threads end.
+    int n = 0;
+    for ( std::list<RenderJob>::const_iterator job=mJobs.begin(); job != mJobs.end(); ++job )
+        if ( NULL != job->thread )
+            ++n;
+    return n;
+}
+
+
+void RenderQueue::Schedule()
+{
+    for ( ;; )
+    {
+        // The view's job has its own worker.
+        int numRunning = 0;
+        bool viewBusy = false;
+        for ( std::list<RenderJob>::const_iterator job=mJobs.begin(); job != mJobs.end(); ++job )
+        {
+            if ( NULL == job->thread )
+                continue;
+            if ( job->toView )
+                viewBusy = true;
+            else
+                ++numRunning;
+        }
+
+        // The first of the highest priority, which has a free worker.
+        RenderJob* best = NULL;
+        for ( std::list<RenderJob>::iterator job=mJobs.begin(); job != mJobs.end(); ++job )
+        {
+            if ( (JS_QUEUED != job->state) ||
+                 (job->toView? viewBusy : (numRunning >= mNumWorkers)) )
+                continue;
+            if ( (NULL == best) || (job->priority > best->priority) )
+                best = &*job;
+        }
+
+        if ( NULL == best )
+            break;
+
+        Start(best);
+    }
+}
+
+
+void RenderQueue::Start( RenderJob* job )
+{
+    job->state = JS_RUNNING;
+    job->timer.start();
+
+    if ( ! job->solutionsFile.empty() )
+    {
+        std::stringstream errSStr;
+        job->sink = new SolutionSink();
+        if ( ! job->sink->Open(job->solutionsFile.c_str(), errSStr) )
+        {
+            job->error = errSStr.str();
+            delete job->sink;
+            job->sink = NULL;
+        }
+    }
+
+    if ( ! job->toView && ! job->error.empty() )
+    {
+        // Its solutions would go nowhere.
+        job->state = JS_CANCELLED;
+        job->snapshot.clear();
+        Q_EMIT sendJobFinished(job->id, false, QString::fromUtf8(job->error.c_str()));
+        return;
+    }
+
+    job->thread = new RenderingThread(job->snapshot, job->K, job->budget, job->mode, job->sink);
+    connect(job->thread, SIGNAL(sendResults(SolutionLogPtr)), this, SLOT(addResults(SolutionLogPtr)), Qt::QueuedConnection);
+    connect(job->thread, SIGNAL(sendRenderFinished(bool)), this, SLOT(noteRenderFinished(bool)), Qt::QueuedConnection);
+    connect(job->thread, SIGNAL(sendFigureStats(FigureStats*)), this, SLOT(setFigureStats(FigureStats*)), Qt::QueuedConnection);
+    connect(job->thread, SIGNAL(sendClearPreview()), this, SLOT(clearPreview()), Qt::QueuedConnection);
+    connect(job->thread, SIGNAL(sendProgress(int, int)), this, SLOT(setProgress(int, int)), Qt::QueuedConnection);
+
+    if ( job->toView )
+        Q_EMIT sendJobStarted(job->id);
+
+    job->thread->start();
+}
+
+
+RenderJob* RenderQueue::SenderJob()
+{
+    // The threads of the ended jobs are gone, but their signals come before
+    // sendRenderFinished().
+    QObject* thread = sender();
+    for ( std::list<RenderJob>::iterator job=mJobs.begin(); job != mJobs.end(); ++job )
+        if ( (NULL != job->thread) && (job->thread == thread) )
+            return &*job;
+    return NULL;
+}
+
+
+void RenderQueue::Trim()
+{
+    unsigned int numEnded = 0;
+    for ( std::list<RenderJob>::const_iterator job=mJobs.begin(); job != mJobs.end(); ++job )
+        if ( (NULL == job->thread) && (JS_QUEUED != job->state) && (JS_RUNNING != job->state) )
+            ++numEnded;
+
+    for ( std::list<RenderJob>::iterator job=mJobs.begin();
+          (job != mJobs.end()) && (numEnded > JOBS_HISTORY); )
+    {
+        if ( (NULL == job->thread) && (JS_QUEUED != job->state) && (JS_RUNNING != job->state) )
+        {
+            job = mJobs.erase(job);
+            --numEnded;
+        }
+        else
+            ++job;
+    }
+}
+
+
+void RenderQueue::addResults( SolutionLogPtr chunk )
+{
+    RenderJob* job = SenderJob();
+    if ( NULL == job )
+        return;
+
+    // The sink, if any, got them already.
+    job->numSolutions += chunk->Size();
+    if ( job->toView )
+        Q_EMIT sendResults(job->id, chunk);
+}
+
+
+void RenderQueue::clearPreview()
+{
+    RenderJob* job = SenderJob();
+    if ( NULL == job )
+        return;
+
+    job->numSolutions = 0;
+    if ( job->toView )
+        Q_EMIT sendClearPreview(job->id);
+}
+
+
+void RenderQueue::setFigureStats( FigureStats* stats )
+{
+    RenderJob* job = SenderJob();
+    if ( (NULL != job) && job->toView )
+        Q_EMIT sendFigureStats(job->id, stats);  // The receiver takes the ownership.
+    else
+        delete stats;
+}
+
+
+void RenderQueue::setProgress( int percent, int etaMs )
+{
+    RenderJob* job = SenderJob();
+    if ( NULL == job )
+        return;
+
+    job->percent = percent;
+    job->etaMs = etaMs;
+    if ( job->toView )
+        Q_EMIT sendProgress(job->id, percent, etaMs);
+
+    // Every job reports, the status bar doesn't need all.
+    if ( mUpdateTimer.isValid() && (mUpdateTimer.elapsed() < JOBS_UPDATE_MS) )
+        return;
+    mUpdateTimer.start();
+    Q_EMIT sendQueueChanged();
+}
+
+
+void RenderQueue::noteRenderFinished( bool result )
+{
+    RenderJob* job = SenderJob();
+    if ( NULL == job )
+        return;
+
+    job->thread->wait();  // It is returning from run().
+    job->thread->deleteLater();
+    job->thread = NULL;
+    job->snapshot.clear();
+    job->wallMs = job->timer.elapsed();
+    job->found = result;
+    if ( JS_RUNNING == job->state )
+    {
+        job->state = JS_DONE;
+        job->percent = 100;
+    }
+
+    if ( NULL != job->sink )
+    {
+        // The thread doesn't write any more.
+        unsigned long numWritten = job->sink->NumWritten();
+        bool written = job->sink->Close();
+        delete job->sink;
+        job->sink = NULL;
+
+        if ( ! written )
+        {
+            std::stringstream errSStr;
+            errSStr << "Failed writing the solutions to '" << job->solutionsFile
+                    << "' after " << numWritten << " solutions";
+            job->error = errSStr.str();
+        }
+    }
+
+    const int id = job->id;
+    Q_EMIT sendJobFinished(id, result, QString::fromUtf8(job->error.c_str()));
+
+    Schedule();
+    Q_EMIT sendQueueChanged();
+}
+
+}  // namespace
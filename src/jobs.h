@@ -0,0 +1,138 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <list>
+#include <string>
+
+#include "qglobal.h"
+#include <QObject>
+#include <QElapsedTimer>
+
+#include "renderer.h"
+
+
+namespace circles
+{
+
+extern const int VIEW_JOB_PRIORITY;
+extern const unsigned int JOBS_HISTORY;
+extern const int JOBS_UPDATE_MS;
+
+
+typedef enum {
+    JS_QUEUED,
+    JS_RUNNING,
+    JS_DONE,
+    JS_CANCELLED
+} JobState;
+
+
+/* A search waiting, running or done in a RenderQueue. */
+struct RenderJob
+{
+    RenderJob() : id(0), snapshot(), K(0), budget(), mode(SM_RAYS), priority(0),
+                  toView(false), solutionsFile(), state(JS_QUEUED), percent(0),
+                  etaMs(-1), found(false), numSolutions(0), wallMs(0), timer(),
+                  error(), thread(NULL), sink(NULL) {}
+
+    int           id;
+    SnapshotPtr   snapshot;
+    int           K;
+    BudgetOptions budget;
+    SearchMode    mode;
+    int           priority;       // The higher ones start first
+    bool          toView;         // The solutions are shown, see RenderQueue
+    std::string   solutionsFile;  // Empty for none
+    JobState      state;
+    int           percent;
+    int           etaMs;          // -1 if not known
+    bool          found;
+    unsigned long numSolutions;   // Found so far, less a dropped preview
+    qint64        wallMs;         // From the start to the end
+    QElapsedTimer timer;          // Started with the job
+    std::string   error;          // Of the solutions file, empty if none
+    RenderingThread* thread;      // Not NULL while running
+    SolutionSink* sink;           // Not NULL while streaming to the file
+};
+
+
+/* Runs the searches (RenderingThread-s) of the queued jobs on a fixed number
+ * of workers, the jobs with higher priority first, then in the order queued.
+ * The jobs shown in the view run one at a time on a worker of their own, so
+ * a full queue doesn't hold them up and their solutions don't mix. Their
+ * results, progress and figure stats are forwarded with the job's id; the
+ * results of the other jobs only go to their solutions files. The last
+ * JOBS_HISTORY ended jobs are kept for showing. Progress alone changes the
+ * queue at most every JOBS_UPDATE_MS. Lives in the GUI thread. */
+class RenderQueue : public QObject
+{
+    Q_OBJECT
+
+  public:
+    // 0 workers for one per core. The view's worker is extra.
+    explicit RenderQueue(int numWorkers = 0, QObject *parent = 0);
+    virtual ~RenderQueue();
+
+    // Queues a job, whose id is returned. It may start at once.
+    int Submit(const SnapshotPtr& snapshot, int K, const BudgetOptions& budget,
+               SearchMode mode, int priority, bool toView,
+               const std::string& solutionsFile);
+
+    // Drops a queued job, or stops a running one within a reflection.
+    void Cancel(int id);
+    void CancelAll();
+
+    // NULL if not known any more.
+    const RenderJob* Job(int id) const;
+    // The jobs known, in the order queued.
+    const std::list<RenderJob>& Jobs() const { return mJobs; }
+
+    int NumQueued() const;
+    int NumRunning() const;
+    int NumWorkers() const { return mNumWorkers + 1; }  // With the view's
+
+  Q_SIGNALS:
+    // Of the jobs shown in the view. The receiver deletes the stats.
+    void sendResults(int id, SolutionLogPtr chunk);
+    void sendClearPreview(int id);
+    void sendFigureStats(int id, FigureStats* stats);
+    void sendProgress(int id, int percent, int etaMs);
+    void sendJobStarted(int id);
+    // Of any job. The error is empty if its solutions were written.
+    void sendJobFinished(int id, bool found, QString error);
+    // The jobs were queued, started, ended or advanced.
+    void sendQueueChanged();
+
+  private slots:
+    void addResults(SolutionLogPtr chunk);
+    void clearPreview();
+    void setFigureStats(FigureStats* stats);
+    void setProgress(int percent, int etaMs);
+    void noteRenderFinished(bool result);
+
+  private:
+    // Starts the best queued jobs on the free workers.
+    void Schedule();
+    void Start(RenderJob* job);
+    // The running job of the thread, which sent the signal, or NULL.
+    RenderJob* SenderJob();
+    RenderJob* FindJob(int id);
+    // Forgets the oldest ended jobs above JOBS_HISTORY.
+    void Trim();
+
+    int                  mNumWorkers;  // For the jobs not shown
+    int                  mNextId;
+    std::list<RenderJob> mJobs;
+    QElapsedTimer        mUpdateTimer;  // Since the last sendQueueChanged() on progress
+
+    RenderQueue(const RenderQueue&);
+    RenderQueue& operator=(const RenderQueue&);
+};
+
+}  // namespace
+
+#endif // JOBS_H
@@ -2,18 +2,324 @@
  * Copyright: Assen Kirov                                                     *
  ******************************************************************************/
 
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cfloat>
+#include <iostream>
 #include <QApplication>
+#include <QCoreApplication>
 #include "ui.h"
+#include "cluster.h"
+#include "batch.h"
+#include "generator.h"
+#include "daemon.h"
+#include "tiles.h"
+#include "profiler.h"
+
+
+static void PrintUsage()
+{
+    std::cerr << "Usage:" << std::endl
+              << "  circles                          start the GUI" << std::endl
+              << "  circles --coordinator <scene> [--workers N] [--rays N]" << std::endl
+              << "          [--shard N] [--seed N] [--K N] [--output file]" << std::endl
+              << "          [--worker-command \"ssh host circles\"] [--fail-every N]" << std::endl
+              << "          [--checkpoint file] [--checkpoint-every seconds]" << std::endl
+              << "  circles --resume <checkpoint> [--workers N] [--output file]" << std::endl
+              << "          [--worker-command \"ssh host circles\"] [--checkpoint-every seconds]" << std::endl
+              << "  circles --worker [--fail-every N]" << std::endl
+              << "  circles --batch <scene> <queries> [--rays N] [--output file]" << std::endl
+              << "          [--time-ms N] [--paths N] [--confidence C]" << std::endl
+              << "          [--figure-stats file.csv|file.json]" << std::endl
+              << "  circles --generate <scene.txt|scene.bin> [--circles N] [--seed N]" << std::endl
+              << "          [--min-r R] [--max-r R] [--exponent E] [--density D]" << std::endl
+              << "          [--width W] [--height H] [--K N]" << std::endl
+              << "  circles --tile <scene.bin> <scene.tiles>" << std::endl
+              << "  circles --tiled <scene.tiles> [--rays N] [--K N] [--seed N]" << std::endl
+              << "          [--cache-mb N] [--output file]" << std::endl
+              << "  circles --daemon <socket> [--scenes N] [--threads N]" << std::endl;
+}
+
+
+// strtoul() takes "-1" for ULONG_MAX. Returns 0 for a negative number.
+static unsigned long ParseCount(const char* val)
+{
+    while ( isspace(static_cast<unsigned char>(*val)) )
+        ++val;
+    return ('-' == *val)? 0 : strtoul(val, NULL, 10);
+}
+
+
+// Parses "--coordinator <scene> [options]" or "--resume <checkpoint> [options]".
+// Returns false on invalid input.
+static bool ParseCoordinatorArgs(int argc, char *argv[],
+                                 circles::CoordinatorOptions* opts)
+{
+    if ( argc < 3 )
+        return false;
+
+    if ( 0 == strcmp(argv[1], "--resume") )
+    {
+        // The scene and the search parameters come from the checkpoint.
+        opts->checkpointFile = argv[2];
+        opts->resume = true;
+    }
+    else
+    {
+        opts->sceneFile = argv[2];
+    }
+
+    for ( int i=3; i<argc; i+=2 )
+    {
+        if ( i+1 >= argc )
+            return false;
+
+        const char* opt = argv[i];
+        const char* val = argv[i+1];
+
+        if ( 0 == strcmp(opt, "--workers") )
+            opts->numWorkers = atoi(val);
+        else if ( 0 == strcmp(opt, "--rays") )
+            opts->numRays = ParseCount(val);
+        else if ( 0 == strcmp(opt, "--shard") )
+            opts->shardSize = strtoul(val, NULL, 10);
+        else if ( 0 == strcmp(opt, "--seed") )
+            opts->seed = strtoul(val, NULL, 10);
+        else if ( 0 == strcmp(opt, "--K") )
+            opts->K = atoi(val);
+        else if ( 0 == strcmp(opt, "--output") )
+            opts->outputFile = val;
+        else if ( 0 == strcmp(opt, "--worker-command") )
+            opts->workerCommand = QString::fromUtf8(val);
+        else if ( 0 == strcmp(opt, "--fail-every") )
+            opts->failEvery = atoi(val);
+        else if ( 0 == strcmp(opt, "--checkpoint") && ! opts->resume )
+            opts->checkpointFile = val;
+        else if ( 0 == strcmp(opt, "--checkpoint-every") )
+            opts->checkpointSeconds = atoi(val);
+        else
+            return false;
+    }
+
+    return (opts->numRays > 0);
+}
+
+
+// Parses "--generate <output> [options]". Returns false on invalid input.
+static bool ParseGeneratorArgs(int argc, char *argv[],
+                               circles::GeneratorOptions* opts)
+{
+    if ( argc < 3 )
+        return false;
+
+    opts->outputFile = argv[2];
+
+    for ( int i=3; i<argc; i+=2 )
+    {
+        if ( i+1 >= argc )
+            return false;
+
+        const char* opt = argv[i];
+        const char* val = argv[i+1];
+
+        if ( 0 == strcmp(opt, "--circles") )
+            opts->numCircles = strtoul(val, NULL, 10);
+        else if ( 0 == strcmp(opt, "--seed") )
+            opts->seed = strtoul(val, NULL, 10);
+        else if ( 0 == strcmp(opt, "--min-r") )
+            opts->minR = atof(val);
+        else if ( 0 == strcmp(opt, "--max-r") )
+            opts->maxR = atof(val);
+        else if ( 0 == strcmp(opt, "--exponent") )
+            opts->exponent = atof(val);
+        else if ( 0 == strcmp(opt, "--density") )
+            opts->density = atof(val);
+        else if ( 0 == strcmp(opt, "--width") )
+            opts->width = atof(val);
+        else if ( 0 == strcmp(opt, "--height") )
+            opts->height = atof(val);
+        else if ( 0 == strcmp(opt, "--K") )
+            opts->K = atoi(val);
+        else
+            return false;
+    }
+
+    return (opts->density > 0.0f) && (opts->density < 1.0f) &&
+           (opts->numCircles <= circles::GEN_MAX_CIRCLES) &&
+           (opts->width >= 0.0f) && (opts->width <= FLT_MAX) &&
+           (opts->height >= 0.0f) && (opts->height <= FLT_MAX) &&
+           (opts->minR > 0.0f) && (opts->maxR >= 0.0f) && (opts->maxR <= FLT_MAX);
+}
 
 
 int main(int argc, char *argv[])
 {
     using namespace circles;
 
+    if ( (argc > 1) && (0 == strcmp(argv[1], "--worker")) )
+    {
+        int failEvery = 0;
+        if ( (argc > 3) && (0 == strcmp(argv[2], "--fail-every")) )
+            failEvery = atoi(argv[3]);
+
+        return RunWorker(failEvery);
+    }
+
+    if ( (argc > 3) && (0 == strcmp(argv[1], "--batch")) )
+    {
+        BudgetOptions budget;
+        std::string outputFile;
+        std::string statsFile;
+
+        for ( int i=4; i+1<argc; i+=2 )
+        {
+            if ( 0 == strcmp(argv[i], "--rays") )
+                budget.maxRays = ParseCount(argv[i+1]);
+            else if ( 0 == strcmp(argv[i], "--time-ms") )
+                budget.maxMs = ParseCount(argv[i+1]);
+            else if ( 0 == strcmp(argv[i], "--paths") )
+                budget.maxPaths = ParseCount(argv[i+1]);
+            else if ( 0 == strcmp(argv[i], "--confidence") )
+                budget.confidence = atof(argv[i+1]);
+            else if ( 0 == strcmp(argv[i], "--output") )
+                outputFile = argv[i+1];
+            else if ( 0 == strcmp(argv[i], "--figure-stats") )
+                statsFile = argv[i+1];
+            else
+            {
+                PrintUsage();
+                return 1;
+            }
+        }
+
+        if ( (budget.maxRays < MIN_NUM_RAYS) || (budget.confidence >= 1.0f) || (argc % 2 != 0) )
+        {
+            PrintUsage();
+            return 1;
+        }
+
+        int result = RunBatch(argv[2], argv[3], outputFile, budget, statsFile);
+        PROFILE_WRITE();
+        return result;
+    }
+
+    if ( (argc > 1) && (0 == strcmp(argv[1], "--generate")) )
+    {
+        GeneratorOptions opts;
+        if ( ! ParseGeneratorArgs(argc, argv, &opts) )
+        {
+            PrintUsage();
+            return 1;
+        }
+
+        return RunGenerator(opts);
+    }
+
+    if ( (argc == 4) && (0 == strcmp(argv[1], "--tile")) )
+    {
+        std::stringstream errSStr;
+        if ( ! WriteTiledScene(argv[2], argv[3], errSStr) )
+        {
+            std::cerr << errSStr.str() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    if ( (argc > 2) && (0 == strcmp(argv[1], "--tiled")) )
+    {
+        TiledOptions opts;
+        opts.sceneFile = argv[2];
+
+        for ( int i=3; i+1<argc; i+=2 )
+        {
+            if ( 0 == strcmp(argv[i], "--rays") )
+                opts.numRays = ParseCount(argv[i+1]);
+            else if ( 0 == strcmp(argv[i], "--K") )
+                opts.K = atoi(argv[i+1]);
+            else if ( 0 == strcmp(argv[i], "--seed") )
+                opts.seed = strtoul(argv[i+1], NULL, 10);
+            else if ( 0 == strcmp(argv[i], "--cache-mb") )
+                opts.cacheMb = strtoul(argv[i+1], NULL, 10);
+            else if ( 0 == strcmp(argv[i], "--output") )
+                opts.outputFile = argv[i+1];
+            else
+            {
+                PrintUsage();
+                return 1;
+            }
+        }
+
+        if ( (opts.numRays == 0) || (argc % 2 == 0) )
+        {
+            PrintUsage();
+            return 1;
+        }
+
+        return RunTiledSearch(opts);
+    }
+
+    if ( (argc > 2) && (0 == strcmp(argv[1], "--daemon")) )
+    {
+        QCoreApplication a(argc, argv);
+
+        DaemonOptions opts;
+        opts.socketName = QString::fromUtf8(argv[2]);
+
+        for ( int i=3; i+1<argc; i+=2 )
+        {
+            if ( 0 == strcmp(argv[i], "--scenes") )
+                opts.maxScenes = atoi(argv[i+1]);
+            else if ( 0 == strcmp(argv[i], "--threads") )
+                opts.numThreads = atoi(argv[i+1]);
+            else
+            {
+                PrintUsage();
+                return 1;
+            }
+        }
+
+        if ( (opts.maxScenes < 1) || (argc % 2 == 0) )
+        {
+            PrintUsage();
+            return 1;
+        }
+
+        return RunDaemon(opts);
+    }
+
+    if ( (argc > 1) && ((0 == strcmp(argv[1], "--coordinator")) ||
+                        (0 == strcmp(argv[1], "--resume"))) )
+    {
+        QCoreApplication a(argc, argv);
+
+        CoordinatorOptions opts;
+        if ( ! ParseCoordinatorArgs(argc, argv, &opts) )
+        {
+            PrintUsage();
+            return 1;
+        }
+
+        Coordinator coordinator(opts);
+        if ( ! coordinator.Start() )
+            return 1;
+
+        return a.exec();
+    }
+
+    if ( argc > 1 )
+    {
+        PrintUsage();
+        return 1;
+    }
+
     QApplication a(argc, argv);
 
     ReflectiveCirclesUI w;
     w.show();
 
-    return a.exec();
+    int result = a.exec();
+    PROFILE_WRITE();
+    return result;
 }
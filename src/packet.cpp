@@ -0,0 +1,117 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include "packet.h"
+
+
+namespace circles
+{
+
+/******************************** FlatScene ***********************************/
+
+void FlatScene::Build( const std::vector<Figure*>& scene,
+                       const Figure* targetFig, const Point& source )
+{
+    cx.clear();
+    cy.clear();
+    r2.clear();
+    r.clear();
+    phi.clear();
+    halfW.clear();
+    target = -1;
+
+    for ( std::vector<Figure*>::const_iterator fig=scene.begin();
+          fig != scene.end(); ++fig )
+    {
+        // TODO Replace dynamic_cast<>
+        const Circle *crp = dynamic_cast<const Circle*>(*fig);
+        if ( (NULL == crp) || (crp->R <= 0.0f) )
+            continue;
+
+        if ( crp == targetFig )
+            target = cx.size();
+
+        cx.push_back(crp->C.x);
+        cy.push_back(crp->C.y);
+        r2.push_back(crp->R * crp->R);
+        r.push_back(crp->R);
+    }
+
+    SetSource(source);
+}
+
+
+void FlatScene::SetSource( const Point& source )
+{
+    Extents(source, &phi, &halfW);
+}
+
+
+void FlatScene::Extents( const Point& source, std::vector<float>* phiOut,
+                         std::vector<float>* halfWOut ) const
+{
+    phiOut->resize(Size());
+    halfWOut->resize(Size());
+
+    for ( unsigned int c=0; c<Size(); ++c )
+    {
+        float dist = Module(cx[c] - source.x, cy[c] - source.y);
+        (*phiOut)[c] = atan2(cy[c] - source.y, cx[c] - source.x);
+        // The source is outside of all circles, but be safe.
+        (*halfWOut)[c] = (dist > r[c])? asin(r[c] / dist) : static_cast<float>(M_PI);
+    }
+}
+
+
+unsigned long long FlatScene::Hash() const
+{
+    // FNV-1a over the bytes of the coordinates.
+    unsigned long long h = 14695981039346656037ULL;
+    const unsigned long long prime = 1099511628211ULL;
+
+    if ( 0 == Size() )
+        return h;
+
+    const float* arrays[3] = { &cx[0], &cy[0], &r[0] };
+    for ( unsigned int c=0; c<Size(); ++c )
+    {
+        if ( static_cast<int>(c) == target )
+        {
+            h = (h ^ 0xffULL) * prime;
+            continue;
+        }
+
+        for ( int a=0; a<3; ++a )
+        {
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&arrays[a][c]);
+            for ( unsigned int b=0; b<sizeof(float); ++b )
+                h = (h ^ bytes[b]) * prime;
+        }
+    }
+
+    return h;
+}
+
+
+/****************************** FigureCounters ********************************/
+
+void FigureCounters::Reset( unsigned int numCircles )
+{
+    tests.assign(numCircles, 0);
+    hits.assign(numCircles, 0);
+    solutions.assign(numCircles, 0);
+}
+
+
+void FigureCounters::Merge( const FigureCounters& other )
+{
+    for ( unsigned int c=0; (c<Size()) && (c<other.Size()); ++c )
+    {
+        tests[c] += other.tests[c];
+        hits[c] += other.hits[c];
+        solutions[c] += other.solutions[c];
+    }
+}
+
+}  // namespace
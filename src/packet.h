@@ -0,0 +1,374 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef PACKET_H
+#define PACKET_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "qglobal.h"
+#include <QAtomicInt>
+
+#include "geometry.h"
+#include "visibility.h"
+
+
+namespace circles
+{
+
+const int PACKET_LANES = 8;  // Rays traced together: 4, 8 or 16
+
+
+/******************************** FlatScene ***********************************/
+
+/* The circles of a scene in flat arrays (structure of arrays), so one circle
+ * can be tested against all rays of a packet with vectorizable loops. Points
+ * are left out - the source is skipped anyway and B is the target circle. */
+struct FlatScene
+{
+    FlatScene() : target(-1) {}
+
+    // The target must be a circle in the scene. The angular extent of each
+    // circle is computed as seen from the source point.
+    void Build(const std::vector<Figure*>& scene, const Figure* targetFig,
+               const Point& source);
+
+    // Recomputes the angular extents (phi and halfW) for another source.
+    void SetSource(const Point& source);
+
+    // The angular extents from the source into other arrays, e.g. for a query
+    // of a scene shared between threads.
+    void Extents(const Point& source, std::vector<float>* phiOut,
+                 std::vector<float>* halfWOut) const;
+
+    unsigned int Size() const { return cx.size(); }
+
+    // Hash of the circles and the target's place, but not of its radius.
+    unsigned long long Hash() const;
+
+    std::vector<float> cx;      // Centers
+    std::vector<float> cy;
+    std::vector<float> r2;      // Squared radiuses
+    std::vector<float> r;
+    std::vector<float> phi;     // Direction from the source to the center
+    std::vector<float> halfW;   // Half of the angular width from the source
+    int                target;  // Index of the target circle or -1
+};
+
+
+/****************************** FigureCounters ********************************/
+
+/* How much tracing work each circle of a FlatScene took: ray-circle
+ * intersection tests, hits (reflections, or reaching the target) and hits on
+ * the path of a solution. Each thread counts into its own, merged at the end. */
+struct FigureCounters
+{
+    FigureCounters() : tests(), hits(), solutions(), path() {}
+
+    // Zeroes the counters for a scene with numCircles circles.
+    void Reset(unsigned int numCircles);
+
+    // Adds the other's counts. Both must be for the same scene.
+    void Merge(const FigureCounters& other);
+
+    unsigned int Size() const { return tests.size(); }
+
+    std::vector<unsigned long long> tests;
+    std::vector<unsigned long long> hits;
+    std::vector<unsigned long long> solutions;
+    std::vector<int>                path;  // Scratch: the circles each lane hit
+};
+
+
+/******************************* PacketTracer *********************************/
+
+/* Traces N neighboring rays from the same source in lock-step: all active rays
+ * make their k-th reflection in the same iteration. On the first leg the
+ * circles outside the packet's angular wedge are skipped once for the whole
+ * packet. With a visibility graph the next legs test only the circles seen
+ * from the current one in the ray's direction (and the target). Rays, which
+ * miss, hit the target or run out of reflections, are masked off. The per-lane
+ * loops are written to be vectorized. */
+template<int N>
+class PacketTracer
+{
+  public:
+    // The graph is optional and must be built for the same scene. So are the
+    // counters, which must be Reset() for it - they cost a little time.
+    explicit PacketTracer( const FlatScene& scene,
+                           const VisibilityGraph* graph = NULL,
+                           FigureCounters* counters = NULL ) :
+        mScene(scene), mGraph(graph), mCounters(counters), mCancel(NULL),
+        mReach(NULL), mTarget(NULL), mPhi(NULL), mHalfW(NULL) {}
+
+    // Trace() gives up at the next reflection once the flag is set - the lanes
+    // still going are left without a hit. NULL for none.
+    void SetCancel( const QAtomicInt* cancel ) { mCancel = cancel; }
+
+    // Lanes, which reflect from a circle, from which the target can't be
+    // reached with the reflections left, are stopped there. The sets must be
+    // built for the same scene and K. NULL for none.
+    void SetReach( const ReachSets* reach ) { mReach = reach; }
+
+    // The place and radius of the target, instead of the ones of the scene's
+    // target circle, which keeps its index. So a shared scene isn't copied for
+    // each target. NULL for the scene's one.
+    void SetTarget( const Circle* target ) { mTarget = target; }
+
+    // The angular extents of the circles from the source, instead of the
+    // scene's (see FlatScene::Extents()). NULL for the scene's ones.
+    void SetExtents( const std::vector<float>* phi, const std::vector<float>* halfW )
+    {
+        mPhi = phi;
+        mHalfW = halfW;
+    }
+
+    // Sets hit[j] if lane j hits the target after exactly K reflections.
+    // If miss is not NULL, miss[j] is set to the distance from the target's
+    // center to the last leg (up to the circle it hits), or INF_DIST if lane
+    // j didn't make K reflections or the target is behind it. If path is not
+    // NULL, path[j] is set to a hash of the circles lane j reflected from, which
+    // tells the distinct paths apart. The angles must be increasing and span
+    // less than 2*PI - the narrower, the more circles are culled at once.
+    // Returns the number of hits.
+    int Trace( const Point& src, const float* angles, int K, bool* hit,
+               float* miss = NULL, unsigned long long* path = NULL ) const
+    {
+        float sx[N], sy[N], dx[N], dy[N], best[N];
+        int   on[N], bestIdx[N];
+        bool  active[N];
+
+        for ( int j=0; j<N; ++j )
+        {
+            sx[j] = src.x;
+            sy[j] = src.y;
+            dx[j] = cos(angles[j]);
+            dy[j] = sin(angles[j]);
+            on[j] = -1;
+            active[j] = true;
+            hit[j] = false;
+            if ( NULL != miss )
+                miss[j] = INF_DIST;
+            if ( NULL != path )
+                path[j] = 14695981039346656037ULL;  // FNV-1a
+        }
+
+        const float wedgeMin = angles[0];
+        const float wedgeMax = angles[N-1];
+        const float twoPi = 2.0f * static_cast<float>(M_PI);
+        const unsigned int numCircles = mScene.Size();
+        const std::vector<float>& phi = (NULL != mPhi)? *mPhi : mScene.phi;
+        const std::vector<float>& halfW = (NULL != mHalfW)? *mHalfW : mScene.halfW;
+
+        // The target's own one is tested apart from the scene's circles.
+        const int target = mScene.target;
+        const bool ownTarget = (NULL != mTarget) && (target >= 0);
+        const float tx = ownTarget? mTarget->C.x : ((target >= 0)? mScene.cx[target] : 0.0f);
+        const float ty = ownTarget? mTarget->C.y : ((target >= 0)? mScene.cy[target] : 0.0f);
+        const float tr2 = ownTarget? mTarget->R * mTarget->R : ((target >= 0)? mScene.r2[target] : 0.0f);
+
+        int numHits = 0;
+        int numLive = N;
+        FigureCounters* const cnt = mCounters;
+        if ( NULL != cnt )
+            cnt->path.resize(N * (K+1));
+
+        for ( int k=0; k<=K; ++k )
+        {
+            if ( (NULL != mCancel) && mCancel->loadAcquire() )
+                break;
+
+            for ( int j=0; j<N; ++j )
+            {
+                best[j] = INF_DIST;
+                bestIdx[j] = -1;
+            }
+
+            if ( (k > 0) && (mGraph != NULL) )
+            {
+                // Each lane leaves its own circle - test its visible neighbours.
+                for ( int j=0; j<N; ++j )
+                {
+                    if ( ! active[j] )
+                        continue;
+
+                    int count = 0;
+                    const int* cand = mGraph->Candidates(on[j], atan2(dy[j], dx[j]), &count);
+                    for ( int i=0; i<count; ++i )
+                        TestLane(j, cand[i], mScene.cx[cand[i]], mScene.cy[cand[i]],
+                                 mScene.r2[cand[i]], sx, sy, dx, dy, on, best, bestIdx);
+                    if ( target >= 0 )
+                        TestLane(j, target, tx, ty, tr2, sx, sy, dx, dy, on, best, bestIdx);
+
+                    if ( NULL != cnt )
+                    {
+                        for ( int i=0; i<count; ++i )
+                            ++cnt->tests[cand[i]];
+                        if ( mScene.target >= 0 )
+                            ++cnt->tests[mScene.target];
+                    }
+                }
+            }
+            else for ( unsigned int c=0; c<numCircles; ++c )
+            {
+                if ( ownTarget && (static_cast<int>(c) == target) )
+                {
+                    for ( int j=0; j<N; ++j )
+                        if ( active[j] )
+                            TestLane(j, target, tx, ty, tr2, sx, sy, dx, dy, on, best, bestIdx);
+                    if ( NULL != cnt )
+                        cnt->tests[c] += numLive;
+                    continue;
+                }
+
+                if ( k == 0 )
+                {
+                    // Shared culling: is the circle inside the packet's wedge?
+                    float d = remainder(phi[c] - 0.5f*(wedgeMin + wedgeMax), twoPi);
+                    if ( fabs(d) > 0.5f*(wedgeMax - wedgeMin) + halfW[c] )
+                        continue;
+                }
+
+                if ( NULL != cnt )
+                    cnt->tests[c] += numLive;
+
+                const float cx = mScene.cx[c];
+                const float cy = mScene.cy[c];
+                const float r2 = mScene.r2[c];
+
+                for ( int j=0; j<N; ++j )
+                {
+                    // Half-b form of Circle::Intersect() with a normalized dir.
+                    float smcx = sx[j] - cx;
+                    float smcy = sy[j] - cy;
+                    float h = dx[j]*smcx + dy[j]*smcy;
+                    float disc = h*h - (smcx*smcx + smcy*smcy - r2);
+                    float t = (disc < 0.25f*EPSILON)? -h : -h - sqrt(fabs(disc));
+                    bool valid = active[j] && (disc >= 0.0f) && (t > 0.0f) &&
+                                 (on[j] != static_cast<int>(c));
+                    if ( valid && (t < best[j]) )
+                    {
+                        best[j] = t;
+                        bestIdx[j] = c;
+                    }
+                }
+            }
+
+            int numActive = 0;
+            for ( int j=0; j<N; ++j )
+            {
+                if ( ! active[j] )
+                    continue;
+
+                int c = bestIdx[j];
+                if ( (c < 0) || (c == mScene.target) || (k == K) )
+                {
+                    // Missed everything, reached the target or out of bounces.
+                    hit[j] = (c >= 0) && (c == mScene.target) && (k == K);
+                    numHits += hit[j]? 1 : 0;
+                    active[j] = false;
+
+                    if ( (NULL != cnt) && (c >= 0) )
+                    {
+                        ++cnt->hits[c];
+                        if ( hit[j] )
+                        {
+                            ++cnt->solutions[c];
+                            for ( int i=0; i<k; ++i )
+                                ++cnt->solutions[cnt->path[j*(K+1) + i]];
+                        }
+                    }
+
+                    if ( (NULL != miss) && (k == K) && (mScene.target >= 0) )
+                    {
+                        // Closest point to B on the leg, up to the blocking circle.
+                        float bx = tx - sx[j];
+                        float by = ty - sy[j];
+                        float proj = bx*dx[j] + by*dy[j];
+                        if ( proj > 0.0f )
+                        {
+                            float d = (c == mScene.target)? proj : std::min(proj, best[j]);
+                            miss[j] = Module(bx - d*dx[j], by - d*dy[j]);
+                        }
+                    }
+                    continue;
+                }
+
+                // Reflect: r = Dir - 2(n.Dir)n
+                float px = sx[j] + best[j]*dx[j];
+                float py = sy[j] + best[j]*dy[j];
+                float nx = (px - mScene.cx[c]) / mScene.r[c];
+                float ny = (py - mScene.cy[c]) / mScene.r[c];
+                float ndot = 2.0f * (nx*dx[j] + ny*dy[j]);
+                dx[j] -= ndot * nx;
+                dy[j] -= ndot * ny;
+                // Grazing hits are off the surface - keep the direction normalized.
+                float len = sqrt(dx[j]*dx[j] + dy[j]*dy[j]);
+                dx[j] /= len;
+                dy[j] /= len;
+                sx[j] = px;
+                sy[j] = py;
+                on[j] = c;
+
+                if ( (NULL != mReach) && ! mReach->Reaches(c, K-k-1, atan2(dy[j], dx[j])) )
+                {
+                    // Doomed - the rest of its path can't get to the target.
+                    active[j] = false;
+                    if ( NULL != cnt )
+                        ++cnt->hits[c];
+                    continue;
+                }
+                ++numActive;
+
+                if ( NULL != cnt )
+                {
+                    ++cnt->hits[c];
+                    cnt->path[j*(K+1) + k] = c;
+                }
+                if ( NULL != path )
+                    path[j] = (path[j] ^ static_cast<unsigned int>(c)) * 1099511628211ULL;
+            }
+
+            if ( numActive == 0 )
+                break;
+            numLive = numActive;
+        }
+
+        return numHits;
+    }
+
+  private:
+    // The scalar version of the lane loop above, for circle c at cx, cy.
+    void TestLane( int j, int c, float cx, float cy, float r2,
+                   const float* sx, const float* sy,
+                   const float* dx, const float* dy, const int* on,
+                   float* best, int* bestIdx ) const
+    {
+        float smcx = sx[j] - cx;
+        float smcy = sy[j] - cy;
+        float h = dx[j]*smcx + dy[j]*smcy;
+        float disc = h*h - (smcx*smcx + smcy*smcy - r2);
+        float t = (disc < 0.25f*EPSILON)? -h : -h - sqrt(fabs(disc));
+        if ( (disc >= 0.0f) && (t > 0.0f) && (on[j] != c) && (t < best[j]) )
+        {
+            best[j] = t;
+            bestIdx[j] = c;
+        }
+    }
+
+    const FlatScene&       mScene;
+    const VisibilityGraph* mGraph;
+    FigureCounters*        mCounters;
+    const QAtomicInt*      mCancel;
+    const ReachSets*       mReach;
+    const Circle*          mTarget;
+    const std::vector<float>* mPhi;
+    const std::vector<float>* mHalfW;
+};
+
+}  // namespace
+
+#endif // PACKET_H
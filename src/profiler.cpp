@@ -0,0 +1,130 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <fstream>
+#include <iomanip>
+#include "profiler.h"
+
+
+namespace circles
+{
+
+const unsigned int PROFILE_RING_SIZE = 65536;  // Events kept per thread
+const char* const  PROFILE_TRACE_FILE = "circles_trace.json";  // Written at exit
+
+
+/********************************* Profiler ***********************************/
+
+struct Profiler::RingHolder
+{
+    RingHolder() : ring(NULL) {}
+
+    ~RingHolder()
+    {
+        if ( NULL == ring )
+            return;
+
+        Profiler& p = Profiler::Instance();
+        QMutexLocker lock(&p.mMutex);
+        p.mFree.push_back(ring);
+    }
+
+    ProfileRing* ring;
+};
+
+
+Profiler::Profiler() :
+        mClock(),
+        mMutex(),
+        mRings(),
+        mFree()
+{
+    mClock.start();
+}
+
+
+Profiler::~Profiler()
+{
+    for ( std::vector<ProfileRing*>::iterator r=mRings.begin(); r != mRings.end(); ++r )
+        delete *r;
+}
+
+
+Profiler& Profiler::Instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+
+ProfileRing* Profiler::ThreadRing()
+{
+    static thread_local RingHolder holder;
+
+    if ( NULL == holder.ring )
+    {
+        QMutexLocker lock(&mMutex);
+        if ( ! mFree.empty() )
+        {
+            // Its events stay, the ones of this thread follow them.
+            holder.ring = mFree.back();
+            mFree.pop_back();
+        }
+        else
+        {
+            holder.ring = new ProfileRing(mRings.size() + 1);
+            mRings.push_back(holder.ring);
+        }
+    }
+
+    return holder.ring;
+}
+
+
+bool Profiler::WriteTrace( const char* fileName, std::stringstream& errSStr ) const
+{
+    std::ofstream out(fileName);
+    if ( ! out.is_open() )
+    {
+        errSStr << "Unable to open the trace file '" << fileName << "'";
+        return false;
+    }
+
+    QMutexLocker lock(&mMutex);
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+    out << std::fixed << std::setprecision(3);
+
+    bool first = true;
+    for ( std::vector<ProfileRing*>::const_iterator r=mRings.begin(); r != mRings.end(); ++r )
+    {
+        const ProfileRing& ring = **r;
+
+        out << (first? "" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring.Tid()
+            << ",\"args\":{\"name\":\"Thread " << ring.Tid() << "\"}}";
+        first = false;
+
+        unsigned long long end = ring.NumAdded();
+        unsigned long long begin = (end > PROFILE_RING_SIZE)? end - PROFILE_RING_SIZE : 0;
+        for ( unsigned long long i=begin; i<end; ++i )
+        {
+            const ProfileEvent& e = ring.Event(i);
+            out << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring.Tid()
+                << ",\"ts\":" << e.start / 1000.0 << ",\"dur\":" << e.duration / 1000.0 << "}";
+        }
+    }
+
+    out << std::endl << "]}" << std::endl;
+    out.close();
+
+    if ( ! out )
+    {
+        errSStr << "Failed writing the trace file '" << fileName << "'";
+        return false;
+    }
+    return true;
+}
+
+}  // namespace
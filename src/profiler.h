@@ -0,0 +1,133 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <vector>
+#include <sstream>
+#include <iostream>
+
+#include "qglobal.h"
+#include <QElapsedTimer>
+#include <QMutex>
+
+
+namespace circles
+{
+
+extern const unsigned int PROFILE_RING_SIZE;
+extern const char* const  PROFILE_TRACE_FILE;
+
+
+/********************************* Profiler ***********************************/
+
+struct ProfileEvent
+{
+    const char* name;      // A string literal
+    qint64      start;     // ns since the profiler was created
+    qint64      duration;  // ns
+};
+
+
+// The last PROFILE_RING_SIZE events of one thread. Only that thread writes it.
+class ProfileRing
+{
+  public:
+    explicit ProfileRing(int tid) : mTid(tid), mEvents(PROFILE_RING_SIZE), mNext(0) {}
+
+    void Add(const char* name, qint64 start, qint64 duration)
+    {
+        ProfileEvent& e = mEvents[mNext % PROFILE_RING_SIZE];
+        e.name = name;
+        e.start = start;
+        e.duration = duration;
+        ++mNext;
+    }
+
+    int Tid() const { return mTid; }
+    unsigned long long NumAdded() const { return mNext; }
+    const ProfileEvent& Event(unsigned long long i) const { return mEvents[i % PROFILE_RING_SIZE]; }
+
+  private:
+    int                        mTid;
+    std::vector<ProfileEvent>  mEvents;
+    unsigned long long         mNext;  // Total added, the oldest are overwritten
+};
+
+
+/* Collects timed phases from all threads, each into its own ring, so adding an
+ * event takes no lock, and writes them in the Chrome trace-event format (open
+ * it in chrome://tracing or https://ui.perfetto.dev). The rings outlive their
+ * threads: the ring of an exited thread goes on with the next new thread, so
+ * there are only as many rings as threads ran at once. Used through the
+ * PROFILE_ macros below, which compile to nothing unless CIRCLES_PROFILE is
+ * defined. */
+class Profiler
+{
+  public:
+    static Profiler& Instance();
+
+    qint64 Now() const { return mClock.nsecsElapsed(); }
+
+    // The calling thread's ring, created the first time.
+    ProfileRing* ThreadRing();
+
+    // Call it when the profiled threads are idle - the rings aren't locked.
+    bool WriteTrace(const char* fileName, std::stringstream& errSStr) const;
+
+  private:
+    // Gives the ring back when its thread exits.
+    struct RingHolder;
+
+    Profiler();
+    ~Profiler();
+
+    QElapsedTimer              mClock;
+    mutable QMutex             mMutex;  // Guards mRings and mFree
+    std::vector<ProfileRing*>  mRings;
+    std::vector<ProfileRing*>  mFree;   // Of the exited threads
+
+    Profiler(const Profiler&);
+    Profiler& operator=(const Profiler&);
+};
+
+
+// Times its own scope.
+class ProfileScope
+{
+  public:
+    explicit ProfileScope(const char* name) :
+        mName(name), mStart(Profiler::Instance().Now()) {}
+
+    ~ProfileScope()
+    {
+        Profiler& p = Profiler::Instance();
+        p.ThreadRing()->Add(mName, mStart, p.Now() - mStart);
+    }
+
+  private:
+    const char* mName;
+    qint64      mStart;
+};
+
+
+#ifdef CIRCLES_PROFILE
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b)  PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name)   circles::ProfileScope PROFILE_CONCAT(profileScope_, __LINE__)(name)
+#define PROFILE_WRITE()                                                           \
+    do {                                                                          \
+        std::stringstream profileErr;                                             \
+        if ( ! circles::Profiler::Instance().WriteTrace(circles::PROFILE_TRACE_FILE, profileErr) ) \
+            std::cerr << profileErr.str() << std::endl;                           \
+    } while ( 0 )
+#else
+#define PROFILE_SCOPE(name)
+#define PROFILE_WRITE()
+#endif // CIRCLES_PROFILE
+
+}  // namespace
+
+#endif // PROFILER_H
@@ -7,9 +7,22 @@
 #include <iomanip>
 #include <string>
 #include <algorithm>
+#include <cmath>
 #include <cstdlib>
 #include <ctime>
 #include "renderer.h"
+#include "scene.h"
+#include "packet.h"
+#include "visibility.h"
+#include "sampler.h"
+#include "tracker.h"
+#include "sink.h"
+#include "density.h"
+#include "export.h"
+#include "profiler.h"
+#include "heatmap.h"
+#include "beam.h"
+#include "jobs.h"
 #include "ui.h"
 
 
@@ -22,7 +35,13 @@ namespace circles
 const float MIN_TARGET_SIZE      = 2.0f;
 const float MAX_TARGET_SIZE      = 4.0f;
 const float INC_TARGET_SIZE      = 1.0f;
-unsigned long MAX_NUM_RAYS       = 2000000;  // TODO: Make it configurable
+unsigned long MAX_NUM_RAYS       = 2000000;  // Per target size, at most
+const float PICK_DISTANCE        = 4.0f;  // Pixels from a figure, in which a click selects it
+const unsigned int RESULTS_CHUNK_SIZE = 256;  // Solutions sent to the GUI at once
+const int RESULTS_FLUSH_MS       = 50;    // Or earlier, if there are only a few
+const unsigned int SOLUTIONS_DISPLAY_MAX = 100000;  // Kept in memory for drawing
+const unsigned long COARSE_NUM_RAYS = 65536;  // Of the preview in latency first mode
+const int PROGRESS_REPORT_MS     = 100;   // The progress is sent at most this often
 
 
 RenderingFrame::RenderingFrame(ReflectiveCirclesUI *ui, QWidget *parent):
@@ -31,22 +50,51 @@ RenderingFrame::RenderingFrame(ReflectiveCirclesUI *ui, QWidget *parent):
         mMousePressed(false),
         mMousePressPos(0,0),
         mMoseEditFig(NULL),
-        mRenderingInProgress(false),
+        mPanning(false),
+        mPanPos(0,0),
         mA(NULL),
         mB(NULL),
         mScene(),
-        mRays()
+        mView(),
+        mGrid(),
+        mGridDirty(false),
+        mVisible(),
+        mSolutions(),
+        mSolutionPainter(),
+        mDensity(),
+        mDensityArea(),
+        mFigureStats(NULL),
+        mShowHeatmap(false),
+        mBudget(),
+        mSearchMode(SM_RAYS),
+        mSolutionsFile(),
+        mJobs(new RenderQueue(0, this)),
+        mViewJob(-1),
+        mQueuedViewJob(-1),
+        mDThread(NULL),
+        mQueuedDensity(),
+        mQueuedDensityK(0),
+        mEThread(NULL),
+        mTracker(NULL)
 {
+    qRegisterMetaType<SolutionLogPtr>("SolutionLogPtr");
+    connect(mJobs, SIGNAL(sendResults(int, SolutionLogPtr)), this, SLOT(addResults(int, SolutionLogPtr)));
+    connect(mJobs, SIGNAL(sendJobStarted(int)), this, SLOT(noteJobStarted(int)));
+    connect(mJobs, SIGNAL(sendJobFinished(int, bool, QString)), this, SLOT(noteJobFinished(int, bool, QString)));
+    connect(mJobs, SIGNAL(sendQueueChanged()), this, SLOT(noteQueueChanged()));
+    qRegisterMetaType<FigureStats*>("FigureStats*");
+    connect(mJobs, SIGNAL(sendFigureStats(int, FigureStats*)), this, SLOT(setFigureStats(int, FigureStats*)));
+    connect(mJobs, SIGNAL(sendClearPreview(int)), this, SLOT(clearPreview(int)));
+    connect(mJobs, SIGNAL(sendProgress(int, int, int)), this, SLOT(setProgress(int, int, int)));
 }
 
 
 RenderingFrame::~RenderingFrame()
 {
-    for ( std::vector<Figure*>::iterator fig=mScene.begin();
-          fig != mScene.end(); ++fig )
-    {
-        delete *fig;
-    }
+    SetLiveTracking(false);
+
+    DeleteFigures(&mScene);
+    delete mFigureStats;
 }
 
 
@@ -72,27 +120,14 @@ bool RenderingFrame::CheckInput() const
 }
 
 
-// Remove leading spaces
-inline void ltrim( std::string & s )
-{
-    while ( isspace(s[0]) )
-        s.erase(0,1);
-}
-
-
-// TODO: Break in several sub-functions
 void RenderingFrame::LoadScene(const char *fileName)
 {
-    if ( RenderingInProgress() )
-    {
-        QMessageBox::warning(this, "ERROR", "Rendering is in progress");
-        return;
-    }
+    PROFILE_SCOPE("LoadScene");
 
     std::ifstream inFile;
     std::stringstream errSStr;
 
-    inFile.open(fileName, std::ios::in);
+    inFile.open(fileName, std::ios::in | std::ios::binary);  // Or a binary scene
     if ( ! inFile.is_open() )
     {
         errSStr << "Unable to open the input file '" << fileName << "'";
@@ -102,217 +137,21 @@ void RenderingFrame::LoadScene(const char *fileName)
 
     Reset();  // Delete the old scene first. Do we need to do this?
 
-    const std::string CirclesBeginDelim="CirclesBegin";
-    const std::string CirclesEndDelim = "CirclesEnd";
-
-    float minX = INF_DIST;
-    float minY = INF_DIST;
-    float maxX = -INF_DIST;
-    float maxY = -INF_DIST;
-
-    std::string s;
-    float x, y, r;
-    Point pt(0,0);
-    Circle cr(0,0,0);
-    bool doScale=false;
-
-    while ( std::getline(inFile, s) )
+    SceneInfo info;
     {
-        ltrim(s);
-        if ( ('\0' == s[0]) || ('#' == s[0]) )
-            continue;
-
-        // TODO: generic point section?
-        if ( s.substr(0,2) == "A=" )
-        {
-            int res = sscanf((s.substr(2)).c_str(), "%f %f", &x, &y);
-            if ( res != 2 )
-            {
-                errSStr << "Ignored invalid A on this row : " << s 
-                        << std::endl;
-                continue;
-            }
-
-            pt.x = x;
-            pt.y = y;
-
-            if ( NULL != FindCollision(&pt) )
-            {
-                errSStr << "Ignored overlapping A on this row : " << s 
-                        << std::endl;
-                continue;
-            }
-
-            if ( NULL == mA )
-            {
-                mA = new Point(pt);
-                mScene.push_back(mA);
-            }
-            else
-            {
-                *mA = pt;
-            }
-
-            if ( x < minX ) minX = x;
-            if ( y < minY ) minY = y;
-            if ( x > maxX ) maxX = x;
-            if ( y > maxY ) maxY = y;
-
-            continue;
-        }
-
-        else if ( s.substr(0,2) == "B=" )
-        {
-            int res = sscanf((s.substr(2)).c_str(), "%f %f", &x, &y);
-            if ( res != 2 )
-            {
-                errSStr << "Ignored invalid B on this row : " << s 
-                        << std::endl;
-                continue;
-            }
-
-            pt.x = x;
-            pt.y = y;
-
-            if ( NULL != FindCollision(&pt) )
-            {
-                errSStr << "Ignored overlapping B on this row : " << s 
-                        << std::endl;
-                continue;
-            }
-
-            if ( NULL == mB )
-            {
-                mB = new Point(pt);
-                mScene.push_back(mB);
-            }
-            else
-            {
-                *mB = pt;
-            }
-
-            if ( x < minX ) minX = x;
-            if ( y < minY ) minY = y;
-            if ( x > maxX ) maxX = x;
-            if ( y > maxY ) maxY = y;
-
-            continue;
-        }
-
-        else if ( s.substr(0,CirclesBeginDelim.length()) == CirclesBeginDelim )
-        {
-            while (std::getline(inFile, s))
-            {
-                ltrim(s);
-                if ( ('\0' == s[0]) || ('#' == s[0]) )
-                    continue;
-                if ( s.substr(0,CirclesEndDelim.length()) == CirclesEndDelim )
-                    break;
-
-                int res = sscanf(s.c_str(), "%f %f %f",  &x, &y, &r);
-                if ( res != 3 )
-                {
-                    errSStr << "Ignored invalid circle on this row : " << s 
-                            << std::endl;
-                    continue;
-                }
-
-                if ( r < 0 )
-                    r = 0.0f;
-
-                cr.C.x = x;
-                cr.C.y = y;
-                cr.R = r;
-
-                if ( NULL != FindCollision(&cr) )
-                {
-                    errSStr << "Ignored overlapping circle on this row : " 
-                            << s << std::endl;
-                    continue;
-                }
-
-                Circle* crp = new Circle(cr);
-                mScene.push_back(crp);
-
-                if ( x-r < minX ) minX = x-r;
-                if ( y-r < minY ) minY = y-r;
-                if ( x+r > maxX ) maxX = x+r;
-                if ( y+r > maxY ) maxY = y+r;
-
-                continue;
-            }
-        }
-
-        else if ( s.substr(0,2) == "K=" )
-        {
-            int K;
-            int res = sscanf((s.substr(2)).c_str(), "%d", &K);
-            if ( (res != 1) || (K < 1) )
-            {
-                errSStr << "Ignored invalid K on this row : " << s 
-                        << std::endl;
-                continue;
-            }
-
-            mUI->SetK(K);
-            continue;
-        }
-
-        else if ( s.substr(0,6) == "Scale=" )
-        {
-            if ( s.find("true", 6) != std::string::npos )
-                doScale = true;
-            else
-                doScale = false;
-        }
+        PROFILE_SCOPE("ReadScene");
+        ReadScene(inFile, &mScene, &info, errSStr);
     }
+    mA = info.A;
+    mB = info.B;
+
+    if ( info.K >= 0 )
+        mUI->SetK(info.K);
 
-    if ( doScale )
+    if ( info.scale )
     {
         // Scale the scene to fit in the rendering frame
-        int width = mUI->GetRenderWidth();
-        int height = mUI->GetRenderHeight();
-        int margin = width / 100; // 1% margin
-        width -= 2*margin;
-        height -= 2*margin;
-        float xScale=1.0f, yScale=1.0f, scale;
-
-        if ( minX < maxX )
-            xScale = width / (maxX - minX);
-
-        if ( minY < maxY )
-            yScale = height / (maxY - minY);
-
-        scale = (xScale < yScale)? xScale : yScale;
-
-        for ( std::vector<Figure*>::iterator fig=mScene.begin();
-              fig != mScene.end(); ++fig )
-        {
-            // TODO Replace dynamic_cast<> with virtual Scale() call
-            Point *ptp = dynamic_cast<Point*>(*fig);
-            if ( NULL != ptp )
-            {
-                ptp->x -= minX;
-                ptp->x *= scale;
-                ptp->y -= minY;
-                ptp->y *= scale;
-                ptp->x += margin;
-                ptp->y += margin;
-                continue;
-            }
-
-            Circle *crp = dynamic_cast<Circle*>(*fig);
-            if ( NULL !=  crp )
-            {
-                crp->C.x -= minX;
-                crp->C.x *= scale;
-                crp->C.y -= minY;
-                crp->C.y *= scale;
-                crp->C.x += margin;
-                crp->C.y += margin;
-                crp->R *= scale;
-            }
-        }
+        ScaleScene(mScene, info, mUI->GetRenderWidth(), mUI->GetRenderHeight());
     }
 
     if (errSStr.str() != "")
@@ -320,7 +159,9 @@ void RenderingFrame::LoadScene(const char *fileName)
 
     inFile.close();
 
-    update();
+    mGridDirty = true;
+    FitView();  // Unscaled scenes may be anywhere.
+    NotifyLiveTracker();
 }
 
 
@@ -329,7 +170,10 @@ void RenderingFrame::SaveScene(const char *fileName) const
     std::ofstream outFile;
     std::stringstream errSStr;
 
-    outFile.open(fileName, std::ios::out);
+    std::string name(fileName);
+    bool binary = (name.size() >= 4) && (name.compare(name.size() - 4, 4, ".bin") == 0);
+
+    outFile.open(fileName, binary? (std::ios::out | std::ios::binary) : std::ios::out);
     if ( ! outFile.is_open() )
     {
         errSStr << "Unable to open the output file '" << fileName << "'";
@@ -337,68 +181,112 @@ void RenderingFrame::SaveScene(const char *fileName) const
         return;
     }
 
-    outFile << std::fixed << std::setprecision(6);
+    if ( binary )
+        WriteSceneBinary(outFile, mScene, mA, mB, mUI->GetK(), errSStr);
+    else
+        WriteScene(outFile, mScene, mA, mB, mUI->GetK(), errSStr);
 
-    for ( std::vector<Figure*>::const_iterator fig=mScene.begin();
-          fig != mScene.end(); ++fig )
-    {
-        // TODO Replace dynamic_cast<> with virtual Serialize() call
-        const Point *pt = dynamic_cast<const Point*>(*fig);
-        if ( NULL != pt )
-        {
-            outFile << std::endl;
+    if (errSStr.str() != "")
+        QMessageBox::warning(mUI, "WARNING", errSStr.str().c_str());
+
+    outFile.close();
+}
 
-            if ( pt == mA )
-                outFile << "A= " << pt->x << " " << pt->y << std::endl;
-            else if ( pt == mB )
-                outFile << "B= " << pt->x << " " << pt->y << std::endl;
-            else
-                errSStr << "Unknown point in the scene" << std::endl;
-        }
-    }
 
-    outFile << std::endl << "CirclesBegin" << std::endl;
-    for ( std::vector<Figure*>::const_iterator fig=mScene.begin();
-          fig != mScene.end(); ++fig )
+void RenderingFrame::ExportImage(const char *fileName, int width)
+{
+    if ( NULL != mEThread )
     {
-        const Circle *cr = dynamic_cast<const Circle*>(*fig);
-        if ( NULL !=  cr )
-        {
-            outFile << cr->C.x << " " << cr->C.y << " " << cr->R << std::endl;
-        }
+        QMessageBox::warning(mUI, "ERROR", "Exporting is in progress");
+        return;
     }
-    outFile << "CirclesEnd" << std::endl;
 
-    outFile << std::endl << "K=" << mUI->GetK() << std::endl;
+    // The scene and the solutions can change meanwhile.
+    mEThread = new ExportThread(SceneSnapshot::Create(mScene, mA, mB), mSolutions,
+                                fileName, width);
+    connect(mEThread, SIGNAL(sendExported(bool, QString)), this, SLOT(noteExported(bool, QString)), Qt::QueuedConnection);
+    connect(mEThread, &ExportThread::finished, mEThread, &QObject::deleteLater);  // auto-delete
+    QApplication::setOverrideCursor(Qt::BusyCursor);
+    mEThread->start();
+}
 
-    outFile << std::endl << "Scale=false" << std::endl;
 
-    if (errSStr.str() != "")
-        QMessageBox::warning(mUI, "WARNING", errSStr.str().c_str());
+void RenderingFrame::noteExported(bool result, QString error)
+{
+    mEThread = NULL;  // Deletes itself.
+    QApplication::restoreOverrideCursor();
 
-    outFile.close();
+    if ( ! result )
+        QMessageBox::warning(mUI, "ERROR", error);
 }
 
 
 void RenderingFrame::paintEvent(QPaintEvent *e)
 {
+    PROFILE_SCOPE("paintEvent");
+
     QPainter painter(this);  // Store it in the class?
 
     painter.setRenderHint(QPainter::Antialiasing, true);  // Is this safe?
+    painter.setTransform(mView.Transform());
+
+    // The visible part of the scene, with room for the pens.
+    const float pixel = 1.0f / mView.Zoom();
+    const QRectF area = mView.Visible(width(), height()).adjusted(-4*pixel, -4*pixel,
+                                                                  4*pixel, 4*pixel);
 
-    // Do we have to re-paint everything?
+    if ( ! mDensity.isNull() )
+        painter.drawImage(mDensityArea, mDensity);  // Under the figures
 
-    for ( std::vector<Figure*>::const_iterator fig=mScene.begin();
-          fig != mScene.end(); ++fig )
     {
-        (*fig)->Draw(&painter);
+        PROFILE_SCOPE("Draw figures");
+        if ( mGridDirty )
+        {
+            mGrid.Build(mScene);
+            mGridDirty = false;
+        }
+        mVisible.clear();
+        mGrid.Query(area, &mVisible);
+
+        // Circles smaller than a pixel are drawn as dots, all at once.
+        std::vector<QPointF> dots;
+        for ( std::vector<unsigned int>::const_iterator v=mVisible.begin();
+              v != mVisible.end(); ++v )
+        {
+            const Figure* fig = mScene[*v];
+            if ( fig == mMoseEditFig )
+                continue;  // Drawn last - it may have left its cells.
+
+            // TODO Replace dynamic_cast<>
+            const Circle *crp = dynamic_cast<const Circle*>(fig);
+            if ( (NULL != crp) && (crp->R * mView.Zoom() < VIEW_DOT_SIZE) )
+                dots.push_back(crp->C);
+            else
+                fig->Draw(&painter);
+        }
+
+        if ( ! dots.empty() )
+        {
+            QPen pen(Qt::blue, 2, Qt::SolidLine);
+            pen.setCosmetic(true);
+            painter.setPen(pen);
+            painter.drawPoints(&dots[0], dots.size());
+        }
+
+        if ( NULL != mMoseEditFig )
+            mMoseEditFig->Draw(&painter);
     }
 
-    // May need mutex protection if using DirectConnection with RenderingThread!
-    for ( std::vector<Ray>::const_iterator iray=mRays.begin();
-          iray != mRays.end(); ++iray )
+    if ( mShowHeatmap && (NULL != mFigureStats) )
     {
-        iray->Draw(&painter);
+        PROFILE_SCOPE("Draw heatmap");
+        DrawHeatmap(*mFigureStats, area, &painter);
+    }
+
+    {
+        PROFILE_SCOPE("Draw solutions");
+        // May need mutex protection if using DirectConnection with RenderingThread!
+        mSolutionPainter.Draw(mSolutions, &painter, area, width(), height());
     }
 
     QFrame::paintEvent(e);
@@ -413,7 +301,10 @@ void RenderingFrame::DelFigure(Figure* fig)
     std::vector<Figure*>::iterator ci = std::find( mScene.begin(), mScene.end(),
                                                    fig );
     if ( ci != mScene.end() )
+    {
         mScene.erase(ci);
+        mGridDirty = true;
+    }
     else
         QMessageBox::warning(mUI, "ERROR", "Figure not found in DelFigure()");  // or throw?
 
@@ -425,13 +316,19 @@ void RenderingFrame::DelFigure(Figure* fig)
 
 Figure* RenderingFrame::FindCollision(const Figure* fig) const
 {
-    for ( std::vector<Figure*>::const_iterator f=mScene.begin();
-          f != mScene.end(); ++f )
-    {
-        if ( fig == *f )
-            continue;
+    return circles::FindCollision(mScene, fig);
+}
 
-        if ( fig->Distance(*f) <= 0.0f )
+
+Figure* RenderingFrame::FindFigureAt(const Point& pos) const
+{
+    const float pickDistance = PICK_DISTANCE / mView.Zoom();
+
+    // The last drawn figure is on top.
+    for ( std::vector<Figure*>::const_reverse_iterator f=mScene.rbegin();
+          f != mScene.rend(); ++f )
+    {
+        if ( pos.Distance(*f) <= pickDistance )
             return *f;
     }
     return NULL;
@@ -440,14 +337,33 @@ Figure* RenderingFrame::FindCollision(const Figure* fig) const
 
 void RenderingFrame::mousePressEvent(QMouseEvent * e)
 {
-    if ( RenderingInProgress() )
+    if ( e->button() != Qt::LeftButton )
     {
-        QMessageBox::warning(this, "ERROR", "Rendering is in progress");
+        // Pan the view, in any drawing mode.
+        mPanning = true;
+        mPanPos = e->pos();
         return;
     }
 
+    // The running search, if any, has its own snapshot of the scene.
     mMousePressed = true;
-    mMousePressPos = e->pos();
+    mMousePressPos = mView.ToScene(e->pos());
+
+    if ( mUI->GetDrawingMode() == DM_MOVE )
+    {
+        // Pick the figure to drag. The rays are kept in live tracking mode.
+        mMoseEditFig = FindFigureAt(mMousePressPos);
+        if ( NULL == mMoseEditFig )
+            mMousePressed = false;
+        else if ( NULL == mTracker )
+        {
+            mSolutions.Clear();
+            mDensity = QImage();
+            SetFigureStats(NULL);
+        }
+        update();
+        return;
+    }
 
     if ( NULL != FindCollision(&mMousePressPos) )
     {
@@ -474,6 +390,7 @@ void RenderingFrame::mousePressEvent(QMouseEvent * e)
                 mB = newPt;
 
             mScene.push_back(newPt);
+            mGridDirty = true;
             break;
         }
 
@@ -482,6 +399,7 @@ void RenderingFrame::mousePressEvent(QMouseEvent * e)
             Circle* cr = new Circle(mMousePressPos, 0);
             mMoseEditFig = cr;
             mScene.push_back(cr);
+            mGridDirty = true;
             break;
         }
 
@@ -489,17 +407,33 @@ void RenderingFrame::mousePressEvent(QMouseEvent * e)
             break;
     }
 
-    mRays.clear();
+    if ( NULL == mTracker )
+    {
+        mSolutions.Clear();
+        mDensity = QImage();
+        SetFigureStats(NULL);
+    }
+    else
+        NotifyLiveTracker();
+
     update();
 }
 
 
 void RenderingFrame::mouseMoveEvent(QMouseEvent * e)
 {
-    if ( RenderingInProgress() || (! mMousePressed) )
+    if ( mPanning )
+    {
+        mView.Pan(e->pos().x() - mPanPos.x(), e->pos().y() - mPanPos.y());
+        mPanPos = e->pos();
+        update();
         return;
+    }
 
-    Point mousePos = e->pos();
+    if ( ! mMousePressed )
+        return;
+
+    Point mousePos = mView.ToScene(e->pos());
 
     switch ( mUI->GetDrawingMode() )
     {
@@ -517,26 +451,50 @@ void RenderingFrame::mouseMoveEvent(QMouseEvent * e)
                 {
                     QMessageBox::warning(mUI, "ERROR", "Overlapping figures!");
                     DelFigure(cp);
+                    mMoseEditFig = NULL;
+                    NotifyLiveTracker();
                     return;
                 }
             }
             break;
         }
 
+        case DM_MOVE:
+        {
+            if ( NULL != mMoseEditFig )
+            {
+                float dx = mousePos.x - mMousePressPos.x;
+                float dy = mousePos.y - mMousePressPos.y;
+                mMoseEditFig->Translate(dx, dy);
+                if ( NULL != FindCollision(mMoseEditFig) )
+                {
+                    mMoseEditFig->Translate(-dx, -dy);  // Stop at the obstacle.
+                    return;
+                }
+                mMousePressPos = mousePos;
+            }
+            break;
+        }
+
         default:
             break;
     }
 
+    NotifyLiveTracker();
     update();
 }
 
 
 void RenderingFrame::mouseReleaseEvent(QMouseEvent * e)
 {
-    if ( RenderingInProgress() || (! mMousePressed) )
+    if ( e->button() != Qt::LeftButton )
+    {
+        mPanning = false;
         return;
+    }
 
-    QPoint mouseReleasePos = e->pos();
+    if ( ! mMousePressed )
+        return;
 
     switch ( mUI->GetDrawingMode() )
     {
@@ -554,18 +512,53 @@ void RenderingFrame::mouseReleaseEvent(QMouseEvent * e)
                     if ( cp->R > 0 )
                         QMessageBox::warning(mUI, "ERROR", "Circle is too small");
                     DelFigure(cp);
+                    NotifyLiveTracker();
                 }
             }
             mMoseEditFig = NULL;
             break;
         }
 
+        case DM_MOVE:
+            mMoseEditFig = NULL;
+            break;
+
         default:
             break;
     }
 
     mMousePressed = false;
+    mGridDirty = true;  // The edited figure was drawn apart from the grid.
+
+    update();
+}
 
+
+void RenderingFrame::wheelEvent(QWheelEvent * e)
+{
+    // Most mice turn by 120 per step.
+#if QT_VERSION >= 0x050000
+    float steps = e->angleDelta().y() / 120.0f;
+#else
+    float steps = e->delta() / 120.0f;
+#endif  // QT_VERSION
+    mView.ZoomAt(pow(VIEW_ZOOM_STEP, steps), e->pos());
+    update();
+}
+
+
+void RenderingFrame::FitView()
+{
+    SceneInfo info;
+    SceneBounds(mScene, &info);
+    mView.Fit(info, width(), height());
+    update();
+}
+
+
+void RenderingFrame::ResetView()
+{
+    mView.Reset();
     update();
 }
 
@@ -577,74 +570,549 @@ void RenderingFrame::Reset()
     mMoseEditFig = NULL;
     mA = mB = NULL;
 
-    for ( std::vector<Figure*>::iterator fig=mScene.begin();
-          fig != mScene.end(); ++fig )
+    DeleteFigures(&mScene);
+    mGrid.Clear();
+    mGridDirty = false;
+    mView.Reset();
+    mSolutions.Clear();
+    mDensity = QImage();
+    SetFigureStats(NULL);
+
+    if ( NULL != mTracker )
     {
-        delete *fig;
+        mTracker->Seed(mSolutions);
+        NotifyLiveTracker();
     }
-    mScene.clear();
-    mRays.clear();
 }
 
 
 void RenderingFrame::Render()
 {
-    // Check if mRThread is still alive (which if we are here SHOULD not be the case)?
+    SnapshotPtr snapshot;
+    {
+        PROFILE_SCOPE("Snapshot");
+        snapshot = SceneSnapshot::Create(mScene, mA, mB);
+    }
+
+    // It runs after the current one. A later request replaces it.
+    if ( mQueuedViewJob >= 0 )
+        mJobs->Cancel(mQueuedViewJob);
+    mQueuedDensity.clear();
+
+    int id = mJobs->Submit(snapshot, mUI->GetK(), mBudget, mSearchMode,
+                           VIEW_JOB_PRIORITY, true, mSolutionsFile);
+    const RenderJob* job = mJobs->Job(id);
+    if ( (NULL != job) && (JS_QUEUED == job->state) )
+        mQueuedViewJob = id;
+}
+
+
+// The file name with "_K<k>" before the extension.
+static std::string JobFileName( const std::string& fileName, int K )
+{
+    std::stringstream suffix;
+    suffix << "_K" << K;
+
+    std::string::size_type dot = fileName.rfind('.');
+    std::string::size_type slash = fileName.find_last_of("/\\");
+    if ( (std::string::npos == dot) ||
+         ((std::string::npos != slash) && (dot < slash)) )
+        return fileName + suffix.str();
+    return fileName.substr(0, dot) + suffix.str() + fileName.substr(dot);
+}
+
+
+int RenderingFrame::QueueJobs( int firstK, int lastK, int priority, const std::string& fileName )
+{
+    // One snapshot for all.
+    SnapshotPtr snapshot = SceneSnapshot::Create(mScene, mA, mB);
+
+    int numJobs = 0;
+    for ( int K=firstK; K<=lastK; ++K, ++numJobs )
+        mJobs->Submit(snapshot, K, mBudget, mSearchMode, priority, false,
+                      JobFileName(fileName, K));
+    return numJobs;
+}
+
+
+bool RenderingFrame::RenderingInProgress() const
+{
+    return (mViewJob >= 0) || (mQueuedViewJob >= 0) || (NULL != mDThread) ||
+           ! mQueuedDensity.isNull();
+}
+
+
+void RenderingFrame::noteJobStarted(int id)
+{
+    if ( id == mQueuedViewJob )
+        mQueuedViewJob = -1;
+    mViewJob = id;
+
+    if ( NULL != mDThread )
+        mDThread->requestInterruption();  // The search takes the view.
+
+    mSolutions.Clear();  // Delete the previous solutions.
+    mDensity = QImage();
+    SetFigureStats(NULL);
+    mUI->SetProgress(0, -1);
+    update();
+}
+
+
+void RenderingFrame::RenderDensity()
+{
+    if ( NULL == mA )
+    {
+        QMessageBox::warning(mUI, "ERROR", "Point A is missing.");
+        return;
+    }
+
+    // It runs after the current search or density. A later request replaces
+    // the queued one.
+    if ( mQueuedViewJob >= 0 )
+        mJobs->Cancel(mQueuedViewJob);
+    if ( NULL != mDThread )
+        mDThread->requestInterruption();
+
+    mQueuedDensity = SceneSnapshot::Create(mScene, mA, mB);
+    mQueuedDensityK = mUI->GetK();
+    StartQueuedDensity();
+}
+
+
+void RenderingFrame::StartQueuedDensity()
+{
+    if ( mQueuedDensity.isNull() || (mViewJob >= 0) || (mQueuedViewJob >= 0) ||
+         (NULL != mDThread) )
+        return;
+
+    mSolutions.Clear();
+    mDensity = QImage();
+    SetFigureStats(NULL);
+    update();
+
+    mDThread = new DensityThread(mQueuedDensity, mQueuedDensityK, width(), height());
+    mQueuedDensity.clear();
+    qRegisterMetaType<QImage*>("QImage*");
+    connect(mDThread, SIGNAL(sendDensity(QImage*, QRectF)), this, SLOT(setDensity(QImage*, QRectF)), Qt::QueuedConnection);
+    connect(mDThread, &DensityThread::finished, mDThread, &QObject::deleteLater);  // auto-delete
+    mDThread->start();
+}
+
+
+void RenderingFrame::setDensity(QImage* image, QRectF area)
+{
+    mDThread = NULL;  // Deletes itself.
+
+    if ( (mViewJob >= 0) || ! mQueuedDensity.isNull() )
+    {
+        delete image;  // A search or a newer density took the view meanwhile.
+        StartQueuedDensity();
+        return;
+    }
+
+    mDensity = *image;
+    mDensityArea = area;
+    delete image;
+
+    update();
+}
+
+
+void RenderingFrame::setFigureStats(int id, FigureStats* stats)
+{
+    if ( id != mViewJob )
+    {
+        delete stats;
+        return;
+    }
+
+    SetFigureStats(stats);
+    update();
+}
+
 
-    mRenderingInProgress = true;
+void RenderingFrame::SetFigureStats(FigureStats* stats)
+{
+    delete mFigureStats;
+    mFigureStats = stats;
+}
 
-    mRays.clear();  // Delete the previous solutions.
+
+void RenderingFrame::clearPreview(int id)
+{
+    if ( id != mViewJob )
+        return;
+
+    mSolutions.Clear();  // The full search has better ones.
     update();
+}
 
-    int K = mUI->GetK();
-    mRThread = new RenderingThread(mA, mB, mScene, K);
-    qRegisterMetaType<Ray>("Ray");
-    connect(mRThread, SIGNAL(sendRayInResults(Ray)), this, SLOT(addRayInResults(Ray)), Qt::QueuedConnection);
-    connect(mRThread, SIGNAL(sendRenderFinished(bool)), this, SLOT(noteRenderFinished(bool)), Qt::QueuedConnection);
-    connect(mRThread, &RenderingThread::finished, mRThread, &QObject::deleteLater);  // auto-delete
-    mRThread->start();
+
+void RenderingFrame::setProgress(int id, int percent, int etaMs)
+{
+    if ( id == mViewJob )
+        mUI->SetProgress(percent, etaMs);
 }
 
 
-void RenderingFrame::addRayInResults(const Ray& r)
+void RenderingFrame::addResults(int id, SolutionLogPtr chunk)
 {
-    mRays.push_back(r);
+    PROFILE_SCOPE("addResults");
+
+    if ( id != mViewJob )
+        return;
+
 #if 0  // Doesn't work
     QPainter painter(this);
     painter.setRenderHint(QPainter::Antialiasing, true);
-    r.Draw(&painter);
+    chunk->Draw(&painter);
 #else
     // May not be thread safe if using DirectConnection!
     update();
 #endif // 0
+    // Keep a bounded window for drawing. The sink, if any, got them all.
+    if ( mSolutions.Size() < SOLUTIONS_DISPLAY_MAX )
+    {
+        mSolutions.Append(*chunk);
+        mSolutions.Truncate(SOLUTIONS_DISPLAY_MAX);
+    }
 }
 
 
-void RenderingFrame::noteRenderFinished(bool result)
+void RenderingFrame::noteJobFinished(int id, bool found, QString error)
 {
-    mRenderingInProgress = false;
+    if ( ! error.isEmpty() )
+        QMessageBox::warning(mUI, "ERROR", error);
+
+    if ( id == mQueuedViewJob )
+    {
+        mQueuedViewJob = -1;  // Cancelled before it started
+        return;
+    }
+
+    if ( id != mViewJob )
+        return;  // Its solutions went to its file.
+
+    mViewJob = -1;
+    mUI->SetProgress(-1, -1);
 
-    if( !result )
+    if ( NULL != mTracker )
+        mTracker->Seed(mSolutions);  // Track the new solutions.
+
+    StartQueuedDensity();
+
+    if ( (mQueuedViewJob < 0) && mQueuedDensity.isNull() && (NULL == mDThread) && ! found )
         QMessageBox::warning(mUI, "Info", "No solutions found");
 
     update();
-    // Where it is safe to set mRThread to NULL?
+}
+
+
+void RenderingFrame::noteQueueChanged()
+{
+    mUI->UpdateJobs();
 }
 
 
 void RenderingFrame::StopRendering()
 {
-    if( NULL != mRThread ) mRThread->requestInterruption();
+    // Stop the queued one too. The other jobs go on.
+    if ( mQueuedViewJob >= 0 ) mJobs->Cancel(mQueuedViewJob);
+    if ( mViewJob >= 0 ) mJobs->Cancel(mViewJob);
+    if( NULL != mDThread ) mDThread->requestInterruption();
+    mQueuedDensity.clear();
+}
+
+
+void RenderingFrame::SetLiveTracking(bool on)
+{
+    if ( on == (NULL != mTracker) )
+        return;
+
+    if ( on )
+    {
+        mTracker = new LiveTracker();
+        qRegisterMetaType<SolutionLogPtr>("SolutionLogPtr");
+        connect(mTracker, SIGNAL(sendLiveRays(SolutionLogPtr)), this, SLOT(setLiveRays(SolutionLogPtr)), Qt::QueuedConnection);
+        mTracker->Seed(mSolutions);
+        NotifyLiveTracker();
+        mTracker->start(QThread::LowPriority);
+    }
+    else
+    {
+        mTracker->Stop();
+        delete mTracker;  // Late queued updates are dropped by setLiveRays().
+        mTracker = NULL;
+    }
+}
+
+
+void RenderingFrame::NotifyLiveTracker()
+{
+    if ( NULL != mTracker )
+        mTracker->UpdateScene(SceneSnapshot::Create(mScene, mA, mB), mUI->GetK());
+}
+
+
+void RenderingFrame::setLiveRays(SolutionLogPtr rays)
+{
+    // The rendering thread owns mSolutions until it finishes.
+    if ( RenderingInProgress() || (NULL == mTracker) )
+        return;
+
+    mSolutions.Swap(*rays);
+    update();
 }
 
 
 /***************************** RenderingThread ********************************/
 
+RenderingThread::~RenderingThread()
+{
+    delete mChunk;  // Not sent, if interrupted.
+    delete mStats;
+}
+
+
+void RenderingThread::AddResult(const Ray& ray, float launchAngle,
+                                const std::vector<unsigned int>* hits)
+{
+    if ( NULL == mChunk )
+    {
+        mChunk = new SolutionLog(mSnapshot, mK);
+        mFlushTimer.start();
+    }
+
+    if ( NULL != hits )
+        mChunk->Add(ray, launchAngle, *hits);
+    else
+        mChunk->AddPinned(ray);
+
+    // The file gets the whole traces.
+    if ( (NULL != mSink) && ! mPreview )
+        mTraces.Add(ray);
+
+    if ( (mChunk->Size() >= RESULTS_CHUNK_SIZE) ||
+         (mFlushTimer.elapsed() >= RESULTS_FLUSH_MS) )
+        FlushResults();
+}
+
+
+void RenderingThread::FlushResults()
+{
+    if ( NULL == mChunk )
+        return;
+
+    PROFILE_SCOPE("FlushResults");
+
+    if ( ! mTraces.Empty() )
+    {
+        mSink->Write(mTraces);
+        mTraces.Clear();
+    }
+
+    Q_EMIT sendResults(SolutionLogPtr(mChunk));
+    mChunk = NULL;
+}
+
+
+void RenderingThread::FlushOldResults()
+{
+    if ( (NULL != mChunk) && (mFlushTimer.elapsed() >= RESULTS_FLUSH_MS) )
+        FlushResults();
+}
+
+
+bool RenderingThread::CoarsePass( Circle* target, const RayBudget& budget, int numSizes )
+{
+    PROFILE_SCOPE("Coarse pass");
+
+    FlatScene flat;
+    flat.Build(mScene, target, *mA);
+    QSharedPointer<const VisibilityGraph> graph = VisibilityGraph::Cached(flat);
+    ReachSets reach;
+    if ( ! graph.isNull() )
+        reach.Build(flat, *graph, mK);
+    PacketTracer<PACKET_LANES> tracer(flat, graph.data());
+    tracer.SetCancel(&mCancel);
+    if ( ! reach.Empty() )
+        tracer.SetReach(&reach);
+
+    // An even sweep of packets, taken in the bit reversed order of their
+    // angles, so the rays traced so far are always spread evenly around A.
+    const unsigned int numPackets = COARSE_NUM_RAYS / PACKET_LANES;
+    unsigned int bits = 0;
+    while ( (1u << bits) < numPackets )
+        ++bits;
+    const float laneStep = 2.0f * M_PI / COARSE_NUM_RAYS;
+    float angles[PACKET_LANES];
+    bool hits[PACKET_LANES];
+    std::vector<unsigned int> hitIds;
+    bool found = false;
+
+    mPreview = true;
+    for ( unsigned int p=0; p<(1u << bits); ++p )
+    {
+        if ( mCancel.loadAcquire() || budget.Stopped() )
+            break;
+
+        unsigned int q = 0;
+        for ( unsigned int b=0; b<bits; ++b )
+            q |= ((p >> b) & 1u) << (bits - 1 - b);
+        if ( q >= numPackets )
+            continue;
+
+        for ( int j=0; j<PACKET_LANES; ++j )
+            angles[j] = (q*PACKET_LANES + j) * laneStep - M_PI;
+
+        int numHits = tracer.Trace(*mA, angles, mK, hits);
+        mRaysDone += PACKET_LANES;
+        ReportProgress(budget, (numPackets - p - 1) * PACKET_LANES, numSizes - 1);
+        FlushOldResults();
+
+        for ( int j=0; (j<PACKET_LANES) && (numHits > 0); ++j )
+        {
+            if ( ! hits[j] )
+                continue;
+
+            Ray r( *mA, Vector(cos(angles[j]), sin(angles[j])) );
+            hitIds.clear();
+            if ( RayTrace(mScene, mA, &r, target, mK, &hitIds) )
+            {
+                AddResult(r, angles[j], &hitIds);
+                if ( ! found )
+                    FlushResults();  // Show the first one at once.
+                found = true;
+            }
+        }
+    }
+
+    FlushResults();
+    mPreview = found;
+    return found;
+}
+
+
+// Passes the progress of a BeamTracer to the thread.
+class BeamProgress : public BeamListener
+{
+  public:
+    BeamProgress( RenderingThread* thread, const RayBudget& budget ) :
+        mThread(thread), mBudget(budget) {}
+
+    void Progress( double share ) { mThread->ReportProgress(mBudget, share); }
+
+  private:
+    RenderingThread* mThread;
+    const RayBudget& mBudget;
+};
+
+
+bool RenderingThread::BeamSearch()
+{
+    PROFILE_SCOPE("Beam search");
+
+    // The target only tells the reach sets where B is - the beams skip it.
+    float minTargetSize, maxTargetSize;
+    TargetSizeRange(mScene, mB, &minTargetSize, &maxTargetSize);
+    Circle* target = new Circle(*mB, minTargetSize);
+    mScene.push_back(target);
+
+    FlatScene flat;
+    flat.Build(mScene, target, *mA);
+    mScene.pop_back();
+    delete target;
+
+    QSharedPointer<const VisibilityGraph> graph = VisibilityGraph::Cached(flat);
+    ReachSets reach;
+    if ( ! graph.isNull() )
+        reach.Build(flat, *graph, mK);
+
+    RayBudget budget(mBudget);
+    BeamProgress progress(this, budget);
+    BeamTracer tracer(flat);
+    tracer.SetCancel(&mCancel);
+    tracer.SetListener(&progress);
+    if ( ! reach.Empty() )
+        tracer.SetReach(&reach);
+
+    std::vector<Ray> solutions;
+    tracer.Trace(*mA, *mB, mK, &budget, &solutions);
+
+    // Made in double precision - they are kept as they are.
+    for ( unsigned int i=0; i<solutions.size(); ++i )
+        AddResult(solutions[i], solutions[i].GetLaunchAngle(), NULL);
+
+    return ! solutions.empty();
+}
+
+
+void RenderingThread::ReportProgress( const RayBudget& budget, unsigned long raysLeft,
+                                      int sizesLeft )
+{
+    if ( mProgressTimer.isValid() && (mProgressTimer.elapsed() < PROGRESS_REPORT_MS) )
+        return;
+    mProgressTimer.start();
+
+    // This target size goes on until maxRays without hits, or until the
+    // confidence is reached with them - then it is the last one. Before the
+    // first hit the budget's guess tells when one is likely, until that many
+    // rays are traced in vain.
+    const BudgetOptions& opts = budget.Options();
+    unsigned long need = budget.Predicted();
+    if ( budget.NumPaths() > 0 )
+        sizesLeft = 0;
+    else if ( (need < opts.maxRays) && (budget.NumRays() < need) )
+        sizesLeft = 0;  // A hit is likely before need
+    else
+        need = opts.maxRays;
+    raysLeft += need - std::min(need, budget.NumRays());
+    raysLeft += sizesLeft * opts.maxRays;
+
+    const unsigned long done = mRaysDone + budget.NumRays();
+    SendProgress(budget, (done + raysLeft > 0)? static_cast<double>(done) / (done + raysLeft) : 0.0);
+}
+
+
+void RenderingThread::ReportProgress( const RayBudget& budget, double share )
+{
+    if ( mProgressTimer.isValid() && (mProgressTimer.elapsed() < PROGRESS_REPORT_MS) )
+        return;
+    mProgressTimer.start();
+
+    SendProgress(budget, share);
+}
+
+
+void RenderingThread::SendProgress( const RayBudget& budget, double share )
+{
+    const BudgetOptions& opts = budget.Options();
+    const qint64 ms = budget.ElapsedMs();
+    qint64 eta = -1;
+    if ( (ms >= PROGRESS_REPORT_MS) && (share > 0.0) )  // Else too early to tell
+        eta = static_cast<qint64>( ms * (1.0 - share) / share );
+
+    int percent = static_cast<int>(100.0 * share);
+    if ( opts.maxMs > 0 )
+    {
+        // The time limit may come first.
+        qint64 msLeft = std::max<qint64>(opts.maxMs - ms, 0);
+        if ( (eta < 0) || (eta > msLeft) )
+            eta = msLeft;
+        percent = std::max(percent, static_cast<int>(100 * ms / opts.maxMs));
+    }
+
+    Q_EMIT sendProgress(std::min(percent, 100), static_cast<int>(eta));
+}
+
 
 void RenderingThread::run()
 {
     // TODO: Parse the scene and determine visible surfaces (from point A) then cast rays only to them?
 
+    PROFILE_SCOPE("RenderingThread::run");
+
     Circle* target=NULL;
     bool foundSolution=false;
 
@@ -656,17 +1124,27 @@ void RenderingThread::run()
         if ( mK == 0 )
         {
             Ray r( *mA, *mB );  // Ray r( *mA, Vector(*mA, *mB) );
+            std::vector<unsigned int> hitIds;
 
-            if ( (foundSolution = RayTrace(&r, mB, mK)) )
+            if ( (foundSolution = RayTrace(mScene, mA, &r, mB, mK, &hitIds)) )
             {
-                Q_EMIT sendRayInResults(r);
+                AddResult(r, r.GetLaunchAngle(), &hitIds);
             }
 #ifdef DEBUG
             else
             {
-                Q_EMIT sendRayInResults(r);
+                AddResult(r, r.GetLaunchAngle(), NULL);  // Pinned - shown where it stopped
             }
 #endif // DEBUG
+            FlushResults();
+            Q_EMIT sendRenderFinished(foundSolution);
+            return;
+        }
+
+        if ( SM_BEAMS == mSearchMode )
+        {
+            foundSolution = BeamSearch();
+            FlushResults();
             Q_EMIT sendRenderFinished(foundSolution);
             return;
         }
@@ -681,9 +1159,10 @@ void RenderingThread::run()
                 continue;
 
             Ray r( *mA, Point(x, y) );
+            std::vector<unsigned int> hitIds;
 
-            if ( (foundSolution = RayTrace(&r, mB, K)) )
-                Q_EMIT sendRayInResults(r);
+            if ( (foundSolution = RayTrace(mScene, mA, &r, mB, mK, &hitIds)) )
+                AddResult(r, r.GetLaunchAngle(), &hitIds);
         }
 
         // If no exact solution is found try to find approximate solutions.
@@ -694,46 +1173,130 @@ void RenderingThread::run()
             // It must be less than the minimum distance to all other figures.
             // If a ray hits this circle we consider it an approximate solution.
 
-            float minTargetSize, maxTargetSize=INF_DIST;
-
-            for ( std::vector<Figure*>::const_iterator fig = mScene.begin();
-                  fig != mScene.end(); ++fig )
+            float minTargetSize, maxTargetSize;
             {
-                if ( *fig == mB )
-                    continue;
+                PROFILE_SCOPE("TargetSizeRange");
+                TargetSizeRange(mScene, mB, &minTargetSize, &maxTargetSize);
+            }
 
-                float dist = mB->Distance(*fig);
+            target = new Circle(*mB, minTargetSize);
+            mScene.push_back(target);
 
-                if ( dist < maxTargetSize )
-                    maxTargetSize = dist;
-            }
+            // Learns, which directions get close to B. Kept while the target grows.
+            AdaptiveSampler sampler(::rand());
+            RayBudget budget(mBudget);
 
-            if ( maxTargetSize > MAX_TARGET_SIZE )
-            {
-                minTargetSize = MIN_TARGET_SIZE;
-                maxTargetSize = MAX_TARGET_SIZE;
-            }
-            else if ( (maxTargetSize < MAX_TARGET_SIZE) &&
-                      (maxTargetSize > MIN_TARGET_SIZE) )
-            {
-                minTargetSize = MIN_TARGET_SIZE;
-            }
-            else
+            if ( SM_LATENCY_FIRST == mSearchMode )
             {
-                minTargetSize = maxTargetSize;
+                // A quick look with the biggest target first.
+                target->R = maxTargetSize;
+                foundSolution = CoarsePass(target, budget,
+                    1 + static_cast<int>((maxTargetSize - minTargetSize) / INC_TARGET_SIZE));
+                target->R = minTargetSize;
             }
 
-            target = new Circle(*mB, minTargetSize);
-            mScene.push_back(target);
-
-            while( (! foundSolution) && (! isInterruptionRequested())
-                   && (target->R <= maxTargetSize) )
+            bool found = false;  // By the full search
+            while( (! found) && (! isInterruptionRequested())
+                   && (target->R <= maxTargetSize) && (! budget.Stopped()) )
             {
                 // Cast rays from A to various directions and trace them.
                 // Remember the rays hitting the target with K reflections.
                 // TODO: cast rays only to the figures.
 
 //              ::srand( ::time(NULL) );
+#if 1  // Packets of neighboring rays.
+                PROFILE_SCOPE("Target size");
+
+                FlatScene flat;
+                QSharedPointer<const VisibilityGraph> graph;
+                ReachSets reach;
+                {
+                    PROFILE_SCOPE("Build FlatScene");
+                    flat.Build(mScene, target, *mA);
+                    // Rebuilt only when the circles change, not the target size.
+                    graph = VisibilityGraph::Cached(flat);
+                    if ( ! graph.isNull() )
+                        reach.Build(flat, *graph, mK);
+                }
+
+                if ( NULL == mStats )
+                {
+                    // The circles are the same for all target sizes.
+                    mStats = new FigureStats();
+                    mStats->circles = flat;
+                    mStats->counters.Reset(flat.Size());
+                }
+                PacketTracer<PACKET_LANES> tracer(flat, graph.data(), &mStats->counters);
+                tracer.SetCancel(&mCancel);
+                if ( ! reach.Empty() )
+                    tracer.SetReach(&reach);
+                budget.NewTarget(flat, mK);
+                const int sizesLeft = static_cast<int>((maxTargetSize - target->R) / INC_TARGET_SIZE);
+
+                float angles[PACKET_LANES];
+                float weights[PACKET_LANES];
+                float misses[PACKET_LANES];
+                bool hits[PACKET_LANES];
+                unsigned long long paths[PACKET_LANES];
+                std::vector<unsigned int> hitIds;
+
+                for ( unsigned int i=0; ! budget.Done(); i+=PACKET_LANES )
+                {
+                    if( mCancel.loadAcquire() ) break;
+                    ReportProgress(budget, 0, sizesLeft);
+                    FlushOldResults();
+
+                    // Close increasing angles, so the tracer's wedge stays narrow.
+#if 1  // Adaptive sampling.
+                    sampler.NextPacket(angles, PACKET_LANES);
+#else  // Uniform.
+                    for ( int j=0; j<PACKET_LANES; ++j )
+                        angles[j] = 2.0f * M_PI * ::rand() / (RAND_MAX + 1.0) - M_PI;
+                    std::sort(angles, angles + PACKET_LANES);
+#endif // 1
+                    for ( int j=0; j<PACKET_LANES; ++j )
+                        weights[j] = sampler.Weight(angles[j]);
+
+                    int numHits;
+                    {
+                        PROFILE_SCOPE("Trace packet");
+                        numHits = tracer.Trace(*mA, angles, mK, hits, misses, paths);
+                    }
+                    budget.AddRays(PACKET_LANES);
+
+                    for ( int j=0; j<PACKET_LANES; ++j )
+                        sampler.Record(angles[j], misses[j]);
+
+                    if ( 0 == numHits )
+                        continue;
+
+                    // Hits are rare - re-trace them to get the full Ray.
+                    for ( int j=0; j<PACKET_LANES; ++j )
+                    {
+                        if ( ! hits[j] )
+                            continue;
+
+                        PROFILE_SCOPE("RayTrace");
+                        Ray r( *mA, Vector(cos(angles[j]), sin(angles[j])) );
+                        hitIds.clear();
+                        if ( RayTrace(mScene, mA, &r, target, mK, &hitIds) )
+                        {
+                            if ( mPreview )
+                            {
+                                // The first solution of the full search replaces the preview.
+                                Q_EMIT sendClearPreview();
+                                mPreview = false;
+                            }
+                            AddResult(r, angles[j], &hitIds);
+                            if ( ! found )
+                                FlushResults();  // Show the first one at once.
+                            foundSolution = found = true;
+                            budget.AddHit(paths[j], weights[j]);
+                        }
+                    }
+                }
+                mRaysDone += budget.NumRays();
+#else  // One ray at a time.
                 for ( unsigned int i=0; i<MAX_NUM_RAYS; i++ )
                 {
                     if( 0 == i%100 )
@@ -750,12 +1313,14 @@ void RenderingThread::run()
                     float angle = 2.0f * M_PI * i / MAX_NUM_RAYS;
                     Ray r( *mA, Vector(cos(angle), sin(angle)) );
 #endif // 0
-                    if ( RayTrace(&r, target, mK) )  // TODO: Do calculations in a pool of threads?
+                    std::vector<unsigned int> hitIds;
+                    if ( RayTrace(mScene, mA, &r, target, mK, &hitIds) )  // TODO: Do calculations in a pool of threads?
                     {
-                        Q_EMIT sendRayInResults(r);
-                        foundSolution = true;
+                        AddResult(r, r.GetLaunchAngle(), &hitIds);
+                        foundSolution = found = true;
                     }
                 }
+#endif // 1
 
                 target->R += INC_TARGET_SIZE;  // Bigger target is easier to hit.
             }
@@ -786,19 +1351,69 @@ void RenderingThread::run()
     if ( NULL != target )
         delete target;
 
+    FlushResults();
+    if ( NULL != mStats )
+    {
+        Q_EMIT sendFigureStats(mStats);
+        mStats = NULL;
+    }
     Q_EMIT sendRenderFinished(foundSolution);
 }
 
 
-bool RenderingThread::RayTrace( Ray *ray, const Figure* const target, int K )
+/******************************* Tracing core *********************************/
+
+
+void TargetSizeRange( const std::vector<Figure*>& scene, const Point* pB,
+                      float* minSize, float* maxSize )
+{
+    // Put B in a circle (a target). The radius will be the precision.
+    // It must be less than the minimum distance to all other figures.
+
+    float maxTargetSize=INF_DIST;
+
+    for ( std::vector<Figure*>::const_iterator fig = scene.begin();
+          fig != scene.end(); ++fig )
+    {
+        if ( *fig == pB )
+            continue;
+
+        float dist = pB->Distance(*fig);
+
+        if ( dist < maxTargetSize )
+            maxTargetSize = dist;
+    }
+
+    if ( maxTargetSize > MAX_TARGET_SIZE )
+    {
+        *minSize = MIN_TARGET_SIZE;
+        *maxSize = MAX_TARGET_SIZE;
+    }
+    else if ( (maxTargetSize < MAX_TARGET_SIZE) &&
+              (maxTargetSize > MIN_TARGET_SIZE) )
+    {
+        *minSize = MIN_TARGET_SIZE;
+        *maxSize = maxTargetSize;
+    }
+    else
+    {
+        *minSize = *maxSize = maxTargetSize;
+    }
+}
+
+
+bool RayTrace( const std::vector<Figure*>& scene, const Figure* const source,
+               Ray *ray, const Figure* const target, int K,
+               std::vector<unsigned int>* hits )
 {
     float dist, minDist=INF_DIST;
     Figure* firstHit=NULL;
+    unsigned int firstHitIdx=0;
 
-    for ( std::vector<Figure*>::const_iterator fig = mScene.begin();
-          fig != mScene.end(); ++fig )
+    for ( std::vector<Figure*>::const_iterator fig = scene.begin();
+          fig != scene.end(); ++fig )
     {
-        if ( *fig == mA )
+        if ( *fig == source )
             continue;
 
         if ( *fig == ray->OnFig() )
@@ -810,6 +1425,7 @@ bool RenderingThread::RayTrace( Ray *ray, const Figure* const target, int K )
             {
                 minDist = dist;  // TODO: pass minDist to Reflect()
                 firstHit = (*fig);
+                firstHitIdx = fig - scene.begin();
             }
         }
     }
@@ -849,8 +1465,10 @@ bool RenderingThread::RayTrace( Ray *ray, const Figure* const target, int K )
 #endif // DEBUG
 
     firstHit->Reflect(ray);
+    if ( NULL != hits )
+        hits->push_back(firstHitIdx);
 
-    return RayTrace(ray, target, K);  // Recurse...
+    return RayTrace(scene, source, ray, target, K, hits);  // Recurse...
 }
 
 }  // namespace
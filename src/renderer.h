@@ -6,6 +6,7 @@
 #define RENDERER_H
 
 #include <vector>
+#include <string>
 #include <stdexcept>
 
 #include "qglobal.h"
@@ -15,8 +16,14 @@
     #include <QtGui>
 #endif  // QT_VERSION
 #include <QThread>
+#include <QElapsedTimer>
+#include <QAtomicInt>
 
 #include "geometry.h"
+#include "solutions.h"
+#include "snapshot.h"
+#include "budget.h"
+#include "view.h"
 
 
 namespace circles
@@ -26,12 +33,45 @@ extern const float MIN_TARGET_SIZE;
 extern const float MAX_TARGET_SIZE;
 extern const float INC_TARGET_SIZE;
 extern unsigned long MAX_NUM_RAYS;
+extern const float PICK_DISTANCE;
+extern const unsigned int SOLUTIONS_DISPLAY_MAX;
+extern const unsigned long COARSE_NUM_RAYS;
+extern const int PROGRESS_REPORT_MS;
+
+
+// How RenderingThread searches.
+typedef enum {
+    SM_RAYS,           // Random rays to a growing target around B
+    SM_LATENCY_FIRST,  // The same, after a coarse preview
+    SM_BEAMS           // Exact solutions with a BeamTracer
+} SearchMode;
+
+
+/******************************* Tracing core *********************************/
+
+// Returns the range of target circle radiuses around B, which don't overlap
+// the other figures in the scene.
+void TargetSizeRange(const std::vector<Figure*>& scene, const Point* pB,
+                     float* minSize, float* maxSize);
+
+// Returns true if the ray hits the target after K reflections. The source
+// figure (the point A) is skipped. The indexes in the scene of the figures
+// reflected from are appended to hits, if it is not NULL.
+bool RayTrace(const std::vector<Figure*>& scene, const Figure* const source,
+              Ray *ray, const Figure* const target, int K,
+              std::vector<unsigned int>* hits = NULL);
 
 
 /******************************* RenderingFrame *******************************/
 
 class ReflectiveCirclesUI;
 class RenderingThread;
+class RenderQueue;
+class DensityThread;
+class ExportThread;
+class LiveTracker;
+class SolutionSink;
+struct FigureStats;
 
 class RenderingFrame : public QFrame
 {
@@ -44,25 +84,68 @@ class RenderingFrame : public QFrame
     bool CheckInput() const;
     void LoadScene(const char *fileName);
     void SaveScene(const char *fileName) const;
+    // Renders the scene and the solutions into a PNG of this width, on
+    // another thread. One export at a time.
+    void ExportImage(const char *fileName, int width);
+    // Starts a search on a snapshot of the scene, or queues it if one is
+    // running. The scene can be edited meanwhile.
     void Render();
+    // Queues searches of a snapshot of the scene for K from firstK to lastK,
+    // which run on the spare workers. Their solutions are written to the file
+    // with "_K<k>" added to its name, not shown. Returns their number.
+    int QueueJobs(int firstK, int lastK, int priority, const std::string& fileName);
+    RenderQueue* Jobs() const { return mJobs; }
+    // Traces many rays from A and shows the light density instead of paths.
+    // Queued like Render(), if a search shown in the view is running.
+    void RenderDensity();
     void Reset();
-    void AddFugure(Figure* fig) { mScene.push_back(fig); }
+    void AddFugure(Figure* fig) { mScene.push_back(fig); mGridDirty = true; }
     void DelFigure(Figure* fig);
-    bool RenderingInProgress() const { return mRenderingInProgress; }
+    // A search shown in the view is running or queued, or the density.
+    bool RenderingInProgress() const;
     void StopRendering();
+    void SetLiveTracking(bool on);
+    void NotifyLiveTracker();
+    // The solutions of the next renders are streamed to this file. Empty
+    // for none.
+    void SetSolutionsFile(const std::string& fileName) { mSolutionsFile = fileName; }
+    // Shows how much work each circle took in the last search.
+    void SetHeatmap(bool on) { mShowHeatmap = on; update(); }
+    // When the next searches stop.
+    void SetBudget(const BudgetOptions& budget) { mBudget = budget; }
+    const BudgetOptions& GetBudget() const { return mBudget; }
+    // How the next searches go, see RenderingThread.
+    void SetSearchMode(SearchMode mode) { mSearchMode = mode; }
+    // Zooms the view to the whole scene, or back to the scene's coordinates.
+    // The scene itself is not changed.
+    void FitView();
+    void ResetView();
 
   public slots:
-    void addRayInResults(const Ray& r);
-    void noteRenderFinished(bool result);
+    void addResults(int id, SolutionLogPtr chunk);
+    void noteJobStarted(int id);
+    void noteJobFinished(int id, bool found, QString error);
+    void noteQueueChanged();
+    void setLiveRays(SolutionLogPtr rays);
+    void setDensity(QImage* image, QRectF area);
+    void noteExported(bool result, QString error);
+    void setFigureStats(int id, FigureStats* stats);
+    void clearPreview(int id);
+    void setProgress(int id, int percent, int etaMs);
 
   protected:
+    void SetFigureStats(FigureStats* stats);  // Takes the ownership
+    // Starts the queued density, if the view is free.
+    void StartQueuedDensity();
     void paintEvent(QPaintEvent*);
     Figure* FindCollision(const Figure* f) const;
+    Figure* FindFigureAt(const Point& pos) const;
 
   private slots:
     void mousePressEvent(QMouseEvent * e);
     void mouseReleaseEvent(QMouseEvent * e);
     void mouseMoveEvent(QMouseEvent * e);
+    void wheelEvent(QWheelEvent * e);
 //  void mouseDoubleClickEvent(QMouseEvent * e);  // Use it for deleting figures?
 
   private:
@@ -70,46 +153,112 @@ class RenderingFrame : public QFrame
     bool mMousePressed;
     Point mMousePressPos;
     Figure* mMoseEditFig;
-    bool mRenderingInProgress;
+    bool mPanning;  // With the right or the middle button
+    QPoint mPanPos;
 
     Point* mA;
     Point* mB;
     std::vector<Figure*> mScene;  // Or a volume tree? Use smart pointers?
-    std::vector<Ray> mRays;
+    SceneView mView;
+    FigureGrid mGrid;  // Of mScene, for drawing only the visible figures
+    bool mGridDirty;  // The figures were added, removed or moved
+    std::vector<unsigned int> mVisible;  // Of the last paint
+    SolutionLog mSolutions;  // Only the first SOLUTIONS_DISPLAY_MAX
+    SolutionPainter mSolutionPainter;
+    QImage mDensity;  // Null if not rendered
+    QRectF mDensityArea;  // Of the scene, which mDensity shows
+    FigureStats* mFigureStats;  // Of the last search, NULL if none
+    bool mShowHeatmap;
+    BudgetOptions mBudget;
+    SearchMode mSearchMode;
+    std::string mSolutionsFile;
 
-    RenderingThread* mRThread;
+    RenderQueue* mJobs;
+    int mViewJob;  // The running search shown, -1 if none
+    int mQueuedViewJob;  // The next one, -1 if none
+    DensityThread* mDThread;
+    SnapshotPtr mQueuedDensity;  // Of the next density, null if none
+    int mQueuedDensityK;
+    ExportThread* mEThread;  // NULL if not exporting
+    LiveTracker* mTracker;  // Not NULL in live tracking mode
 };
 
 
+/* Searches the solutions from A to B with K reflections, growing the target
+ * around B until some are found. In the latency first mode a coarse pass goes
+ * first: COARSE_NUM_RAYS evenly spread rays to the biggest target, its first
+ * solution sent at once. These are a preview, which the receiver drops when the
+ * first solution of the full search comes. In the beams mode the rays through
+ * B itself are found with a BeamTracer, one per distinct path. */
 class RenderingThread : public QThread
 {
     Q_OBJECT
 
   public:
-    RenderingThread(const Point* const pA, const Point* const pB,
-                    const std::vector<Figure*>& scene, int K) :
-        mA(pA), mB(pB), mScene(scene), mK(K)
+    RenderingThread(const SnapshotPtr& snapshot, int K,
+                    const BudgetOptions& budget = BudgetOptions(),
+                    SearchMode mode = SM_RAYS, SolutionSink* sink = NULL) :
+        mSnapshot(snapshot), mA(snapshot->A()), mB(snapshot->B()),
+        mScene(snapshot->Figures()), mK(K), mBudget(budget),
+        mSearchMode(mode), mSink(sink), mChunk(NULL), mTraces(), mStats(NULL),
+        mCancel(0), mPreview(false), mRaysDone(0)
     {
     }
 
-    ~RenderingThread()
-    {
-    }
+    ~RenderingThread();
 
     void run();
 
-    // Returns true if the ray hits the target after K reflections
-    bool RayTrace(Ray *ray, const Figure* const target, int K);
+    // Stops the search within a reflection of the rays being traced.
+    void Cancel() { mCancel.storeRelease(1); requestInterruption(); }
 
   Q_SIGNALS:
-    void sendRayInResults(const Ray& ray);
+    void sendResults(SolutionLogPtr chunk);
     void sendRenderFinished(bool result);
+    void sendFigureStats(FigureStats* stats);  // The receiver deletes them.
+    void sendClearPreview();  // The solutions sent so far were a preview.
+    // Estimated from the rays traced per ms so far. etaMs is -1 if not known.
+    void sendProgress(int percent, int etaMs);
 
   private:
+    // Collects the solutions in a chunk, which is sent when it is full or old.
+    // The ray was launched at the angle and reflected from the figures of
+    // mScene with the hits indexes, or it is pinned if hits is NULL.
+    void AddResult(const Ray& ray, float launchAngle, const std::vector<unsigned int>* hits);
+    void FlushResults();
+    // Sends the chunk if it is older than RESULTS_FLUSH_MS. Polled by the
+    // searches, so a lone solution is shown before the next one comes.
+    void FlushOldResults();
+    // Traces COARSE_NUM_RAYS to the target. Returns true if any hit it. The
+    // full search after it takes up to numSizes target sizes.
+    bool CoarsePass(Circle* target, const RayBudget& budget, int numSizes);
+    // Traces beams to B. Returns true if any solution is found.
+    bool BeamSearch();
+    // Sends the progress, at most every PROGRESS_REPORT_MS. raysLeft are left
+    // before the budget's target size, and sizesLeft target sizes after it.
+    void ReportProgress(const RayBudget& budget, unsigned long raysLeft, int sizesLeft);
+    // The same, with the share of the work done known.
+    void ReportProgress(const RayBudget& budget, double share);
+    // Sends the share done and the ETA, which follows from it.
+    void SendProgress(const RayBudget& budget, double share);
+    friend class BeamProgress;
+
+    SnapshotPtr mSnapshot;  // Keeps the figures alive
     const Point* const mA;
     const Point* const mB;
-    std::vector<Figure*> mScene;  // A copy of the scene. Will be modified.
+    std::vector<Figure*> mScene;  // The snapshot's figures and the target
     const int mK;
+    const BudgetOptions mBudget;
+    const SearchMode mSearchMode;
+    SolutionSink* mSink;    // Written before sending, owned by the queue
+    SolutionLog* mChunk;    // Not sent yet
+    SolutionArena mTraces;  // Of the chunk, for the sink
+    QElapsedTimer mFlushTimer;
+    FigureStats* mStats;    // The work per circle, not sent yet
+    QAtomicInt mCancel;     // Checked by the tracer at every reflection
+    bool mPreview;          // The solutions sent are a preview
+    unsigned long mRaysDone;  // In the finished passes and target sizes
+    QElapsedTimer mProgressTimer;
 };
 
 }  // namespace
@@ -0,0 +1,112 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include "sampler.h"
+#include "geometry.h"
+
+
+namespace circles
+{
+
+const int   SAMPLER_BINS        = 720;    // Half a degree each
+const int   SAMPLER_BATCH       = 16384;  // Samples between updates
+const float SAMPLER_ELITE       = 0.02f;  // Share of a batch, which is followed
+const float SAMPLER_SMOOTHING   = 0.3f;   // Weight of the new distribution
+const float SAMPLER_MIN_EXPLORE = 0.25f;  // Probability kept uniform
+
+
+/****************************** AdaptiveSampler *******************************/
+
+AdaptiveSampler::AdaptiveSampler( unsigned int seed ) :
+        mProb(SAMPLER_BINS, 1.0f / SAMPLER_BINS),
+        mCdf(SAMPLER_BINS),
+        mBatch(),
+        mRng(seed)
+{
+    for ( int b=0; b<SAMPLER_BINS; ++b )
+        mCdf[b] = (b + 1.0f) / SAMPLER_BINS;
+
+    mBatch.reserve(SAMPLER_BATCH);
+}
+
+
+float AdaptiveSampler::Next()
+{
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    float u = uniform(mRng) * mCdf.back();
+    int bin = std::upper_bound(mCdf.begin(), mCdf.end(), u) - mCdf.begin();
+    bin = std::min(bin, SAMPLER_BINS - 1);
+
+    return static_cast<float>( 2.0 * M_PI * (bin + uniform(mRng)) / SAMPLER_BINS - M_PI );
+}
+
+
+void AdaptiveSampler::NextPacket( float* angles, int n )
+{
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+
+    const float base = Next();
+    const float step = static_cast<float>( 2.0 * M_PI / SAMPLER_BINS / n );
+    for ( int j=0; j<n; ++j )
+        angles[j] = base + step * (j + uniform(mRng));
+}
+
+
+void AdaptiveSampler::Record( float angle, float miss )
+{
+    int bin = static_cast<int>( (angle + M_PI) * SAMPLER_BINS / (2.0 * M_PI) );
+    bin = ((bin % SAMPLER_BINS) + SAMPLER_BINS) % SAMPLER_BINS;  // Wrap around
+
+    mBatch.push_back(std::make_pair(miss, bin));
+
+    if ( static_cast<int>(mBatch.size()) >= SAMPLER_BATCH )
+        Update();
+}
+
+
+float AdaptiveSampler::Weight( float angle ) const
+{
+    int bin = static_cast<int>( (angle + M_PI) * SAMPLER_BINS / (2.0 * M_PI) );
+    bin = ((bin % SAMPLER_BINS) + SAMPLER_BINS) % SAMPLER_BINS;
+
+    return mCdf.back() / (SAMPLER_BINS * mProb[bin]);
+}
+
+
+void AdaptiveSampler::Update()
+{
+    // Only the rays, which made K reflections, tell something.
+    std::vector<std::pair<float, int> >::iterator last =
+        std::partition(mBatch.begin(), mBatch.end(),
+                       [](const std::pair<float, int>& s) { return s.first < INF_DIST; });
+
+    unsigned int numFinite = last - mBatch.begin();
+    unsigned int numElite = std::max(1u, static_cast<unsigned int>(SAMPLER_ELITE * mBatch.size()));
+    numElite = std::min(numElite, numFinite);
+
+    if ( numElite > 0 )
+    {
+        std::nth_element(mBatch.begin(), mBatch.begin() + numElite - 1, last);
+
+        std::vector<float> elite(SAMPLER_BINS, 0.0f);
+        for ( unsigned int i=0; i<numElite; ++i )
+            elite[mBatch[i].second] += 1.0f / numElite;
+
+        float sum = 0.0f;
+        for ( int b=0; b<SAMPLER_BINS; ++b )
+        {
+            float p = (1.0f - SAMPLER_SMOOTHING) * mProb[b] + SAMPLER_SMOOTHING * elite[b];
+            mProb[b] = (1.0f - SAMPLER_MIN_EXPLORE) * p + SAMPLER_MIN_EXPLORE / SAMPLER_BINS;
+            sum += mProb[b];
+            mCdf[b] = sum;
+        }
+    }
+
+    mBatch.clear();
+}
+
+}  // namespace
@@ -0,0 +1,64 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <vector>
+#include <random>
+
+
+namespace circles
+{
+
+extern const int   SAMPLER_BINS;
+extern const int   SAMPLER_BATCH;
+extern const float SAMPLER_ELITE;
+extern const float SAMPLER_SMOOTHING;
+extern const float SAMPLER_MIN_EXPLORE;
+
+
+/****************************** AdaptiveSampler *******************************/
+
+/* Draws launch angles from a piecewise uniform distribution over SAMPLER_BINS
+ * bins of the circle around A. After every SAMPLER_BATCH recorded samples the
+ * bin probabilities move towards the bins of the best samples of the batch
+ * (the ones, which came closest to B) - a cross-entropy update. A share of
+ * SAMPLER_MIN_EXPLORE of the probability stays uniform, so no direction is
+ * ever given up. */
+class AdaptiveSampler
+{
+  public:
+    explicit AdaptiveSampler(unsigned int seed);
+
+    // A launch angle in [-PI, PI).
+    float Next();
+
+    // n increasing launch angles within one bin width from a base angle drawn
+    // like Next(): one in each of n equal strata after it, jittered. They may
+    // exceed PI - Record() and Weight() wrap them.
+    void NextPacket(float* angles, int n);
+
+    // How close a ray launched at this angle came to B after K reflections:
+    // INF_DIST if it didn't make them.
+    void Record(float angle, float miss);
+
+    // The uniform density over this one at the angle: the weight of a sample
+    // there, when estimating a share of all directions from the samples.
+    float Weight(float angle) const;
+
+    float Probability(int bin) const { return mProb[bin]; }
+
+  private:
+    void Update();
+
+    std::vector<float>  mProb;    // Of each bin
+    std::vector<float>  mCdf;     // mCdf[b] = sum of mProb[0..b]
+    std::vector<std::pair<float, int> > mBatch;  // (miss, bin) of this batch
+    std::minstd_rand    mRng;
+};
+
+}  // namespace
+
+#endif // SAMPLER_H
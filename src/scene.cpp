@@ -0,0 +1,463 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <string>
+#include <cstring>
+#include <iomanip>
+#include <cstdio>
+#include <algorithm>
+#include "qglobal.h"
+#include "scene.h"
+
+
+namespace circles
+{
+
+const char SCENE_MAGIC[8] = { 'R', 'C', 'S', 'C', 'N', '1', '\n', '\0' };
+
+
+// Remove leading spaces
+inline void ltrim( std::string & s )
+{
+    while ( isspace(s[0]) )
+        s.erase(0,1);
+}
+
+
+Figure* FindCollision( const std::vector<Figure*>& figures, const Figure* fig )
+{
+    for ( std::vector<Figure*>::const_iterator f=figures.begin();
+          f != figures.end(); ++f )
+    {
+        if ( fig == *f )
+            continue;
+
+        if ( fig->Distance(*f) <= 0.0f )
+            return *f;
+    }
+    return NULL;
+}
+
+
+// Reads "A=" or "B=" rows. Returns the (new or updated) point or NULL.
+static Point* ReadPoint( const std::string& s, const char* name, Point* old,
+                         std::vector<Figure*>* figures, SceneInfo* info,
+                         std::stringstream& errSStr )
+{
+    float x, y;
+    int res = sscanf((s.substr(2)).c_str(), "%f %f", &x, &y);
+    if ( res != 2 )
+    {
+        errSStr << "Ignored invalid " << name << " on this row : " << s
+                << std::endl;
+        return old;
+    }
+
+    Point pt(x, y);
+
+    if ( NULL != FindCollision(*figures, &pt) )
+    {
+        errSStr << "Ignored overlapping " << name << " on this row : " << s
+                << std::endl;
+        return old;
+    }
+
+    if ( NULL == old )
+    {
+        old = new Point(pt);
+        figures->push_back(old);
+    }
+    else
+    {
+        *old = pt;
+    }
+
+    if ( x < info->minX ) info->minX = x;
+    if ( y < info->minY ) info->minY = y;
+    if ( x > info->maxX ) info->maxX = x;
+    if ( y > info->maxY ) info->maxY = y;
+
+    return old;
+}
+
+
+template<typename T>
+static inline bool Get( std::istream& in, T* value )
+{
+    return static_cast<bool>( in.read(reinterpret_cast<char*>(value), sizeof(T)) );
+}
+
+
+template<typename T>
+static inline void Put( std::ostream& out, T value )
+{
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+
+// The rest of a binary scene, after SCENE_MAGIC. False if it is broken.
+static bool ReadSceneBinary( std::istream& in, std::vector<Figure*>* figures,
+                             SceneInfo* info, std::stringstream& errSStr )
+{
+    qint32 K;
+    quint8 scale, hasA, hasB;
+    float ax, ay, bx, by;
+    quint32 numCircles;
+
+    if ( ! (Get(in, &K) && Get(in, &scale) &&
+            Get(in, &hasA) && Get(in, &ax) && Get(in, &ay) &&
+            Get(in, &hasB) && Get(in, &bx) && Get(in, &by) &&
+            Get(in, &numCircles)) )
+    {
+        errSStr << "Invalid binary scene header" << std::endl;
+        return false;
+    }
+
+    info->K = (K >= 1)? K : -1;
+    info->scale = (scale != 0);
+
+    // The count isn't trusted - reserve only for the circles, which the rest
+    // of the stream can hold. 3 floats each.
+    std::streampos pos = in.tellg();
+    if ( pos >= 0 )
+    {
+        in.seekg(0, std::ios::end);
+        std::streamoff bytesLeft = in.tellg() - pos;
+        in.seekg(pos);
+        if ( in && (bytesLeft >= 0) )
+            figures->reserve( figures->size() + 2 +
+                std::min<std::streamoff>(numCircles, bytesLeft / (3 * sizeof(float))) );
+        in.clear();
+    }
+
+    if ( hasA )
+    {
+        info->A = new Point(ax, ay);
+        figures->push_back(info->A);
+    }
+    if ( hasB )
+    {
+        info->B = new Point(bx, by);
+        figures->push_back(info->B);
+    }
+
+    // Written without overlaps, so they are not checked - that is O(N^2).
+    bool complete = true;
+    for ( quint32 i=0; i<numCircles; ++i )
+    {
+        float xyr[3];
+        if ( ! in.read(reinterpret_cast<char*>(xyr), sizeof(xyr)) )
+        {
+            errSStr << "The binary scene ends after " << i << " of "
+                    << numCircles << " circles" << std::endl;
+            complete = false;
+            break;
+        }
+        figures->push_back(new Circle(xyr[0], xyr[1], (xyr[2] > 0.0f)? xyr[2] : 0.0f));
+    }
+
+    SceneBounds(*figures, info);
+    return complete;
+}
+
+
+bool ReadScene( std::istream& in, std::vector<Figure*>* figures,
+                SceneInfo* info, std::stringstream& errSStr )
+{
+    char magic[sizeof(SCENE_MAGIC)];
+    std::streampos start = in.tellg();
+    if ( in.read(magic, sizeof(magic)) &&
+         (0 == memcmp(magic, SCENE_MAGIC, sizeof(magic))) )
+    {
+        return ReadSceneBinary(in, figures, info, errSStr);
+    }
+    in.clear();
+    in.seekg(start);
+
+    const std::string CirclesBeginDelim="CirclesBegin";
+    const std::string CirclesEndDelim = "CirclesEnd";
+
+    std::string s;
+    float x, y, r;
+    Circle cr(0,0,0);
+    bool recognized = false;  // A row of a scene was found
+
+    while ( std::getline(in, s) )
+    {
+        ltrim(s);
+        if ( ('\0' == s[0]) || ('#' == s[0]) )
+            continue;
+
+        // TODO: generic point section?
+        if ( s.substr(0,2) == "A=" )
+        {
+            info->A = ReadPoint(s, "A", info->A, figures, info, errSStr);
+        }
+
+        else if ( s.substr(0,2) == "B=" )
+        {
+            info->B = ReadPoint(s, "B", info->B, figures, info, errSStr);
+        }
+
+        else if ( s.substr(0,CirclesBeginDelim.length()) == CirclesBeginDelim )
+        {
+            while (std::getline(in, s))
+            {
+                ltrim(s);
+                if ( ('\0' == s[0]) || ('#' == s[0]) )
+                    continue;
+                if ( s.substr(0,CirclesEndDelim.length()) == CirclesEndDelim )
+                    break;
+
+                int res = sscanf(s.c_str(), "%f %f %f",  &x, &y, &r);
+                if ( res != 3 )
+                {
+                    errSStr << "Ignored invalid circle on this row : " << s
+                            << std::endl;
+                    continue;
+                }
+
+                if ( r < 0 )
+                    r = 0.0f;
+
+                cr.C.x = x;
+                cr.C.y = y;
+                cr.R = r;
+
+                if ( NULL != FindCollision(*figures, &cr) )
+                {
+                    errSStr << "Ignored overlapping circle on this row : "
+                            << s << std::endl;
+                    continue;
+                }
+
+                Circle* crp = new Circle(cr);
+                figures->push_back(crp);
+
+                if ( x-r < info->minX ) info->minX = x-r;
+                if ( y-r < info->minY ) info->minY = y-r;
+                if ( x+r > info->maxX ) info->maxX = x+r;
+                if ( y+r > info->maxY ) info->maxY = y+r;
+            }
+        }
+
+        else if ( s.substr(0,2) == "K=" )
+        {
+            int K;
+            int res = sscanf((s.substr(2)).c_str(), "%d", &K);
+            if ( (res != 1) || (K < 1) )
+            {
+                errSStr << "Ignored invalid K on this row : " << s
+                        << std::endl;
+                continue;
+            }
+
+            info->K = K;
+        }
+
+        else if ( s.substr(0,6) == "Scale=" )
+        {
+            if ( s.find("true", 6) != std::string::npos )
+                info->scale = true;
+            else
+                info->scale = false;
+        }
+
+        else
+            continue;
+
+        recognized = true;
+    }
+
+    if ( ! recognized )
+        errSStr << "No scene in the input" << std::endl;
+    return recognized;
+}
+
+
+void SceneBounds( const std::vector<Figure*>& figures, SceneInfo* info )
+{
+    info->minX = info->minY = INF_DIST;
+    info->maxX = info->maxY = -INF_DIST;
+
+    for ( std::vector<Figure*>::const_iterator fig=figures.begin();
+          fig != figures.end(); ++fig )
+    {
+        float x, y, r;
+
+        // TODO Replace dynamic_cast<>
+        const Point *ptp = dynamic_cast<const Point*>(*fig);
+        const Circle *crp = dynamic_cast<const Circle*>(*fig);
+        if ( NULL != ptp )
+        {
+            x = ptp->x;
+            y = ptp->y;
+            r = 0.0f;
+        }
+        else if ( NULL != crp )
+        {
+            x = crp->C.x;
+            y = crp->C.y;
+            r = crp->R;
+        }
+        else
+            continue;
+
+        if ( x-r < info->minX ) info->minX = x-r;
+        if ( y-r < info->minY ) info->minY = y-r;
+        if ( x+r > info->maxX ) info->maxX = x+r;
+        if ( y+r > info->maxY ) info->maxY = y+r;
+    }
+}
+
+
+void FitScene( const SceneInfo& info, int width, int height,
+               float* scale, int* margin )
+{
+    *margin = width / 100; // 1% margin
+    width -= 2 * *margin;
+    height -= 2 * *margin;
+    float xScale=1.0f, yScale=1.0f;
+
+    if ( info.minX < info.maxX )
+        xScale = width / (info.maxX - info.minX);
+
+    if ( info.minY < info.maxY )
+        yScale = height / (info.maxY - info.minY);
+
+    *scale = (xScale < yScale)? xScale : yScale;
+}
+
+
+void ScaleScene( const std::vector<Figure*>& figures, const SceneInfo& info,
+                 int width, int height )
+{
+    float scale;
+    int margin;
+    FitScene(info, width, height, &scale, &margin);
+
+    for ( std::vector<Figure*>::const_iterator fig=figures.begin();
+          fig != figures.end(); ++fig )
+    {
+        // TODO Replace dynamic_cast<> with virtual Scale() call
+        Point *ptp = dynamic_cast<Point*>(*fig);
+        if ( NULL != ptp )
+        {
+            ptp->x -= info.minX;
+            ptp->x *= scale;
+            ptp->y -= info.minY;
+            ptp->y *= scale;
+            ptp->x += margin;
+            ptp->y += margin;
+            continue;
+        }
+
+        Circle *crp = dynamic_cast<Circle*>(*fig);
+        if ( NULL !=  crp )
+        {
+            crp->C.x -= info.minX;
+            crp->C.x *= scale;
+            crp->C.y -= info.minY;
+            crp->C.y *= scale;
+            crp->C.x += margin;
+            crp->C.y += margin;
+            crp->R *= scale;
+        }
+    }
+}
+
+
+void WriteScene( std::ostream& out, const std::vector<Figure*>& figures,
+                 const Point* pA, const Point* pB, int K,
+                 std::stringstream& errSStr )
+{
+    out << std::fixed << std::setprecision(6);
+
+    for ( std::vector<Figure*>::const_iterator fig=figures.begin();
+          fig != figures.end(); ++fig )
+    {
+        // TODO Replace dynamic_cast<> with virtual Serialize() call
+        const Point *pt = dynamic_cast<const Point*>(*fig);
+        if ( NULL != pt )
+        {
+            out << std::endl;
+
+            if ( pt == pA )
+                out << "A= " << pt->x << " " << pt->y << std::endl;
+            else if ( pt == pB )
+                out << "B= " << pt->x << " " << pt->y << std::endl;
+            else
+                errSStr << "Unknown point in the scene" << std::endl;
+        }
+    }
+
+    out << std::endl << "CirclesBegin" << std::endl;
+    for ( std::vector<Figure*>::const_iterator fig=figures.begin();
+          fig != figures.end(); ++fig )
+    {
+        const Circle *cr = dynamic_cast<const Circle*>(*fig);
+        if ( NULL !=  cr )
+        {
+            out << cr->C.x << " " << cr->C.y << " " << cr->R << '\n';  // No flush
+        }
+    }
+    out << "CirclesEnd" << std::endl;
+
+    out << std::endl << "K=" << K << std::endl;
+
+    out << std::endl << "Scale=false" << std::endl;
+}
+
+
+void WriteSceneBinary( std::ostream& out, const std::vector<Figure*>& figures,
+                       const Point* pA, const Point* pB, int K,
+                       std::stringstream& errSStr )
+{
+    quint32 numCircles = 0;
+    for ( std::vector<Figure*>::const_iterator fig=figures.begin();
+          fig != figures.end(); ++fig )
+    {
+        // TODO Replace dynamic_cast<> with virtual Serialize() call
+        if ( NULL != dynamic_cast<const Circle*>(*fig) )
+            ++numCircles;
+        else if ( ((*fig) != pA) && ((*fig) != pB) )
+            errSStr << "Unknown point in the scene" << std::endl;
+    }
+
+    out.write(SCENE_MAGIC, sizeof(SCENE_MAGIC));
+    Put<qint32>(out, K);
+    Put<quint8>(out, 0);
+    Put<quint8>(out, (NULL != pA)? 1 : 0);
+    Put<float>(out, (NULL != pA)? pA->x : 0.0f);
+    Put<float>(out, (NULL != pA)? pA->y : 0.0f);
+    Put<quint8>(out, (NULL != pB)? 1 : 0);
+    Put<float>(out, (NULL != pB)? pB->x : 0.0f);
+    Put<float>(out, (NULL != pB)? pB->y : 0.0f);
+    Put<quint32>(out, numCircles);
+
+    for ( std::vector<Figure*>::const_iterator fig=figures.begin();
+          fig != figures.end(); ++fig )
+    {
+        const Circle *cr = dynamic_cast<const Circle*>(*fig);
+        if ( NULL != cr )
+        {
+            Put<float>(out, cr->C.x);
+            Put<float>(out, cr->C.y);
+            Put<float>(out, cr->R);
+        }
+    }
+}
+
+
+void DeleteFigures( std::vector<Figure*>* figures )
+{
+    for ( std::vector<Figure*>::iterator fig=figures->begin();
+          fig != figures->end(); ++fig )
+    {
+        delete *fig;
+    }
+    figures->clear();
+}
+
+}  // namespace
@@ -0,0 +1,81 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <vector>
+#include <iostream>
+#include <sstream>
+
+#include "geometry.h"
+
+
+namespace circles
+{
+
+extern const char SCENE_MAGIC[8];
+
+
+/******************************** Scene files *********************************/
+
+// What was read from a scene file, besides the figures.
+struct SceneInfo
+{
+    SceneInfo() : A(NULL), B(NULL), K(-1), scale(false),
+                  minX(INF_DIST), minY(INF_DIST), maxX(-INF_DIST), maxY(-INF_DIST) {}
+
+    Point* A;     // Also in the figures, NULL if missing
+    Point* B;     // Also in the figures, NULL if missing
+    int    K;     // -1 if missing
+    bool   scale; // "Scale=true"
+    float  minX;  // Bounding box of all figures
+    float  minY;
+    float  maxX;
+    float  maxY;
+};
+
+
+// Returns the first figure overlapping fig, or NULL.
+Figure* FindCollision(const std::vector<Figure*>& figures, const Figure* fig);
+
+// Reads a scene in the format of scenes/input.txt, or in the binary format of
+// WriteSceneBinary(). The figures are appended to 'figures' (A and B too) and
+// are owned by the caller. Ignored rows are reported in errSStr. Returns false
+// if there is no scene: a binary one is broken or cut short, or a text one
+// has no valid row.
+bool ReadScene(std::istream& in, std::vector<Figure*>* figures,
+               SceneInfo* info, std::stringstream& errSStr);
+
+// Sets the bounding box in info to the one of the figures.
+void SceneBounds(const std::vector<Figure*>& figures, SceneInfo* info);
+
+// The scale and the margin, with which ScaleScene() fits the bounding box in
+// width x height: x' = (x - minX)*scale + margin, the same for y.
+void FitScene(const SceneInfo& info, int width, int height,
+              float* scale, int* margin);
+
+// Fits the figures in width x height with 1% margin, using the bounding box.
+void ScaleScene(const std::vector<Figure*>& figures, const SceneInfo& info,
+                int width, int height);
+
+// Writes the scene in the format of scenes/input.txt.
+void WriteScene(std::ostream& out, const std::vector<Figure*>& figures,
+                const Point* pA, const Point* pB, int K,
+                std::stringstream& errSStr);
+
+/* Writes the scene in a binary format, which is read much faster, as the
+ * circles are not checked for overlapping: SCENE_MAGIC, int32 K, uint8 scale,
+ * uint8 has A, float Ax, Ay, uint8 has B, float Bx, By, uint32 number of
+ * circles, then float x, y, r for each one (native byte order). Open the
+ * streams in binary mode. */
+void WriteSceneBinary(std::ostream& out, const std::vector<Figure*>& figures,
+                      const Point* pA, const Point* pB, int K,
+                      std::stringstream& errSStr);
+
+void DeleteFigures(std::vector<Figure*>* figures);
+
+}  // namespace
+
+#endif // SCENE_H
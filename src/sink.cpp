@@ -0,0 +1,195 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <cstring>
+#include <iomanip>
+#include <QMutexLocker>
+#include "sink.h"
+
+
+namespace circles
+{
+
+const unsigned int SINK_BUFFER_SIZE = 1 << 20;  // Wake the writer at this size
+const unsigned int SINK_MAX_PENDING = 1 << 24;  // Producers wait above this size
+const int          SINK_FLUSH_MS    = 200;      // Or write what we have after this
+const char         SINK_MAGIC[8]    = { 'R', 'C', 'S', 'O', 'L', '1', '\n', '\0' };
+
+
+// Appends the bytes of a value to the buffer.
+template<typename T>
+static inline void Put( std::string* out, T value )
+{
+    out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+
+/******************************** SolutionSink ********************************/
+
+SolutionSink::SolutionSink() :
+        mFile(),
+        mFormat(SF_BINARY),
+        mNumWritten(0),
+        mPending(),
+        mClosing(false),
+        mFailed(false)
+{
+}
+
+
+SolutionSink::~SolutionSink()
+{
+    Close();
+}
+
+
+bool SolutionSink::Open( const char* fileName, std::stringstream& errSStr )
+{
+    size_t len = strlen(fileName);
+    mFormat = ((len > 4) && (0 == strcmp(fileName + len - 4, ".csv")))? SF_CSV : SF_BINARY;
+
+    mFile.open(fileName, std::ios::out | std::ios::binary | std::ios::trunc);
+    if ( ! mFile.is_open() )
+    {
+        errSStr << "Unable to open the solutions file '" << fileName << "'";
+        return false;
+    }
+
+    if ( SF_CSV == mFormat )
+        mFile << "angle,length,points,x0,y0,..." << std::endl;
+    else
+        mFile.write(SINK_MAGIC, sizeof(SINK_MAGIC));
+
+    mNumWritten = 0;
+    mClosing = false;
+    mFailed = false;
+    start(QThread::LowPriority);
+
+    return true;
+}
+
+
+void SolutionSink::Write( const SolutionArena& solutions )
+{
+    if ( solutions.Empty() || ! mFile.is_open() )
+        return;
+
+    std::string bytes;
+    Serialize(solutions, &bytes);
+
+    QMutexLocker lock(&mMutex);
+
+    while ( (mPending.size() > SINK_MAX_PENDING) && ! mFailed )
+        mHasRoom.wait(&mMutex);
+
+    if ( mFailed )
+        return;  // Reported by Close()
+
+    mPending.append(bytes);
+    mNumWritten += solutions.Size();
+
+    if ( mPending.size() >= SINK_BUFFER_SIZE )
+        mHasData.wakeOne();
+}
+
+
+bool SolutionSink::Close()
+{
+    if ( ! mFile.is_open() )
+        return ! mFailed;
+
+    {
+        QMutexLocker lock(&mMutex);
+        mClosing = true;
+        mHasData.wakeOne();
+    }
+
+    wait();  // The thread writes the rest before it ends.
+
+    mFile.close();
+
+    return ! mFailed;
+}
+
+
+void SolutionSink::run()
+{
+    std::string buffer;
+
+    for (;;)
+    {
+        bool closing;
+        {
+            QMutexLocker lock(&mMutex);
+
+            if ( ! mClosing && (mPending.size() < SINK_BUFFER_SIZE) )
+                mHasData.wait(&mMutex, SINK_FLUSH_MS);
+
+            buffer.swap(mPending);
+            closing = mClosing;
+            mHasRoom.wakeAll();
+        }
+
+        if ( ! buffer.empty() )
+        {
+            mFile.write(buffer.data(), buffer.size());
+            mFile.flush();
+            buffer.clear();
+
+            if ( ! mFile.good() )
+            {
+                QMutexLocker lock(&mMutex);
+                mFailed = true;
+                mHasRoom.wakeAll();
+                break;
+            }
+        }
+
+        if ( closing )
+            break;
+    }
+}
+
+
+void SolutionSink::Serialize( const SolutionArena& solutions, std::string* out ) const
+{
+    if ( SF_CSV == mFormat )
+    {
+        std::ostringstream line;
+        line << std::setprecision(9);
+
+        for ( unsigned int s=0; s<solutions.Size(); ++s )
+        {
+            const SolutionRecord& rec = solutions.Record(s);
+            const TracePoint* points = solutions.Points(s);
+
+            line << rec.launchAngle << ',' << rec.pathLength << ',' << rec.length;
+            for ( unsigned int i=0; i<rec.length; ++i )
+                line << ',' << points[i].x << ',' << points[i].y;
+            line << '\n';
+        }
+
+        out->append(line.str());
+        return;
+    }
+
+    out->reserve(solutions.Size() * 3 * sizeof(float) + solutions.NumPoints() * 2 * sizeof(float));
+
+    for ( unsigned int s=0; s<solutions.Size(); ++s )
+    {
+        const SolutionRecord& rec = solutions.Record(s);
+        const TracePoint* points = solutions.Points(s);
+
+        Put<quint32>(out, rec.length);
+        Put<float>(out, rec.launchAngle);
+        Put<float>(out, rec.pathLength);
+        for ( unsigned int i=0; i<rec.length; ++i )
+        {
+            Put<float>(out, points[i].x);
+            Put<float>(out, points[i].y);
+        }
+    }
+}
+
+}  // namespace
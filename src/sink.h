@@ -0,0 +1,83 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef SINK_H
+#define SINK_H
+
+#include <string>
+#include <fstream>
+#include <sstream>
+
+#include "qglobal.h"
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "solutions.h"
+
+
+namespace circles
+{
+
+extern const unsigned int SINK_BUFFER_SIZE;
+extern const unsigned int SINK_MAX_PENDING;
+extern const int          SINK_FLUSH_MS;
+extern const char         SINK_MAGIC[8];
+
+
+/******************************** SolutionSink ********************************/
+
+typedef enum {
+    SF_BINARY,
+    SF_CSV
+} SinkFormat;
+
+
+/* Appends solutions to a file as they are found, so they don't have to stay
+ * in memory. Write() only serializes the solutions into a buffer; a thread of
+ * the sink writes it out in the background. If the disk can't keep up, Write()
+ * waits, so the memory stays bounded.
+ *
+ * The binary format is SINK_MAGIC, then per solution: uint32 number of points,
+ * float launch angle, float path length and the points as float x, y pairs
+ * (native byte order). The CSV format has a header line, then one line per
+ * solution: angle,length,points,x0,y0,x1,y1,... */
+class SolutionSink : public QThread
+{
+  public:
+    SolutionSink();
+    ~SolutionSink();
+
+    // Files named *.csv are written as CSV, the others - as binary.
+    bool Open(const char* fileName, std::stringstream& errSStr);
+
+    // Called by the producer thread.
+    void Write(const SolutionArena& solutions);
+
+    // Writes the rest and closes the file. Returns false on a write error.
+    bool Close();
+
+    unsigned long NumWritten() const { return mNumWritten; }
+
+    void run();
+
+  private:
+    void Serialize(const SolutionArena& solutions, std::string* out) const;
+
+    std::ofstream  mFile;
+    SinkFormat     mFormat;
+    unsigned long  mNumWritten;  // Updated by the producer
+
+    // Shared with the writing thread, protected by mMutex.
+    QMutex         mMutex;
+    QWaitCondition mHasData;
+    QWaitCondition mHasRoom;
+    std::string    mPending;
+    bool           mClosing;
+    bool           mFailed;
+};
+
+}  // namespace
+
+#endif // SINK_H
@@ -0,0 +1,61 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include "snapshot.h"
+
+
+namespace circles
+{
+
+/******************************* SceneSnapshot ********************************/
+
+SnapshotPtr SceneSnapshot::Create( const std::vector<Figure*>& scene,
+                                   const Point* pA, const Point* pB )
+{
+    SceneSnapshot* snap = new SceneSnapshot();
+    SnapshotPtr result(snap);  // Deletes it if something throws.
+
+    // Count first - the arrays must not move after taking the pointers.
+    unsigned int numPoints = 0, numCircles = 0;
+    for ( std::vector<Figure*>::const_iterator fig=scene.begin();
+          fig != scene.end(); ++fig )
+    {
+        // TODO Replace dynamic_cast<>
+        if ( NULL != dynamic_cast<const Circle*>(*fig) )
+            ++numCircles;
+        else if ( NULL != dynamic_cast<const Point*>(*fig) )
+            ++numPoints;
+    }
+
+    snap->mPoints.reserve(numPoints);
+    snap->mCircles.reserve(numCircles);
+    snap->mFigures.reserve(numPoints + numCircles);
+
+    for ( std::vector<Figure*>::const_iterator fig=scene.begin();
+          fig != scene.end(); ++fig )
+    {
+        const Circle *crp = dynamic_cast<const Circle*>(*fig);
+        const Point *ptp = dynamic_cast<const Point*>(*fig);
+
+        if ( NULL != crp )
+        {
+            snap->mCircles.push_back(*crp);
+            snap->mFigures.push_back(&snap->mCircles.back());
+        }
+        else if ( NULL != ptp )
+        {
+            snap->mPoints.push_back(*ptp);
+            snap->mFigures.push_back(&snap->mPoints.back());
+
+            if ( ptp == pA )
+                snap->mA = &snap->mPoints.back();
+            else if ( ptp == pB )
+                snap->mB = &snap->mPoints.back();
+        }
+    }
+
+    return result;
+}
+
+}  // namespace
@@ -0,0 +1,58 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <vector>
+
+#include "qglobal.h"
+#include <QSharedPointer>
+
+#include "geometry.h"
+
+
+namespace circles
+{
+
+class SceneSnapshot;
+typedef QSharedPointer<const SceneSnapshot> SnapshotPtr;
+
+
+/******************************* SceneSnapshot ********************************/
+
+/* A frozen copy of the scene, which the rendering and tracking threads share.
+ * The figures are copied once into contiguous arrays; after Create() nothing
+ * changes, so no locking is needed and the GUI is free to edit its own figures
+ * (the working version) and to take a new snapshot for the next run. The last
+ * holder of the pointer deletes it. */
+class SceneSnapshot
+{
+  public:
+    // Copies the figures. pA and pB are the ones in the scene, or NULL.
+    static SnapshotPtr Create(const std::vector<Figure*>& scene,
+                              const Point* pA, const Point* pB);
+
+    // In the order of the original scene. Must not be modified, even though
+    // the tracing functions take non-const figures.
+    const std::vector<Figure*>& Figures() const { return mFigures; }
+
+    const Point* A() const { return mA; }
+    const Point* B() const { return mB; }
+
+  private:
+    SceneSnapshot() : mPoints(), mCircles(), mFigures(), mA(NULL), mB(NULL) {}
+    SceneSnapshot(const SceneSnapshot&);             // Not copyable - the
+    SceneSnapshot& operator=(const SceneSnapshot&);  // figures point inside.
+
+    std::vector<Point>   mPoints;
+    std::vector<Circle>  mCircles;
+    std::vector<Figure*> mFigures;  // Into mPoints and mCircles
+    const Point*         mA;
+    const Point*         mB;
+};
+
+}  // namespace
+
+#endif // SNAPSHOT_H
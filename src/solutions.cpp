@@ -0,0 +1,535 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <cmath>
+#include <algorithm>
+#include "solutions.h"
+#include "density.h"
+#include "view.h"
+
+
+namespace circles
+{
+
+const unsigned int SOLUTIONS_LINES_MAX = 10000;  // More are drawn as density
+const unsigned int TRACE_CACHE_SIZE = 16384;  // Rebuilt traces kept, more than the lines
+
+/****************************** SolutionArena *********************************/
+
+void SolutionArena::Add( const Ray& ray )
+{
+    const std::vector<Point>& trace = ray.GetTrace();
+
+    SolutionRecord rec;
+    rec.offset = mPoints.size();
+    rec.length = trace.size() + 1;
+    rec.launchAngle = ray.GetLaunchAngle();
+    rec.pathLength = 0.0f;
+
+    for ( unsigned int i=0; i<trace.size(); ++i )
+    {
+        TracePoint tp = { trace[i].x, trace[i].y };
+        mPoints.push_back(tp);
+    }
+
+    Point src = ray.GetSrc();
+    TracePoint last = { src.x, src.y };
+    mPoints.push_back(last);
+
+    for ( unsigned int i=rec.offset+1; i<mPoints.size(); ++i )
+        rec.pathLength += Module( mPoints[i].x - mPoints[i-1].x,
+                                  mPoints[i].y - mPoints[i-1].y );
+
+    mRecords.push_back(rec);
+}
+
+
+void SolutionArena::Append( SolutionArena& other )
+{
+    if ( mRecords.empty() )
+    {
+        Swap(other);  // Nothing to copy.
+        return;
+    }
+
+    ++other.mEpoch;
+
+    unsigned int base = mPoints.size();
+
+    mPoints.insert(mPoints.end(), other.mPoints.begin(), other.mPoints.end());
+
+    mRecords.reserve(mRecords.size() + other.mRecords.size());
+    for ( std::vector<SolutionRecord>::const_iterator rec=other.mRecords.begin();
+          rec != other.mRecords.end(); ++rec )
+    {
+        mRecords.push_back(*rec);
+        mRecords.back().offset += base;
+    }
+
+    other.Clear();
+}
+
+
+void SolutionArena::Truncate( unsigned int n )
+{
+    if ( n >= mRecords.size() )
+        return;
+
+    mPoints.resize(mRecords[n].offset);
+    mRecords.resize(n);
+    ++mEpoch;
+}
+
+
+void SolutionArena::Clear()
+{
+    // Release the memory too - the arena may have been huge.
+    std::vector<TracePoint>().swap(mPoints);
+    std::vector<SolutionRecord>().swap(mRecords);
+    ++mEpoch;
+}
+
+
+void SolutionArena::Swap( SolutionArena& other )
+{
+    mPoints.swap(other.mPoints);
+    mRecords.swap(other.mRecords);
+    ++mEpoch;
+    ++other.mEpoch;
+}
+
+
+void SolutionArena::Draw( QPainter *painter, const QRectF& area ) const
+{
+    if ( mRecords.empty() )
+        return;
+
+    QPen pen(Qt::darkYellow, 1, Qt::SolidLine);
+    pen.setCosmetic(true);
+    painter->setPen(pen);
+    const bool all = area.isNull();
+
+    // One segment less per trace than points.
+    std::vector<QLineF> lines;
+    lines.reserve(mPoints.size() - mRecords.size());
+
+    for ( std::vector<SolutionRecord>::const_iterator rec=mRecords.begin();
+          rec != mRecords.end(); ++rec )
+    {
+        for ( unsigned int i=rec->offset+1; i<rec->offset+rec->length; ++i )
+        {
+            QLineF l(mPoints[i-1].x, mPoints[i-1].y, mPoints[i].x, mPoints[i].y);
+            if ( all || Overlap(area, QRectF(l.p1(), l.p2()).normalized()) )
+                lines.push_back(l);
+        }
+    }
+
+    if ( ! lines.empty() )
+        painter->drawLines(&lines[0], lines.size());
+}
+
+
+/******************************* SolutionLog **********************************/
+
+// The distance from B to the line of the last leg, from last to end.
+static float LastLegMiss( const Point* B, float lastX, float lastY, float endX, float endY )
+{
+    float legLength = Module(endX - lastX, endY - lastY);
+    if ( legLength <= 0.0f )
+        return Module(B->x - lastX, B->y - lastY);
+    return fabs((endX - lastX) * (B->y - lastY) - (endY - lastY) * (B->x - lastX)) / legLength;
+}
+
+
+bool SolutionLog::Add( const Ray& ray, float launchAngle, const std::vector<unsigned int>& hits )
+{
+    if ( hits.size() != static_cast<unsigned int>(mK) )
+        return false;  // Of another K, the records would be misaligned
+
+    const std::vector<Point>& trace = ray.GetTrace();
+    const Point end = ray.GetSrc();
+
+    CompactSolution rec;
+    rec.launchAngle = launchAngle;
+    rec.pathLength = 0.0f;
+    for ( unsigned int i=1; i<trace.size(); ++i )
+        rec.pathLength += Module(trace[i].x - trace[i-1].x, trace[i].y - trace[i-1].y);
+    rec.pathLength += Module(end.x - trace.back().x, end.y - trace.back().y);
+    rec.miss = LastLegMiss(mSnapshot->B(), trace.back().x, trace.back().y, end.x, end.y);
+
+    rec.first = mHits.size();
+    rec.pinned = false;
+    mHits.insert(mHits.end(), hits.begin(), hits.end());
+    mRecords.push_back(rec);
+    return true;
+}
+
+
+void SolutionLog::AddPinned( const Ray& ray )
+{
+    mPinned.Add(ray);
+
+    const SolutionRecord& trace = mPinned.Record(mPinned.Size() - 1);
+    const TracePoint* points = mPinned.Points(mPinned.Size() - 1);
+    const TracePoint& last = points[trace.length - 2];
+    const TracePoint& end = points[trace.length - 1];
+
+    CompactSolution rec;
+    rec.launchAngle = trace.launchAngle;
+    rec.pathLength = trace.pathLength;
+    rec.miss = LastLegMiss(mSnapshot->B(), last.x, last.y, end.x, end.y);
+    rec.first = mPinned.Size() - 1;
+    rec.pinned = true;
+    mRecords.push_back(rec);
+}
+
+
+void SolutionLog::Append( SolutionLog& other )
+{
+    if ( mRecords.empty() )
+    {
+        Swap(other);  // Nothing to copy.
+        return;
+    }
+
+    ++other.mEpoch;
+
+    const unsigned int hitsBase = mHits.size();
+    const unsigned int pinnedBase = mPinned.Size();
+
+    mHits.insert(mHits.end(), other.mHits.begin(), other.mHits.end());
+    mPinned.Append(other.mPinned);
+
+    mRecords.reserve(mRecords.size() + other.mRecords.size());
+    for ( std::vector<CompactSolution>::const_iterator rec=other.mRecords.begin();
+          rec != other.mRecords.end(); ++rec )
+    {
+        mRecords.push_back(*rec);
+        mRecords.back().first += rec->pinned ? pinnedBase : hitsBase;
+    }
+
+    other.Clear();
+}
+
+
+void SolutionLog::Truncate( unsigned int n )
+{
+    if ( n >= mRecords.size() )
+        return;
+
+    // The hits and the pinned traces are in the order of the records.
+    unsigned int numHits = 0;
+    unsigned int numPinned = 0;
+    for ( unsigned int i=0; i<n; ++i )
+    {
+        if ( mRecords[i].pinned )
+            numPinned = mRecords[i].first + 1;
+        else
+            numHits = mRecords[i].first + mK;
+    }
+
+    mHits.resize(numHits);
+    mPinned.Truncate(numPinned);
+    mRecords.resize(n);
+    ++mEpoch;
+}
+
+
+void SolutionLog::Clear()
+{
+    // Release the memory too. The snapshot stays for the next solutions.
+    std::vector<unsigned int>().swap(mHits);
+    std::vector<CompactSolution>().swap(mRecords);
+    mPinned.Clear();
+    ++mEpoch;
+}
+
+
+void SolutionLog::Swap( SolutionLog& other )
+{
+    mSnapshot.swap(other.mSnapshot);
+    std::swap(mK, other.mK);
+    mHits.swap(other.mHits);
+    mRecords.swap(other.mRecords);
+    mPinned.Swap(other.mPinned);
+    ++mEpoch;
+    ++other.mEpoch;
+}
+
+
+bool SolutionLog::SamePath( unsigned int a, unsigned int b ) const
+{
+    const CompactSolution& ra = mRecords[a];
+    const CompactSolution& rb = mRecords[b];
+    if ( ra.pinned || rb.pinned )
+        return false;
+
+    return std::equal(mHits.begin() + ra.first, mHits.begin() + ra.first + mK,
+                      mHits.begin() + rb.first);
+}
+
+
+bool SolutionLog::Trace( unsigned int i, std::vector<TracePoint>* points ) const
+{
+    const CompactSolution& rec = mRecords[i];
+    points->clear();
+
+    if ( rec.pinned )
+    {
+        const TracePoint* pinned = mPinned.Points(rec.first);
+        points->assign(pinned, pinned + mPinned.Record(rec.first).length);
+        return true;
+    }
+
+    // The same steps as RayTrace(), so the same floats.
+    const std::vector<Figure*>& figures = mSnapshot->Figures();
+    Ray ray( *mSnapshot->A(), Vector(cos(rec.launchAngle), sin(rec.launchAngle)) );
+    for ( int k=0; k<mK; ++k )
+    {
+        if ( mHits[rec.first + k] >= figures.size() )
+            return false;  // Not of this snapshot
+        figures[mHits[rec.first + k]]->Reflect(&ray);
+        if ( ray.GetNumberOfReflections() != k+1 )
+            return false;  // Missed it
+    }
+
+    // A and the reflection points, then the last leg, which is as long as
+    // the rest of the path.
+    const std::vector<Point>& trace = ray.GetTrace();
+    for ( unsigned int j=0; j<trace.size(); ++j )
+    {
+        TracePoint tp = { trace[j].x, trace[j].y };
+        points->push_back(tp);
+    }
+    TracePoint src = { ray.GetSrc().x, ray.GetSrc().y };
+    points->push_back(src);
+
+    float rest = rec.pathLength;
+    for ( unsigned int j=1; j<points->size(); ++j )
+        rest -= Module((*points)[j].x - (*points)[j-1].x, (*points)[j].y - (*points)[j-1].y);
+    Point end = ray.GetPointAt(std::max(rest, 0.0f));
+    TracePoint tp = { end.x, end.y };
+    points->push_back(tp);
+
+    return true;
+}
+
+
+void SolutionLog::Replay( SolutionArena* arena ) const
+{
+    std::vector<TracePoint> points;
+    for ( unsigned int i=0; i<mRecords.size(); ++i )
+    {
+        if ( ! Trace(i, &points) )
+            continue;
+
+        // Back to a Ray for the arena.
+        Ray ray( Point(points[0].x, points[0].y), Vector(cos(mRecords[i].launchAngle),
+                                                         sin(mRecords[i].launchAngle)) );
+        for ( unsigned int j=1; j<points.size(); ++j )
+            ray.Propagate(Point(points[j].x, points[j].y));
+        arena->Add(ray);
+    }
+}
+
+
+/******************************** TraceCache **********************************/
+
+void TraceCache::Clear()
+{
+    mTraces.clear();
+    mLru.clear();
+    mLog = NULL;
+}
+
+
+const std::vector<TracePoint>* TraceCache::Trace( const SolutionLog& log, unsigned int i )
+{
+    if ( (&log != mLog) || (log.Epoch() != mEpoch) )
+    {
+        // Removed or replaced - the indexes are not the same solutions.
+        Clear();
+        mLog = &log;
+        mEpoch = log.Epoch();
+    }
+
+    std::map<unsigned int, Entry>::iterator found = mTraces.find(i);
+    if ( found != mTraces.end() )
+    {
+        mLru.splice(mLru.begin(), mLru, found->second.lru);
+        return found->second.points.empty() ? NULL : &found->second.points;
+    }
+
+    if ( (mTraces.size() >= mMaxTraces) && ! mLru.empty() )
+    {
+        mTraces.erase(mLru.back());
+        mLru.pop_back();
+    }
+
+    mLru.push_front(i);
+    Entry& entry = mTraces[i];
+    entry.lru = mLru.begin();
+    if ( ! log.Trace(i, &entry.points) )
+        entry.points.clear();
+
+    return entry.points.empty() ? NULL : &entry.points;
+}
+
+
+/***************************** SolutionPainter ********************************/
+
+SolutionPainter::~SolutionPainter()
+{
+    delete mField;
+}
+
+
+void SolutionPainter::Draw( const SolutionLog& solutions, QPainter *painter,
+                            const QRectF& area, int width, int height )
+{
+    if ( (solutions.Epoch() != mEpoch) || (solutions.Size() < mDone) ||
+         ((NULL != mField) && ((mWidth != width) || (mHeight != height))) )
+    {
+        // Removed or replaced - start over.
+        delete mField;
+        mField = NULL;
+        mImage = QImage();
+        mEpoch = solutions.Epoch();
+        mDone = 0;
+        mBest.clear();
+        mOrder.clear();
+    }
+
+    if ( solutions.Empty() )
+        return;
+
+    if ( solutions.Size() != mDone )
+        FindBest(solutions);
+
+    if ( solutions.Size() <= SOLUTIONS_LINES_MAX )
+        DrawLines(solutions, painter, area);
+    else
+    {
+        if ( NULL == mField )
+        {
+            QRectF fieldArea;
+            int fieldWidth, fieldHeight;
+            DensityField::Bounds(solutions.Snapshot()->Figures(), width, height,
+                                 &fieldArea, &fieldWidth, &fieldHeight);
+            mField = new DensityField(fieldArea, fieldWidth, fieldHeight);
+            mWidth = width;
+            mHeight = height;
+            mDone = 0;
+        }
+
+        if ( solutions.Size() != mDone )
+        {
+            // Rebuilt once each, they are not drawn again.
+            for ( unsigned int s=mDone; s<solutions.Size(); ++s )
+            {
+                if ( ! solutions.Trace(s, &mPoints) )
+                    continue;
+                for ( unsigned int i=1; i<mPoints.size(); ++i )
+                    mField->AddSegment(mPoints[i-1].x, mPoints[i-1].y,
+                                       mPoints[i].x, mPoints[i].y);
+            }
+            mImage = mField->ToneMap();
+        }
+
+        painter->drawImage(mField->Area(), mImage);
+    }
+    mDone = solutions.Size();
+
+    // The best rays on top.
+    std::vector<QPointF> line;
+    QPen pen(Qt::red, 2, Qt::SolidLine);
+    pen.setCosmetic(true);
+    painter->setPen(pen);
+    for ( unsigned int b=0; b<mBest.size(); ++b )
+    {
+        const std::vector<TracePoint>* points = mTraces.Trace(solutions, mBest[b]);
+        if ( (NULL == points) || (points->size() < 2) )
+            continue;
+        line.clear();
+        for ( unsigned int i=0; i<points->size(); ++i )
+            line.push_back(QPointF((*points)[i].x, (*points)[i].y));
+        painter->drawPolyline(&line[0], line.size());
+    }
+}
+
+
+void SolutionPainter::DrawLines( const SolutionLog& solutions, QPainter *painter,
+                                 const QRectF& area )
+{
+    QPen pen(Qt::darkYellow, 1, Qt::SolidLine);
+    pen.setCosmetic(true);
+    painter->setPen(pen);
+    const bool all = area.isNull();
+
+    std::vector<QLineF> lines;
+    for ( unsigned int s=0; s<solutions.Size(); ++s )
+    {
+        const std::vector<TracePoint>* points = mTraces.Trace(solutions, s);
+        if ( NULL == points )
+            continue;
+
+        for ( unsigned int i=1; i<points->size(); ++i )
+        {
+            QLineF l((*points)[i-1].x, (*points)[i-1].y, (*points)[i].x, (*points)[i].y);
+            if ( all || Overlap(area, QRectF(l.p1(), l.p2()).normalized()) )
+                lines.push_back(l);
+        }
+    }
+
+    if ( ! lines.empty() )
+        painter->drawLines(&lines[0], lines.size());
+}
+
+
+// Orders solutions by their launch angle.
+class LaunchAngleLess
+{
+  public:
+    explicit LaunchAngleLess( const SolutionLog& solutions ) : mSolutions(solutions) {}
+
+    bool operator()( unsigned int a, unsigned int b ) const
+    {
+        return mSolutions.Record(a).launchAngle < mSolutions.Record(b).launchAngle;
+    }
+
+  private:
+    const SolutionLog& mSolutions;
+};
+
+
+void SolutionPainter::FindBest( const SolutionLog& solutions )
+{
+    // Only the appended solutions are sorted, then merged into the order.
+    const unsigned int numSorted = mOrder.size();
+    for ( unsigned int s=numSorted; s<solutions.Size(); ++s )
+        mOrder.push_back(s);
+    LaunchAngleLess less(solutions);
+    std::sort(mOrder.begin() + numSorted, mOrder.end(), less);
+    std::inplace_merge(mOrder.begin(), mOrder.begin() + numSorted, mOrder.end(), less);
+
+    mBest.clear();
+    unsigned int best = 0;  // Of the current run in mOrder
+    for ( unsigned int s=1; s<=mOrder.size(); ++s )
+    {
+        bool same = (s < mOrder.size()) && solutions.SamePath(mOrder[s-1], mOrder[s]);
+
+        if ( same )
+        {
+            if ( solutions.Record(mOrder[s]).miss < solutions.Record(mOrder[best]).miss )
+                best = s;
+        }
+        else
+        {
+            mBest.push_back(mOrder[best]);
+            best = s;
+        }
+    }
+}
+
+}  // namespace
@@ -0,0 +1,247 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef SOLUTIONS_H
+#define SOLUTIONS_H
+
+#include <vector>
+#include <list>
+#include <map>
+#include <QPainter>
+#include <QImage>
+#include <QSharedPointer>
+
+#include "geometry.h"
+#include "snapshot.h"
+
+
+namespace circles
+{
+
+extern const unsigned int SOLUTIONS_LINES_MAX;
+extern const unsigned int TRACE_CACHE_SIZE;
+
+class DensityField;
+
+
+/****************************** SolutionArena *********************************/
+
+// A trace point without the Figure overhead.
+struct TracePoint
+{
+    float x;
+    float y;
+};
+
+
+// Where a solution's trace is in the point pool, and what we know about it.
+struct SolutionRecord
+{
+    unsigned int offset;       // Index of the first point in the pool
+    unsigned int length;       // Number of points (reflections + 2)
+    float        launchAngle;  // Direction from A in radians
+    float        pathLength;   // Sum of the segment lengths
+};
+
+
+/* Stores many solution traces in one flat point pool, plus a record per
+ * solution, instead of a heap block per Ray. The searches without the GUI
+ * collect their solutions in it, and the sinks write it. */
+class SolutionArena
+{
+  public:
+    SolutionArena() : mPoints(), mRecords(), mEpoch(0) {}
+    ~SolutionArena() {}
+
+    // Appends the trace of the ray and its current source as the last point.
+    void Add( const Ray& ray );
+
+    // Moves all solutions of the other arena to the end of this one.
+    void Append( SolutionArena& other );
+
+    // Keeps only the first n solutions.
+    void Truncate( unsigned int n );
+
+    void Clear();
+    void Swap( SolutionArena& other );
+
+    unsigned int Size() const { return mRecords.size(); }
+    bool Empty() const { return mRecords.empty(); }
+    unsigned int NumPoints() const { return mPoints.size(); }
+
+    const SolutionRecord& Record( unsigned int i ) const { return mRecords[i]; }
+    const TracePoint* Points( unsigned int i ) const { return &mPoints[mRecords[i].offset]; }
+
+    // Changes when solutions are removed or replaced, but not when appended.
+    unsigned int Epoch() const { return mEpoch; }
+
+    // Draws every trace with one drawLines() call. Only the segments, which
+    // may cross the area, if it is not null.
+    void Draw( QPainter *painter, const QRectF& area = QRectF() ) const;
+
+  private:
+    std::vector<TracePoint>     mPoints;
+    std::vector<SolutionRecord> mRecords;
+    unsigned int                mEpoch;
+};
+
+
+/******************************* SolutionLog **********************************/
+
+// A solution without its trace: it is replayed from the launch angle, by
+// reflecting from the same figures.
+struct CompactSolution
+{
+    float        launchAngle;  // The ray is built from its cos() and sin()
+    float        miss;         // Distance from B to the last leg
+    float        pathLength;   // Sum of the segment lengths
+    unsigned int first;        // Of its K hits in the pool, or of its trace in
+                               // the pinned arena
+    bool         pinned;       // The trace is kept
+};
+
+
+/* Stores the solutions of a search with K reflections in a snapshot as launch
+ * parameters and the indexes of the figures they reflect from, a few dozen
+ * bytes each. The trace of a solution is rebuilt on demand in O(K), without a
+ * search. The traces, which can't be rebuilt like this (e.g. made in double
+ * precision), are pinned - kept as they are. This is what the rendering
+ * threads send to the GUI. */
+class SolutionLog
+{
+  public:
+    SolutionLog() : mSnapshot(), mK(0), mHits(), mRecords(), mPinned(), mEpoch(0) {}
+    SolutionLog( const SnapshotPtr& snapshot, int K ) :
+        mSnapshot(snapshot), mK(K), mHits(), mRecords(), mPinned(), mEpoch(0) {}
+
+    // The ray, launched from A at the angle, reflected from the snapshot's
+    // figures with these indexes (see RayTrace()). Returns false and drops it
+    // if there are not K of them.
+    bool Add( const Ray& ray, float launchAngle, const std::vector<unsigned int>& hits );
+    void AddPinned( const Ray& ray );
+
+    // Moves all solutions of the other log, which must be of the same
+    // snapshot and K (or this one must be empty), to the end of this one.
+    void Append( SolutionLog& other );
+
+    // Keeps only the first n solutions.
+    void Truncate( unsigned int n );
+
+    void Clear();
+    void Swap( SolutionLog& other );
+
+    unsigned int Size() const { return mRecords.size(); }
+    bool Empty() const { return mRecords.empty(); }
+
+    const CompactSolution& Record( unsigned int i ) const { return mRecords[i]; }
+
+    // True if the solutions reflect from the same figures. The pinned ones
+    // are different from all.
+    bool SamePath( unsigned int a, unsigned int b ) const;
+
+    // Rebuilds the trace of solution i. Returns false if it isn't the same
+    // any more (never for the snapshot it was found in).
+    bool Trace( unsigned int i, std::vector<TracePoint>* points ) const;
+
+    // Rebuilds all traces, e.g. for exporting them.
+    void Replay( SolutionArena* arena ) const;
+
+    // Changes when solutions are removed or replaced, but not when appended.
+    unsigned int Epoch() const { return mEpoch; }
+
+    const SnapshotPtr& Snapshot() const { return mSnapshot; }
+
+  private:
+    SnapshotPtr                  mSnapshot;  // Keeps the figures alive
+    int                          mK;
+    std::vector<unsigned int>    mHits;      // K figure indexes per solution
+    std::vector<CompactSolution> mRecords;
+    SolutionArena                mPinned;
+    unsigned int                 mEpoch;
+};
+
+
+// Solutions sent from a thread to the GUI. Freed with the queued signal, if
+// it is never delivered.
+typedef QSharedPointer<SolutionLog> SolutionLogPtr;
+
+
+/******************************** TraceCache **********************************/
+
+/* Keeps the last TRACE_CACHE_SIZE traces rebuilt from a log, dropping the
+ * least recently used ones. */
+class TraceCache
+{
+  public:
+    explicit TraceCache( unsigned int maxTraces = TRACE_CACHE_SIZE ) :
+        mMaxTraces(maxTraces), mLog(NULL), mEpoch(0), mTraces(), mLru() {}
+
+    // The trace of solution i, rebuilt if it isn't kept. NULL if it can't be
+    // rebuilt. Valid until the next call.
+    const std::vector<TracePoint>* Trace( const SolutionLog& log, unsigned int i );
+
+    void Clear();
+
+  private:
+    struct Entry
+    {
+        std::vector<TracePoint>           points;  // Empty if not rebuilt
+        std::list<unsigned int>::iterator lru;
+    };
+
+    unsigned int                  mMaxTraces;
+    const SolutionLog*            mLog;    // Of the traces kept
+    unsigned int                  mEpoch;  // Of the log
+    std::map<unsigned int, Entry> mTraces;  // By solution
+    std::list<unsigned int>       mLru;     // The most recent first
+};
+
+
+/***************************** SolutionPainter ********************************/
+
+/* Draws an arena with a level of detail, which depends on its size. Up to
+ * SOLUTIONS_LINES_MAX solutions are drawn as lines. More are rasterized into a
+ * density image over the scene's bounds, and only the solutions, which are
+ * appended since the last time, are added to it. In both cases the best ray of
+ * each distinct path is drawn on top. */
+class SolutionPainter
+{
+  public:
+    SolutionPainter() : mField(NULL), mImage(), mWidth(0), mHeight(0), mEpoch(0),
+                        mDone(0), mBest(), mOrder(), mTraces(), mPoints() {}
+    ~SolutionPainter();
+
+    // The view is width x height, the visible area is in the coordinates of
+    // the solutions. The density image has about as many pixels.
+    void Draw( const SolutionLog& solutions, QPainter *painter,
+               const QRectF& area, int width, int height );
+
+  private:
+    // Draws every trace with one drawLines() call. Only the segments, which
+    // may cross the area.
+    void DrawLines( const SolutionLog& solutions, QPainter *painter, const QRectF& area );
+
+    // Takes the solution, which comes closest to B, of each run of
+    // neighbouring launch angles reflecting from the same figures. The order
+    // by angle is kept, only the appended solutions are sorted into it.
+    void FindBest( const SolutionLog& solutions );
+
+    DensityField*             mField;  // NULL below SOLUTIONS_LINES_MAX
+    QImage                    mImage;  // Tone-mapped mField
+    int                       mWidth;  // Of the view, for which mField was made
+    int                       mHeight;
+    unsigned int              mEpoch;  // Of the arena, which was drawn
+    unsigned int              mDone;   // Solutions drawn so far
+    std::vector<unsigned int> mBest;   // Indexes of the highlighted solutions
+    std::vector<unsigned int> mOrder;  // Of the solutions by launch angle
+    TraceCache                mTraces;  // Of the lines and the best rays
+    std::vector<TracePoint>   mPoints;  // Rebuilt for the density
+
+    SolutionPainter( const SolutionPainter& );
+    SolutionPainter& operator=( const SolutionPainter& );
+};
+
+}  // namespace
+
+#endif // SOLUTIONS_H
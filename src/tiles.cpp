@@ -0,0 +1,659 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+#include <QElapsedTimer>
+#ifdef Q_OS_UNIX
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif  // Q_OS_UNIX
+#include "tiles.h"
+#include "scene.h"
+#include "solutions.h"
+#include "renderer.h"
+
+
+namespace circles
+{
+
+const char TILES_MAGIC[8] = { 'R', 'C', 'T', 'I', 'L', '1', '\n', '\0' };
+const unsigned int TILE_CIRCLES  = 256;   // Per tile, on average (a page)
+const int          TILE_PREFETCH = 4;     // Tiles ahead of a ray
+const unsigned int TILE_CACHE_MB = 256;   // Mapped tiles, by default
+
+static const quint32 NO_CIRCLE = 0xFFFFFFFF;
+static const unsigned int READ_CHUNK = 4096;  // Circles read at once
+
+
+/******************************** Tiled scene *********************************/
+
+template<typename T>
+static inline bool Get( std::istream& in, T* value )
+{
+    return static_cast<bool>( in.read(reinterpret_cast<char*>(value), sizeof(T)) );
+}
+
+
+// Reads the circles of a binary scene from 'start' and calls the visitor with
+// each one and its index. Returns false if the file ends early.
+template<typename Visitor>
+static bool ReadCircles( std::istream& in, std::streampos start,
+                         quint32 numCircles, Visitor* visit )
+{
+    in.clear();
+    in.seekg(start);
+
+    std::vector<float> chunk(3 * READ_CHUNK);
+    for ( quint32 i=0; i<numCircles; )
+    {
+        quint32 n = std::min(READ_CHUNK, numCircles - i);
+        if ( ! in.read(reinterpret_cast<char*>(&chunk[0]), n * 3 * sizeof(float)) )
+            return false;
+
+        for ( quint32 j=0; j<n; ++j )
+            (*visit)(chunk[3*j], chunk[3*j+1], std::max(chunk[3*j+2], 0.0f), i + j);
+        i += n;
+    }
+    return true;
+}
+
+
+// The tiles covered by the bounding box of a circle, clamped to the scene.
+static void TileRange( const TilesHeader& h, float x, float y, float r,
+                       int* col0, int* row0, int* col1, int* row1 )
+{
+    *col0 = std::max(static_cast<int>( floor((x - r - h.x0) / h.tileSize) ), 0);
+    *row0 = std::max(static_cast<int>( floor((y - r - h.y0) / h.tileSize) ), 0);
+    *col1 = std::min(static_cast<int>( floor((x + r - h.x0) / h.tileSize) ), h.cols - 1);
+    *row1 = std::min(static_cast<int>( floor((y + r - h.y0) / h.tileSize) ), h.rows - 1);
+}
+
+
+class BoundsVisitor
+{
+  public:
+    BoundsVisitor() : minX(INF_DIST), minY(INF_DIST), maxX(-INF_DIST),
+                      maxY(-INF_DIST), maxR(0.0f) {}
+
+    void operator()( float x, float y, float r, quint32 )
+    {
+        minX = std::min(minX, x - r);
+        minY = std::min(minY, y - r);
+        maxX = std::max(maxX, x + r);
+        maxY = std::max(maxY, y + r);
+        maxR = std::max(maxR, r);
+    }
+
+    float minX, minY, maxX, maxY, maxR;
+};
+
+
+// Counts the circles of each tile at index + 1.
+class CountVisitor
+{
+  public:
+    CountVisitor( const TilesHeader& h, std::vector<quint64>* index ) :
+        mHeader(h), mIndex(*index) {}
+
+    void operator()( float x, float y, float r, quint32 )
+    {
+        int col0, row0, col1, row1;
+        TileRange(mHeader, x, y, r, &col0, &row0, &col1, &row1);
+        for ( int row=row0; row<=row1; ++row )
+            for ( int col=col0; col<=col1; ++col )
+                ++mIndex[row*mHeader.cols + col + 1];
+    }
+
+  private:
+    const TilesHeader&    mHeader;
+    std::vector<quint64>& mIndex;
+};
+
+
+// Puts the circles in their tiles. next[] is the next free place of each tile.
+class PlaceVisitor
+{
+  public:
+    PlaceVisitor( const TilesHeader& h, std::vector<quint64>* next,
+                  TileCircle* records ) :
+        mHeader(h), mNext(*next), mRecords(records) {}
+
+    void operator()( float x, float y, float r, quint32 id )
+    {
+        TileCircle c = { x, y, r, id };
+        int col0, row0, col1, row1;
+        TileRange(mHeader, x, y, r, &col0, &row0, &col1, &row1);
+        for ( int row=row0; row<=row1; ++row )
+            for ( int col=col0; col<=col1; ++col )
+                mRecords[mNext[row*mHeader.cols + col]++] = c;
+    }
+
+  private:
+    const TilesHeader&    mHeader;
+    std::vector<quint64>& mNext;
+    TileCircle*           mRecords;
+};
+
+
+bool WriteTiledScene( const char* sceneFile, const char* tilesFile,
+                      std::stringstream& errSStr )
+{
+    std::ifstream in(sceneFile, std::ios::in | std::ios::binary);
+    if ( ! in.is_open() )
+    {
+        errSStr << "Unable to open the input file '" << sceneFile << "'";
+        return false;
+    }
+
+    char magic[sizeof(SCENE_MAGIC)];
+    qint32 K;
+    quint8 scale, hasA, hasB;
+    float ax, ay, bx, by;
+    quint32 numCircles;
+    if ( ! (in.read(magic, sizeof(magic)) &&
+            (0 == memcmp(magic, SCENE_MAGIC, sizeof(magic))) &&
+            Get(in, &K) && Get(in, &scale) &&
+            Get(in, &hasA) && Get(in, &ax) && Get(in, &ay) &&
+            Get(in, &hasB) && Get(in, &bx) && Get(in, &by) &&
+            Get(in, &numCircles)) )
+    {
+        errSStr << "'" << sceneFile << "' is not a binary scene (save it as *.bin first)";
+        return false;
+    }
+    const std::streampos circlesAt = in.tellg();
+
+    BoundsVisitor bounds;
+    if ( hasA )
+        bounds(ax, ay, 0.0f, 0);
+    if ( hasB )
+        bounds(bx, by, 0.0f, 0);
+    if ( ! ReadCircles(in, circlesAt, numCircles, &bounds) )
+    {
+        errSStr << "The binary scene ends before " << numCircles << " circles";
+        return false;
+    }
+
+    TilesHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TILES_MAGIC, sizeof(header.magic));
+    header.K = K;
+    header.hasA = hasA;
+    header.ax = ax;
+    header.ay = ay;
+    header.hasB = hasB;
+    header.bx = bx;
+    header.by = by;
+    header.maxR = bounds.maxR;
+    header.numCircles = numCircles;
+
+    // Square tiles of about TILE_CIRCLES circles.
+    const float w = std::max(bounds.maxX - bounds.minX, 1.0f);
+    const float h = std::max(bounds.maxY - bounds.minY, 1.0f);
+    const float numTiles = std::max(1.0f, static_cast<float>(numCircles) / TILE_CIRCLES);
+    header.tileSize = sqrt(w * h / numTiles);
+    header.x0 = bounds.minX;
+    header.y0 = bounds.minY;
+    header.cols = static_cast<int>( ceil(w / header.tileSize) );
+    header.rows = static_cast<int>( ceil(h / header.tileSize) );
+
+    std::vector<quint64> index(static_cast<size_t>(header.cols) * header.rows + 1, 0);
+    CountVisitor counter(header, &index);
+    ReadCircles(in, circlesAt, numCircles, &counter);
+    for ( unsigned int t=1; t<index.size(); ++t )
+        index[t] += index[t-1];
+    header.numRecords = index.back();
+
+    QFile out(QString::fromUtf8(tilesFile));
+    if ( ! out.open(QIODevice::ReadWrite | QIODevice::Truncate) )
+    {
+        errSStr << "Unable to open the output file '" << tilesFile << "'";
+        return false;
+    }
+
+    const qint64 indexBytes = index.size() * sizeof(quint64);
+    const qint64 recordsAt = sizeof(header) + indexBytes;
+    const qint64 recordsBytes = header.numRecords * sizeof(TileCircle);
+    if ( (out.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header)) ||
+         (out.write(reinterpret_cast<const char*>(&index[0]), indexBytes) != indexBytes) ||
+         ! out.resize(recordsAt + recordsBytes) )
+    {
+        errSStr << "Failed writing the output file '" << tilesFile << "'";
+        return false;
+    }
+
+    // The records are placed through a mapping, so they don't have to be in
+    // memory at once.
+    if ( recordsBytes > 0 )
+    {
+        uchar* records = out.map(recordsAt, recordsBytes);
+        if ( NULL == records )
+        {
+            errSStr << "Unable to map the output file '" << tilesFile << "'";
+            return false;
+        }
+
+        std::vector<quint64> next(index.begin(), index.end() - 1);
+        PlaceVisitor placer(header, &next, reinterpret_cast<TileCircle*>(records));
+        ReadCircles(in, circlesAt, numCircles, &placer);
+        out.unmap(records);
+    }
+
+    out.close();
+    return true;
+}
+
+
+/********************************* TileCache **********************************/
+
+TileCache::TileCache() :
+        mFile(),
+        mHeader(),
+        mRecordsAt(0),
+        mIndex(),
+        mTiles(),
+        mLru(),
+        mMaxBytes(0),
+        mBytes(0),
+        mPeakBytes(0),
+        mNumHits(0),
+        mNumMisses(0),
+        mNumEvicted(0)
+{
+    memset(&mHeader, 0, sizeof(mHeader));
+}
+
+
+TileCache::~TileCache()
+{
+    for ( std::list<int>::const_iterator t=mLru.begin(); t!=mLru.end(); ++t )
+        mFile.unmap(mTiles[*t].data);
+}
+
+
+bool TileCache::Open( const char* fileName, quint64 maxBytes,
+                      std::stringstream& errSStr )
+{
+    mFile.setFileName(QString::fromUtf8(fileName));
+    if ( ! mFile.open(QIODevice::ReadOnly) )
+    {
+        errSStr << "Unable to open the input file '" << fileName << "'";
+        return false;
+    }
+
+    if ( (mFile.read(reinterpret_cast<char*>(&mHeader), sizeof(mHeader)) != sizeof(mHeader)) ||
+         (0 != memcmp(mHeader.magic, TILES_MAGIC, sizeof(mHeader.magic))) ||
+         (mHeader.cols < 1) || (mHeader.rows < 1) || (mHeader.tileSize <= 0.0f) )
+    {
+        errSStr << "'" << fileName << "' is not a tiled scene";
+        return false;
+    }
+
+    mIndex.resize(static_cast<size_t>(mHeader.cols) * mHeader.rows + 1);
+    const qint64 indexBytes = mIndex.size() * sizeof(quint64);
+    mRecordsAt = sizeof(mHeader) + indexBytes;
+    if ( (mFile.read(reinterpret_cast<char*>(&mIndex[0]), indexBytes) != indexBytes) ||
+         (mIndex.back() != mHeader.numRecords) ||
+         (mFile.size() < mRecordsAt + static_cast<qint64>(mHeader.numRecords * sizeof(TileCircle))) )
+    {
+        errSStr << "The tiled scene '" << fileName << "' is truncated";
+        return false;
+    }
+
+    mTiles.assign(mIndex.size() - 1, Entry());
+    mMaxBytes = maxBytes;
+    return true;
+}
+
+
+quint64 TileCache::Bytes( int tile ) const
+{
+    return (mIndex[tile+1] - mIndex[tile]) * sizeof(TileCircle);
+}
+
+
+const TileCircle* TileCache::Tile( int tile, unsigned int* count )
+{
+    *count = mIndex[tile+1] - mIndex[tile];
+    if ( 0 == *count )
+        return NULL;
+
+    Entry& e = mTiles[tile];
+    if ( NULL != e.data )
+    {
+        ++mNumHits;
+        mLru.splice(mLru.begin(), mLru, e.lru);
+    }
+    else
+    {
+        ++mNumMisses;
+        Map(tile);
+    }
+    return reinterpret_cast<const TileCircle*>(e.data);
+}
+
+
+void TileCache::Prefetch( int tile )
+{
+    if ( (Bytes(tile) == 0) || (NULL != mTiles[tile].data) )
+        return;
+
+    Map(tile);
+
+#ifdef Q_OS_UNIX
+    // Start reading it in the background.
+    const quintptr page = sysconf(_SC_PAGESIZE);
+    const quintptr begin = reinterpret_cast<quintptr>(mTiles[tile].data);
+    const quintptr start = begin & ~(page - 1);
+    posix_madvise(reinterpret_cast<void*>(start), begin + Bytes(tile) - start,
+                  POSIX_MADV_WILLNEED);
+#endif  // Q_OS_UNIX
+}
+
+
+void TileCache::Map( int tile )
+{
+    Entry& e = mTiles[tile];
+    e.data = mFile.map(mRecordsAt + mIndex[tile] * sizeof(TileCircle), Bytes(tile));
+    if ( NULL == e.data )
+        throw std::runtime_error("Unable to map a tile of the scene");
+
+    mLru.push_front(tile);
+    e.lru = mLru.begin();
+    mBytes += Bytes(tile);
+    mPeakBytes = std::max(mPeakBytes, mBytes);
+
+    Evict();
+}
+
+
+void TileCache::Evict()
+{
+    // The tile in use and the prefetched ones stay.
+    while ( (mBytes > mMaxBytes) &&
+            (mLru.size() > static_cast<size_t>(TILE_PREFETCH) + 1) )
+    {
+        const int tile = mLru.back();
+        mLru.pop_back();
+        mFile.unmap(mTiles[tile].data);
+        mTiles[tile].data = NULL;
+        mBytes -= Bytes(tile);
+        ++mNumEvicted;
+    }
+}
+
+
+/******************************** TiledTracer *********************************/
+
+TiledTracer::TiledTracer( TileCache* cache ) :
+        mCache(cache),
+        mLegs()
+{
+}
+
+
+// Narrows [t0, t1] to where s + t*d is in [lo, hi]. False if none is left.
+static bool Clip( double s, double d, double lo, double hi, double* t0, double* t1 )
+{
+    if ( 0.0 == d )
+        return (s >= lo) && (s <= hi);
+
+    double a = (lo - s) / d;
+    double b = (hi - s) / d;
+    if ( a > b )
+        std::swap(a, b);
+    *t0 = std::max(*t0, a);
+    *t1 = std::min(*t1, b);
+    return *t0 <= *t1;
+}
+
+
+bool TiledTracer::Hit( double sx, double sy, double dx, double dy, quint32 skip,
+                       double* t, TileCircle* hit )
+{
+    const TilesHeader& h = mCache->Header();
+    const double size = h.tileSize;
+
+    // The part of the leg over the tiles, up to *t.
+    double t0 = 0.0, t1 = *t;
+    if ( ! Clip(sx, dx, h.x0, h.x0 + h.cols*size, &t0, &t1) ||
+         ! Clip(sy, dy, h.y0, h.y0 + h.rows*size, &t0, &t1) )
+        return false;
+
+    int col = static_cast<int>( floor((sx + t0*dx - h.x0) / size) );
+    int row = static_cast<int>( floor((sy + t0*dy - h.y0) / size) );
+    col = std::min(std::max(col, 0), h.cols - 1);
+    row = std::min(std::max(row, 0), h.rows - 1);
+
+    // The leg's t at the next tile border in each direction, and between two.
+    const int stepC = (dx > 0.0)? 1 : -1;
+    const int stepR = (dy > 0.0)? 1 : -1;
+    double nextC = (0.0 != dx)? (h.x0 + (col + (dx > 0.0)) * size - sx) / dx : INF_DIST;
+    double nextR = (0.0 != dy)? (h.y0 + (row + (dy > 0.0)) * size - sy) / dy : INF_DIST;
+    const double deltaC = (0.0 != dx)? size / fabs(dx) : INF_DIST;
+    const double deltaR = (0.0 != dy)? size / fabs(dy) : INF_DIST;
+
+    while ( true )
+    {
+        unsigned int count;
+        const TileCircle* circles = mCache->Tile(row*h.cols + col, &count);
+
+        // The tiles the leg goes to next.
+        int c = col, r = row;
+        double nc = nextC, nr = nextR;
+        for ( int i=0; (i < TILE_PREFETCH) && (std::min(nc, nr) < t1); ++i )
+        {
+            if ( nc < nr ) { c += stepC; nc += deltaC; }
+            else           { r += stepR; nr += deltaR; }
+            if ( (c < 0) || (c >= h.cols) || (r < 0) || (r >= h.rows) )
+                break;
+            mCache->Prefetch(r*h.cols + c);
+        }
+
+        // A hit in this tile is the nearest - the circles hit earlier are
+        // in the tiles before.
+        const double exit = std::min(std::min(nextC, nextR), t1);
+        double best = exit;
+        bool found = false;
+        for ( unsigned int i=0; i<count; ++i )
+        {
+            const TileCircle& cr = circles[i];
+            if ( cr.id == skip )
+                continue;
+
+            double smcx = sx - cr.x;
+            double smcy = sy - cr.y;
+            double hh = dx*smcx + dy*smcy;
+            double disc = hh*hh - (smcx*smcx + smcy*smcy - static_cast<double>(cr.r)*cr.r);
+            if ( disc < 0.0 )
+                continue;
+            double tc = -hh - sqrt(disc);
+            if ( (tc > 0.0) && (tc <= best) )
+            {
+                best = tc;
+                *hit = cr;
+                found = true;
+            }
+        }
+
+        if ( found )
+        {
+            *t = best;
+            return true;
+        }
+
+        if ( exit >= t1 )
+            return false;
+
+        if ( nextC < nextR ) { col += stepC; nextC += deltaC; }
+        else                 { row += stepR; nextR += deltaR; }
+        if ( (col < 0) || (col >= h.cols) || (row < 0) || (row >= h.rows) )
+            return false;
+    }
+}
+
+
+bool TiledTracer::Trace( const Point& src, float angle, int K, const Point& dst,
+                         float targetR, Ray* ray )
+{
+    double sx = src.x, sy = src.y;
+    double dx = cos(angle), dy = sin(angle);
+    quint32 on = NO_CIRCLE;
+    mLegs.clear();
+
+    for ( int k=0; k<=K; ++k )
+    {
+        // How far the target is on this leg, if it is hit.
+        double tTarget = INF_DIST;
+        double smcx = sx - dst.x;
+        double smcy = sy - dst.y;
+        double hh = dx*smcx + dy*smcy;
+        double disc = hh*hh - (smcx*smcx + smcy*smcy - static_cast<double>(targetR)*targetR);
+        if ( (disc >= 0.0) && (-hh - sqrt(disc) > 0.0) )
+            tTarget = -hh - sqrt(disc);
+
+        double t = tTarget;
+        TileCircle c;
+        if ( ! Hit(sx, sy, dx, dy, on, &t, &c) )
+        {
+            if ( (k < K) || (tTarget >= INF_DIST) )
+                return false;  // Escaped, or the target is hit too early
+
+            *ray = Ray( src, Vector(cos(angle), sin(angle)) );
+            for ( unsigned int i=0; i<mLegs.size(); i+=4 )
+            {
+                ray->Propagate(Point(mLegs[i], mLegs[i+1]));
+                ray->SetDir(Vector(mLegs[i+2], mLegs[i+3]));
+            }
+            ray->Propagate(Point(sx + tTarget*dx, sy + tTarget*dy));
+            return true;
+        }
+
+        if ( k == K )
+            return false;
+
+        // Reflect: r = Dir - 2(n.Dir)n
+        double px = sx + t*dx;
+        double py = sy + t*dy;
+        double nx = (px - c.x) / c.r;
+        double ny = (py - c.y) / c.r;
+        double ndot = 2.0 * (nx*dx + ny*dy);
+        dx -= ndot * nx;
+        dy -= ndot * ny;
+        double len = hypot(dx, dy);
+        dx /= len;
+        dy /= len;
+        sx = px;
+        sy = py;
+        on = c.id;
+
+        mLegs.push_back(px);
+        mLegs.push_back(py);
+        mLegs.push_back(dx);
+        mLegs.push_back(dy);
+    }
+    return false;
+}
+
+
+/******************************* RunTiledSearch *******************************/
+
+int RunTiledSearch( const TiledOptions& opts )
+{
+    std::stringstream errSStr;
+    TileCache cache;
+    if ( ! cache.Open(opts.sceneFile.c_str(),
+                      static_cast<quint64>(opts.cacheMb) << 20, errSStr) )
+    {
+        std::cerr << errSStr.str() << std::endl;
+        return 1;
+    }
+
+    const TilesHeader& h = cache.Header();
+    const int K = (opts.K >= 0)? opts.K : std::max(h.K, 0);
+    if ( ! h.hasA || ! h.hasB )
+    {
+        std::cerr << "Point A or B is missing." << std::endl;
+        return 1;
+    }
+    const Point A(h.ax, h.ay), B(h.bx, h.by);
+
+    QElapsedTimer timer;
+    timer.start();
+
+    TiledTracer tracer(&cache);
+    SolutionArena solutions;
+    unsigned long long random = opts.seed * 2685821657736338717ULL + 1;
+    float targetR = MIN_TARGET_SIZE;
+    unsigned long numRays = 0;
+
+    try
+    {
+        for ( float r=MIN_TARGET_SIZE; solutions.Empty() && (r <= MAX_TARGET_SIZE);
+              r += INC_TARGET_SIZE )
+        {
+            targetR = r;  // Bigger target is easier to hit.
+            for ( unsigned long i=0; i<opts.numRays; ++i )
+            {
+                // xorshift64*, in [0, 1)
+                random ^= random >> 12;
+                random ^= random << 25;
+                random ^= random >> 27;
+                float angle = ((random * 2685821657736338717ULL) >> 40) *
+                              (2.0f * M_PI / 16777216.0f);
+
+                Ray r;
+                if ( tracer.Trace(A, angle, K, B, targetR, &r) )
+                    solutions.Add(r);
+            }
+            numRays += opts.numRays;
+        }
+    }
+    catch ( const std::runtime_error& e )
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+
+    std::cerr << h.numCircles << " circles in " << h.cols << " x " << h.rows
+              << " tiles, " << numRays << " rays traced in " << timer.elapsed()
+              << " ms, " << solutions.Size() << " solutions; tiles mapped "
+              << cache.NumMisses() << " times (" << cache.NumHits() << " hits, "
+              << cache.NumEvicted() << " evicted), at most "
+              << (cache.PeakBytes() >> 10) << " KB" << std::endl;
+
+    std::ofstream outFile;
+    if ( ! opts.outputFile.empty() )
+    {
+        outFile.open(opts.outputFile.c_str(), std::ios::out);
+        if ( ! outFile.is_open() )
+            std::cerr << "Unable to open the output file '" << opts.outputFile
+                      << "'" << std::endl;
+    }
+    std::ostream& out = outFile.is_open()? outFile : std::cout;
+
+    out << std::setprecision(9);
+    out << "# A " << A.x << " " << A.y << " B " << B.x << " " << B.y << " K " << K
+        << " : " << solutions.Size() << " solutions, target radius "
+        << targetR << std::endl;
+    for ( unsigned int s=0; s<solutions.Size(); ++s )
+    {
+        const SolutionRecord& rec = solutions.Record(s);
+        const TracePoint* points = solutions.Points(s);
+
+        out << rec.launchAngle << " " << rec.pathLength << " " << rec.length;
+        for ( unsigned int i=0; i<rec.length; ++i )
+            out << " " << points[i].x << " " << points[i].y;
+        out << std::endl;
+    }
+
+    return 0;
+}
+
+}  // namespace
@@ -0,0 +1,178 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef TILES_H
+#define TILES_H
+
+#include <vector>
+#include <list>
+#include <string>
+#include <sstream>
+
+#include "qglobal.h"
+#include <QFile>
+
+#include "geometry.h"
+
+
+namespace circles
+{
+
+extern const char         TILES_MAGIC[8];
+extern const unsigned int TILE_CIRCLES;
+extern const int          TILE_PREFETCH;
+extern const unsigned int TILE_CACHE_MB;
+
+
+/******************************** Tiled scene *********************************/
+
+/* A scene file for scenes, which don't fit in memory. The bounding box of the
+ * scene is cut in square tiles of about TILE_CIRCLES circles, and the circles
+ * of each tile are stored together, so a tile is read with one mapping. A
+ * circle is stored in every tile its bounding box overlaps. The file is
+ * TilesHeader, then uint64 cols*rows+1 indexes of the first circle of each tile
+ * (and of the end), then the TileCircle-s (native byte order). */
+struct TilesHeader
+{
+    char    magic[8];  // TILES_MAGIC
+    qint32  K;
+    qint32  hasA;
+    float   ax, ay;
+    qint32  hasB;
+    float   bx, by;
+    float   x0, y0;    // Top left corner of the tiles
+    float   tileSize;
+    qint32  cols;
+    qint32  rows;
+    float   maxR;
+    qint32  reserved;
+    quint64 numCircles;  // Distinct
+    quint64 numRecords;  // With the copies in more tiles
+};
+
+
+struct TileCircle
+{
+    float   x, y, r;
+    quint32 id;  // Index of the circle in the binary scene
+};
+
+
+// Makes a tiled scene of a binary scene (see WriteSceneBinary()). Both files
+// are streamed, so the memory taken is only in proportion to the number of
+// tiles.
+bool WriteTiledScene(const char* sceneFile, const char* tilesFile,
+                     std::stringstream& errSStr);
+
+
+/********************************* TileCache **********************************/
+
+/* Maps the tiles of a tiled scene file into memory on demand. The mapped
+ * tiles are kept up to a limit of bytes, above which the least recently used
+ * ones are unmapped. Tiles asked for in advance are mapped and the OS is told
+ * to read them, without waiting. Not thread safe - use one per thread. The
+ * mappings of the same file share the OS page cache. */
+class TileCache
+{
+  public:
+    TileCache();
+    ~TileCache();
+
+    bool Open(const char* fileName, quint64 maxBytes, std::stringstream& errSStr);
+
+    const TilesHeader& Header() const { return mHeader; }
+
+    // The circles of the tile, NULL if it is empty. Valid until more than
+    // TILE_PREFETCH other tiles are asked for.
+    const TileCircle* Tile(int tile, unsigned int* count);
+
+    // The tile will be needed soon.
+    void Prefetch(int tile);
+
+    unsigned long NumHits() const { return mNumHits; }
+    unsigned long NumMisses() const { return mNumMisses; }
+    unsigned long NumEvicted() const { return mNumEvicted; }
+    quint64 PeakBytes() const { return mPeakBytes; }
+
+  private:
+    struct Entry
+    {
+        Entry() : data(NULL), lru() {}
+
+        uchar*                   data;  // NULL if not mapped
+        std::list<int>::iterator lru;
+    };
+
+    quint64 Bytes(int tile) const;
+    void Map(int tile);
+    void Evict();
+
+    QFile               mFile;
+    TilesHeader         mHeader;
+    qint64              mRecordsAt;  // Offset of the first TileCircle
+    std::vector<quint64> mIndex;
+    std::vector<Entry>  mTiles;
+    std::list<int>      mLru;        // Mapped tiles, the most recent first
+    quint64             mMaxBytes;
+    quint64             mBytes;      // Mapped
+    quint64             mPeakBytes;
+    unsigned long       mNumHits;
+    unsigned long       mNumMisses;
+    unsigned long       mNumEvicted;
+
+    TileCache(const TileCache&);
+    TileCache& operator=(const TileCache&);
+};
+
+
+/******************************** TiledTracer *********************************/
+
+/* Traces rays through a tiled scene, walking the tiles along each leg (like a
+ * grid DDA) and testing only the circles of the tiles on the way. The next
+ * TILE_PREFETCH tiles of the leg are prefetched. So the memory follows the
+ * tiles the rays go through, not the size of the scene. */
+class TiledTracer
+{
+  public:
+    explicit TiledTracer(TileCache* cache);
+
+    // Returns true if the ray from src at the angle hits the target circle
+    // around dst after exactly K reflections. Then the ray gets its trace.
+    bool Trace(const Point& src, float angle, int K, const Point& dst,
+               float targetR, Ray* ray);
+
+  private:
+    // The nearest circle hit by the leg, other than skip, or false.
+    bool Hit(double sx, double sy, double dx, double dy, quint32 skip,
+             double* t, TileCircle* hit);
+
+    TileCache*          mCache;
+    std::vector<double> mLegs;  // x, y of each reflection point
+};
+
+
+/******************************* RunTiledSearch *******************************/
+
+struct TiledOptions
+{
+    TiledOptions() : sceneFile(), K(-1), numRays(1000000), seed(1),
+                     cacheMb(TILE_CACHE_MB), outputFile() {}
+
+    std::string   sceneFile;
+    int           K;        // -1 for the one in the file
+    unsigned long numRays;  // Per target size
+    unsigned int  seed;
+    unsigned int  cacheMb;  // Of mapped tiles
+    std::string   outputFile;  // Empty for stdout
+};
+
+
+/* Searches the solutions from A to B of a tiled scene with random rays, like
+ * --batch does, growing the target around B until some are found. They are
+ * written as: <launch angle> <path length> <number of points> <x y>* */
+int RunTiledSearch(const TiledOptions& opts);
+
+}  // namespace
+
+#endif // TILES_H
@@ -0,0 +1,377 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <QElapsedTimer>
+#include <QMutexLocker>
+#include "tracker.h"
+#include "renderer.h"
+
+
+namespace circles
+{
+
+const int   LIVE_FRAME_MS      = 16;       // Time budget for one update
+const int   LIVE_POLISH_STEPS  = 4;        // Secant steps per solution per frame
+const int   LIVE_SEARCH_EVERY  = 8;        // Search for new paths every N frames
+const int   LIVE_IDLE_FRAMES   = 60;       // Keep searching after the last edit
+const int   LIVE_SEARCH_BATCH  = 64;       // Random rays between budget checks
+const float LIVE_ANGLE_STEP    = 1.0e-4f;  // Initial secant step in radians
+const float LIVE_MAX_STEP      = 0.05f;    // Don't jump to another path
+const float LIVE_SAME_ANGLE    = 1.0e-3f;  // Launch angles of the same path
+
+
+// Difference of two angles, wrapped in [-PI, PI].
+static inline float AngleDiff( float a, float b )
+{
+    return remainder(a - b, 2.0f * static_cast<float>(M_PI));
+}
+
+
+LiveTracker::LiveTracker() :
+        mStop(false),
+        mDirty(false),
+        mNewScene(false),
+        mPending(),
+        mPendingK(0),
+        mSeeds(),
+        mSeeded(false),
+        mSnapshot(),
+        mScene(),
+        mA(NULL),
+        mB(NULL),
+        mTarget(NULL),
+        mMinTargetSize(0.0f),
+        mMaxTargetSize(0.0f),
+        mK(0),
+        mTracks(),
+        mNext(0),
+        mRng(12345)
+{
+}
+
+
+LiveTracker::~LiveTracker()
+{
+    Stop();
+
+    ClearScene();
+}
+
+
+void LiveTracker::UpdateScene( const SnapshotPtr& snapshot, int K )
+{
+    QMutexLocker lock(&mMutex);
+
+    // Replaces the previous edit if the tracker didn't pick it up yet.
+    mPending = snapshot;
+    mPendingK = K;
+    mNewScene = true;
+    mDirty = true;
+    mWake.wakeAll();
+}
+
+
+void LiveTracker::Seed( const SolutionLog& solutions )
+{
+    QMutexLocker lock(&mMutex);
+
+    mSeeds.clear();
+    for ( unsigned int i=0; i<solutions.Size(); ++i )
+    {
+        mSeeds.push_back(solutions.Record(i).launchAngle);
+    }
+
+    mSeeded = true;
+    mDirty = true;
+    mWake.wakeAll();
+}
+
+
+void LiveTracker::Stop()
+{
+    // Set under the lock, so the thread can't miss it before waiting.
+    mMutex.lock();
+    mStop = true;
+    mWake.wakeAll();
+    mMutex.unlock();
+
+    wait();
+}
+
+
+void LiveTracker::ClearScene()
+{
+    delete mTarget;  // The rest belong to the snapshot.
+    mTarget = NULL;
+    mScene.clear();
+    mSnapshot.clear();
+    mA = mB = NULL;
+}
+
+
+bool LiveTracker::TakePendingScene()
+{
+    QMutexLocker lock(&mMutex);
+
+    if ( ! mDirty )
+        return false;
+
+    if ( mNewScene )
+    {
+        ClearScene();
+        mSnapshot = mPending;
+        mPending.clear();
+        mScene = mSnapshot->Figures();
+        mA = mSnapshot->A();
+        mB = mSnapshot->B();
+        mK = mPendingK;
+        mNewScene = false;
+
+        // The hits index the old figures. Only the angles are kept, until
+        // the tracks are polished in this scene.
+        for ( std::vector<Track>::iterator t=mTracks.begin(); t != mTracks.end(); ++t )
+        {
+            t->ray = Ray();
+            t->traced = false;
+            t->hits.clear();
+        }
+    }
+
+    if ( mSeeded )
+    {
+        mTracks.clear();
+        for ( std::vector<float>::const_iterator a=mSeeds.begin();
+              a != mSeeds.end(); ++a )
+        {
+            Track t = { *a, Ray(), true, false, std::vector<unsigned int>() };
+            mTracks.push_back(t);
+        }
+        mSeeds.clear();
+        mSeeded = false;
+        mNext = 0;
+    }
+
+    mDirty = false;
+    lock.unlock();
+
+    if ( (NULL != mA) && (NULL != mB) && (NULL == mTarget) )
+    {
+        TargetSizeRange(mScene, mB, &mMinTargetSize, &mMaxTargetSize);
+        mTarget = new Circle(*mB, mMinTargetSize);
+        mScene.push_back(mTarget);
+    }
+
+    return true;
+}
+
+
+float LiveTracker::Miss( float angle ) const
+{
+    Ray r( *mA, Vector(cos(angle), sin(angle)) );
+
+    for ( int k=0; k<mK; ++k )
+    {
+        float dist, minDist=INF_DIST;
+        const Figure* firstHit=NULL;
+
+        for ( std::vector<Figure*>::const_iterator fig = mScene.begin();
+              fig != mScene.end(); ++fig )
+        {
+            if ( (*fig == mA) || (*fig == mB) || (*fig == mTarget) ||
+                 (*fig == r.OnFig()) )
+                continue;
+
+            if ( (*fig)->Intersect(&r, &dist) && (dist < minDist) )
+            {
+                minDist = dist;
+                firstHit = *fig;
+            }
+        }
+
+        if ( NULL == firstHit )
+            return INF_DIST;
+
+        firstHit->Reflect(&r);
+    }
+
+    Vector toB( r.GetSrc(), *mB );
+    if ( toB.ScalarProduct(r.GetDir()) <= 0.0f )
+        return INF_DIST;
+
+    return ( r.GetDir().GetX() * toB.GetY() - r.GetDir().GetY() * toB.GetX() );
+}
+
+
+bool LiveTracker::Polish( float* angle, Ray* ray, std::vector<unsigned int>* hits ) const
+{
+    float a0 = *angle;
+    float f0 = Miss(a0);
+
+    if ( f0 != INF_DIST )
+    {
+        float a1 = a0 + LIVE_ANGLE_STEP;
+        float f1 = Miss(a1);
+
+        for ( int i=0; (i < LIVE_POLISH_STEPS) && (f1 != INF_DIST) &&
+                       (fabs(f1) > EPSILON) && (f1 != f0); ++i )
+        {
+            float step = - f1 * (a1 - a0) / (f1 - f0);
+            if ( step > LIVE_MAX_STEP ) step = LIVE_MAX_STEP;
+            if ( step < -LIVE_MAX_STEP ) step = -LIVE_MAX_STEP;
+
+            a0 = a1;
+            f0 = f1;
+            a1 += step;
+            f1 = Miss(a1);
+        }
+
+        // Keep the best finite estimate.
+        if ( (f1 != INF_DIST) && (fabs(f1) < fabs(f0)) )
+            a0 = a1;
+    }
+
+    // Validate it the same way as the rendering thread does.
+    Ray r( *mA, Vector(cos(a0), sin(a0)) );
+    std::vector<unsigned int> h;
+    if ( RayTrace(mScene, mA, &r, mTarget, mK, &h) )
+    {
+        *angle = a0;
+        *ray = r;
+        hits->swap(h);
+        return true;
+    }
+
+    return false;
+}
+
+
+bool LiveTracker::Known( float angle ) const
+{
+    for ( std::vector<Track>::const_iterator t=mTracks.begin();
+          t != mTracks.end(); ++t )
+    {
+        if ( fabs(AngleDiff(t->angle, angle)) < LIVE_SAME_ANGLE )
+            return true;
+    }
+    return false;
+}
+
+
+void LiveTracker::RunFrame( bool search )
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    SolutionLogPtr rays(new SolutionLog(mSnapshot, mK));
+
+    if ( (NULL == mA) || (NULL == mB) || (NULL == mTarget) )
+    {
+        mTracks.clear();
+        Q_EMIT sendLiveRays(rays);
+        return;
+    }
+
+    // Re-polish in round-robin order, so a long list is refreshed over several
+    // frames, without exceeding the frame budget.
+    unsigned int n = mTracks.size();
+    unsigned int i;
+    for ( i=0; (i < n) && (timer.elapsed() < LIVE_FRAME_MS); ++i )
+    {
+        Track& t = mTracks[(mNext + i) % n];
+        t.valid = Polish(&t.angle, &t.ray, &t.hits);
+        t.traced = t.valid;
+    }
+    mNext = (n > 0)? (mNext + i) % n : 0;
+
+    // Drop the paths, which became invalid, and the ones merged with another.
+    for ( unsigned int j=0; j<mTracks.size(); )
+    {
+        bool same = ! mTracks[j].valid;
+        for ( unsigned int k=0; k<j; ++k )
+        {
+            if ( fabs(AngleDiff(mTracks[j].angle, mTracks[k].angle)) < LIVE_SAME_ANGLE )
+            {
+                same = true;
+                break;
+            }
+        }
+
+        if ( same )
+            mTracks.erase(mTracks.begin() + j);
+        else
+            ++j;
+    }
+
+    if ( search )
+    {
+        // Spend the rest of the frame on random rays. A bigger target is easier
+        // to hit; the hits are polished and validated with the small one.
+        std::uniform_real_distribution<float> uniformAngle(-M_PI, M_PI);
+
+        while ( timer.elapsed() < LIVE_FRAME_MS )
+        {
+            for ( int b=0; b<LIVE_SEARCH_BATCH; ++b )
+            {
+                float angle = uniformAngle(mRng);
+                Ray r( *mA, Vector(cos(angle), sin(angle)) );
+
+                mTarget->R = mMaxTargetSize;
+                bool hit = RayTrace(mScene, mA, &r, mTarget, mK);
+                mTarget->R = mMinTargetSize;
+
+                std::vector<unsigned int> hits;
+                if ( hit && Polish(&angle, &r, &hits) && (! Known(angle)) )
+                {
+                    Track t = { angle, r, true, true, hits };
+                    mTracks.push_back(t);
+                }
+            }
+        }
+    }
+
+    for ( std::vector<Track>::const_iterator t=mTracks.begin();
+          t != mTracks.end(); ++t )
+    {
+        if ( t->traced && (t->ray.GetNumberOfReflections() > 0) )
+            rays->Add(t->ray, t->angle, t->hits);
+    }
+
+    Q_EMIT sendLiveRays(rays);
+}
+
+
+void LiveTracker::run()
+{
+    unsigned long frame = 0;
+    int idleFrames = LIVE_IDLE_FRAMES;
+
+    for ( ;; )
+    {
+        {
+            QMutexLocker lock(&mMutex);
+            if ( (! mStop) && (! mDirty) && (idleFrames >= LIVE_IDLE_FRAMES) )
+                mWake.wait(&mMutex);  // Sleep until the next edit.
+            if ( mStop )
+                break;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+
+        if ( TakePendingScene() )
+            idleFrames = 0;
+        else
+            ++idleFrames;
+
+        RunFrame( (0 == frame % LIVE_SEARCH_EVERY) || (idleFrames > 0) );
+        ++frame;
+
+        // Keep the update rate at one frame per budget, unless there is an edit.
+        QMutexLocker lock(&mMutex);
+        if ( (! mStop) && (! mDirty) && (timer.elapsed() < LIVE_FRAME_MS) )
+            mWake.wait(&mMutex, LIVE_FRAME_MS - timer.elapsed());
+    }
+}
+
+}  // namespace
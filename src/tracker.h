@@ -0,0 +1,111 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef TRACKER_H
+#define TRACKER_H
+
+#include <vector>
+#include <random>
+
+#include "qglobal.h"
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "geometry.h"
+#include "solutions.h"
+#include "snapshot.h"
+
+
+namespace circles
+{
+
+extern const int   LIVE_FRAME_MS;
+extern const int   LIVE_POLISH_STEPS;
+extern const int   LIVE_SEARCH_EVERY;
+extern const int   LIVE_IDLE_FRAMES;
+
+
+/******************************** LiveTracker *********************************/
+
+/* Follows the known solutions while the scene is being edited. Each frame the
+ * latest scene is picked up, every solution is re-polished starting from its
+ * previous launch angle, and the ones, which don't reach B any more, are
+ * dropped. From time to time the rest of the frame is spent searching for new
+ * solutions with random rays. */
+class LiveTracker : public QThread
+{
+    Q_OBJECT
+
+  public:
+    LiveTracker();
+    ~LiveTracker();
+
+    // Called by the GUI after every edit, with a new snapshot.
+    void UpdateScene(const SnapshotPtr& snapshot, int K);
+
+    // Replaces the tracked solutions with the launch angles of these ones.
+    void Seed(const SolutionLog& solutions);
+
+    // Asks the thread to finish and waits for it.
+    void Stop();
+
+    void run();
+
+  Q_SIGNALS:
+    void sendLiveRays(SolutionLogPtr rays);
+
+  private:
+    struct Track
+    {
+        float angle;  // Launch angle from A
+        Ray   ray;    // The last valid trace
+        bool  valid;  // False once the path is lost
+        bool  traced; // The ray and hits are of the current scene
+        std::vector<unsigned int> hits;  // Of the ray, see RayTrace()
+    };
+
+    bool TakePendingScene();
+    void ClearScene();
+    void RunFrame(bool search);
+
+    // Signed distance from B to the last leg of a ray, launched from A at the
+    // given angle and reflected K times. Returns INF_DIST if it can't reflect
+    // K times or B is behind the last leg.
+    float Miss(float angle) const;
+
+    // Moves the angle towards B with a few secant steps. Returns true and the
+    // trace if the polished ray hits the target after K reflections.
+    bool Polish(float* angle, Ray* ray, std::vector<unsigned int>* hits) const;
+
+    bool Known(float angle) const;
+
+    // Shared with the GUI thread, protected by mMutex.
+    QMutex                mMutex;
+    QWaitCondition        mWake;
+    bool                  mStop;       // Set once by Stop()
+    bool                  mDirty;      // A new scene or new seeds are pending
+    bool                  mNewScene;
+    SnapshotPtr           mPending;
+    int                   mPendingK;
+    std::vector<float>    mSeeds;
+    bool                  mSeeded;
+
+    // Used only by the tracking thread.
+    SnapshotPtr           mSnapshot;
+    std::vector<Figure*>  mScene;      // The snapshot's figures and the target
+    const Point*          mA;
+    const Point*          mB;
+    Circle*               mTarget;
+    float                 mMinTargetSize;  // Used for polishing
+    float                 mMaxTargetSize;  // Used for searching
+    int                   mK;
+    std::vector<Track>    mTracks;
+    unsigned int          mNext;       // Round-robin start for polishing
+    std::minstd_rand      mRng;
+};
+
+}  // namespace
+
+#endif // TRACKER_H
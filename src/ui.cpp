@@ -3,6 +3,8 @@
  ******************************************************************************/
 
 #include "ui.h"
+#include "export.h"
+#include "jobs.h"
 
 
 namespace circles
@@ -59,12 +61,18 @@ void ReflectiveCirclesUI::SetupUi()
     mRBCircle->setObjectName(QString::fromUtf8("mRBCircle"));
     mRBCircle->setGeometry(QRect(20, 105, 160, 21));
     mRBCircle->setText(QString::fromUtf8("Circle (press and drag)"));
+
+    mRBMove = new QRadioButton(mCentralWidget);
+    mRBMove->setObjectName(QString::fromUtf8("mRBMove"));
+    mRBMove->setGeometry(QRect(20, 130, 160, 21));
+    mRBMove->setText(QString::fromUtf8("Move (drag a figure)"));
     
     mRBGroup = new QButtonGroup(this);
     mRBGroup->setObjectName(QString::fromUtf8("mRBGroup"));
     mRBGroup->addButton(mRBPointA);
     mRBGroup->addButton(mRBPointB);
     mRBGroup->addButton(mRBCircle);
+    mRBGroup->addButton(mRBMove);
 
     mKSpinBox = new QSpinBox(this);
     mKSpinBox->setObjectName(QString::fromUtf8("mKSpinBox"));
@@ -92,6 +100,16 @@ void ReflectiveCirclesUI::SetupUi()
     mClearButton->setGeometry(QRect(20, 370, 93, 28));
     mClearButton->setText(QString::fromUtf8("Reset"));
 
+    mProgressBar = new QProgressBar(mCentralWidget);
+    mProgressBar->setObjectName(QString::fromUtf8("mProgressBar"));
+    mProgressBar->setGeometry(QRect(20, 410, 160, 16));
+    mProgressBar->setRange(0, 100);
+    mProgressBar->reset();
+
+    mEtaLabel = new QLabel(mCentralWidget);
+    mEtaLabel->setObjectName(QString::fromUtf8("mEtaLabel"));
+    mEtaLabel->setGeometry(QRect(20, 428, 160, 16));
+
     mOptionsLabel = new QLabel(mCentralWidget);
     mOptionsLabel->setObjectName(QString::fromUtf8("mOptionsLabel"));
     mOptionsLabel->setGeometry(QRect(20, 450, 50, 16));
@@ -108,6 +126,21 @@ void ReflectiveCirclesUI::SetupUi()
     mMinRLabel->setGeometry(QRect(85, 482, 160, 16));
     mMinRLabel->setText(QString::fromUtf8("Min circle radius"));
 
+    mLiveCheckBox = new QCheckBox(mCentralWidget);
+    mLiveCheckBox->setObjectName(QString::fromUtf8("mLiveCheckBox"));
+    mLiveCheckBox->setGeometry(QRect(20, 540, 160, 21));
+    mLiveCheckBox->setText(QString::fromUtf8("Live tracking"));
+
+    mDensityCheckBox = new QCheckBox(mCentralWidget);
+    mDensityCheckBox->setObjectName(QString::fromUtf8("mDensityCheckBox"));
+    mDensityCheckBox->setGeometry(QRect(20, 565, 160, 21));
+    mDensityCheckBox->setText(QString::fromUtf8("Light density map"));
+
+    mHeatmapCheckBox = new QCheckBox(mCentralWidget);
+    mHeatmapCheckBox->setObjectName(QString::fromUtf8("mHeatmapCheckBox"));
+    mHeatmapCheckBox->setGeometry(QRect(20, 590, 160, 21));
+    mHeatmapCheckBox->setText(QString::fromUtf8("Figure heatmap"));
+
     this->setCentralWidget(mCentralWidget);
 
     mMenuBar = new QMenuBar(this);
@@ -126,6 +159,41 @@ void ReflectiveCirclesUI::CreateActions()
 
     mFileSave = new QAction(tr("&Save"), this);
     connect(mFileSave, SIGNAL(triggered()), this, SLOT(SaveScene()));
+
+    mFileStream = new QAction(tr("Stream S&olutions..."), this);
+    mFileStream->setCheckable(true);
+    connect(mFileStream, SIGNAL(toggled(bool)), this, SLOT(StreamSolutions(bool)));
+
+    mFileExport = new QAction(tr("&Export Image..."), this);
+    connect(mFileExport, SIGNAL(triggered()), this, SLOT(ExportImage()));
+
+    mSearchBudget = new QAction(tr("&Budget..."), this);
+    connect(mSearchBudget, SIGNAL(triggered()), this, SLOT(SetBudget()));
+
+    mSearchModes = new QActionGroup(this);
+    connect(mSearchModes, SIGNAL(triggered(QAction*)), this, SLOT(SetSearchMode(QAction*)));
+
+    mSearchRays = new QAction(tr("&Random Rays"), mSearchModes);
+    mSearchRays->setCheckable(true);
+    mSearchRays->setChecked(true);
+
+    mSearchLatency = new QAction(tr("&Latency First"), mSearchModes);
+    mSearchLatency->setCheckable(true);
+
+    mSearchBeams = new QAction(tr("B&eam Tracing"), mSearchModes);
+    mSearchBeams->setCheckable(true);
+
+    mSearchQueue = new QAction(tr("&Queue Jobs..."), this);
+    connect(mSearchQueue, SIGNAL(triggered()), this, SLOT(QueueJobs()));
+
+    mJobsCancelAll = new QAction(tr("&Cancel All"), this);
+    connect(mJobsCancelAll, SIGNAL(triggered()), this, SLOT(CancelAllJobs()));
+
+    mViewFit = new QAction(tr("&Fit Scene"), this);
+    connect(mViewFit, SIGNAL(triggered()), this, SLOT(FitView()));
+
+    mViewReset = new QAction(tr("&Actual Size"), this);
+    connect(mViewReset, SIGNAL(triggered()), this, SLOT(ResetView()));
 }
 
 
@@ -135,24 +203,40 @@ void ReflectiveCirclesUI::CreateMenus()
 
     mFileMenu->addAction(mFileOpen);
     mFileMenu->addAction(mFileSave);
+    mFileMenu->addSeparator();
+    mFileMenu->addAction(mFileStream);
+    mFileMenu->addAction(mFileExport);
 
     menuBar()->addMenu(mFileMenu);
+
+    mSearchMenu = new QMenu(tr("&Search"), this);
+    mSearchMenu->addAction(mSearchBudget);
+    mSearchMenu->addSeparator();
+    mSearchMenu->addActions(mSearchModes->actions());
+    mSearchMenu->addSeparator();
+    mSearchMenu->addAction(mSearchQueue);
+    menuBar()->addMenu(mSearchMenu);
+
+    // Filled in when shown.
+    mJobsMenu = new QMenu(tr("&Jobs"), this);
+    connect(mJobsMenu, SIGNAL(aboutToShow()), this, SLOT(ShowJobs()));
+    connect(mJobsMenu, SIGNAL(triggered(QAction*)), this, SLOT(CancelJob(QAction*)));
+    menuBar()->addMenu(mJobsMenu);
+
+    mViewMenu = new QMenu(tr("&View"), this);
+    mViewMenu->addAction(mViewFit);
+    mViewMenu->addAction(mViewReset);
+    menuBar()->addMenu(mViewMenu);
 }
 
 
 void ReflectiveCirclesUI::LoadScene()
 {
-    if ( mRenderFrame->RenderingInProgress() )
-    {
-        QMessageBox::warning(this, "ERROR", "Rendering is in progress");
-        return;
-    }
-
     QString fileName = QFileDialog::getOpenFileName(
         this,
         "Load scene",
         QDir::currentPath(),
-        tr("Scenes (*.txt)") );
+        tr("Scenes (*.txt *.bin)") );
 
     if ( ! fileName.isNull() )
     {
@@ -167,7 +251,7 @@ void ReflectiveCirclesUI::SaveScene()
         this, 
         tr("Save Scene"), 
         QDir::currentPath(), 
-        tr("Scenes (*.txt)") );
+        tr("Scenes (*.txt);;Binary scenes (*.bin)") );
 
     if ( ! fileName.isNull() )
     {
@@ -176,11 +260,254 @@ void ReflectiveCirclesUI::SaveScene()
 }
 
 
+void ReflectiveCirclesUI::StreamSolutions(bool on)
+{
+    // Takes effect from the next render.
+    if ( ! on )
+    {
+        mRenderFrame->SetSolutionsFile("");
+        return;
+    }
+
+    QString fileName = QFileDialog::getSaveFileName(
+        this,
+        tr("Stream Solutions"),
+        QDir::currentPath(),
+        tr("Binary solutions (*.bin);;CSV solutions (*.csv)") );
+
+    if ( fileName.isNull() )
+    {
+        mFileStream->setChecked(false);
+        return;
+    }
+
+    mRenderFrame->SetSolutionsFile(fileName.toStdString());
+}
+
+
+void ReflectiveCirclesUI::ExportImage()
+{
+    QString fileName = QFileDialog::getSaveFileName(
+        this,
+        tr("Export Image"),
+        QDir::currentPath(),
+        tr("PNG images (*.png)") );
+
+    if ( fileName.isNull() )
+        return;
+
+    // The height follows from the scene.
+    bool ok = false;
+    int width = QInputDialog::getInt(this, tr("Export Image"), tr("Width in pixels"),
+                                     16384, 1, EXPORT_MAX_SIZE, 1, &ok);
+    if ( ! ok )
+        return;
+
+    mRenderFrame->ExportImage(fileName.toStdString().c_str(), width);
+}
+
+
+void ReflectiveCirclesUI::SetBudget()
+{
+    // Takes effect from the next render.
+    BudgetOptions budget = mRenderFrame->GetBudget();
+    bool ok = false;
+
+    int seconds = QInputDialog::getInt(this, tr("Search Budget"), tr("Time limit in seconds (0 for none)"),
+                                       budget.maxMs / 1000, 0, 86400, 1, &ok);
+    if ( ! ok )
+        return;
+
+    int paths = QInputDialog::getInt(this, tr("Search Budget"), tr("Stop after this many distinct paths (0 for all)"),
+                                     budget.maxPaths, 0, 1000000, 1, &ok);
+    if ( ! ok )
+        return;
+
+    double confidence = QInputDialog::getDouble(this, tr("Search Budget"),
+                                                tr("Confidence of finding each path, % (0 to trace all rays)"),
+                                                100.0 * budget.confidence, 0.0, 99.99, 2, &ok);
+    if ( ! ok )
+        return;
+
+    int maxRays = QInputDialog::getInt(this, tr("Search Budget"), tr("At most this many rays per target size"),
+                                       budget.maxRays, PACKET_LANES, 2000000000, 1000000, &ok);
+    if ( ! ok )
+        return;
+
+    budget.maxRays = maxRays;
+    budget.maxMs = 1000 * static_cast<qint64>(seconds);
+    budget.maxPaths = paths;
+    budget.confidence = confidence / 100.0;
+    mRenderFrame->SetBudget(budget);
+}
+
+
+void ReflectiveCirclesUI::SetSearchMode(QAction* action)
+{
+    // Takes effect from the next render.
+    if ( action == mSearchLatency )
+        mRenderFrame->SetSearchMode(SM_LATENCY_FIRST);
+    else if ( action == mSearchBeams )
+        mRenderFrame->SetSearchMode(SM_BEAMS);
+    else
+        mRenderFrame->SetSearchMode(SM_RAYS);
+}
+
+
+void ReflectiveCirclesUI::FitView()
+{
+    mRenderFrame->FitView();
+}
+
+
+void ReflectiveCirclesUI::ResetView()
+{
+    mRenderFrame->ResetView();
+}
+
+
+void ReflectiveCirclesUI::QueueJobs()
+{
+    if ( ! mRenderFrame->CheckInput() )
+        return;
+
+    bool ok = false;
+    int firstK = QInputDialog::getInt(this, tr("Queue Jobs"), tr("From reflections"),
+                                      GetK(), 0, 1000, 1, &ok);
+    if ( ! ok )
+        return;
+
+    int lastK = QInputDialog::getInt(this, tr("Queue Jobs"), tr("To reflections"),
+                                     firstK, firstK, 1000, 1, &ok);
+    if ( ! ok )
+        return;
+
+    int priority = QInputDialog::getInt(this, tr("Queue Jobs"),
+                                        tr("Priority (\"Find Path\" has %1)").arg(VIEW_JOB_PRIORITY),
+                                        0, -1000, 1000, 1, &ok);
+    if ( ! ok )
+        return;
+
+    // The jobs are not shown, so their solutions need a file.
+    QString fileName = QFileDialog::getSaveFileName(
+        this,
+        tr("Solutions of the Jobs"),
+        QDir::currentPath(),
+        tr("Binary solutions (*.bin);;CSV solutions (*.csv)") );
+    if ( fileName.isNull() )
+        return;
+
+    // With the current budget and search mode.
+    mRenderFrame->QueueJobs(firstK, lastK, priority, fileName.toStdString());
+}
+
+
+// A line of the "Jobs" menu.
+static QString JobText( const RenderJob& job )
+{
+    QString state;
+    switch ( job.state )
+    {
+      case JS_QUEUED:
+        state = "queued";
+        break;
+      case JS_RUNNING:
+        state = QString("%1% %2 s").arg(job.percent)
+                                   .arg(job.timer.elapsed() / 1000.0, 0, 'f', 1);
+        break;
+      case JS_DONE:
+        state = QString("done %1 s, %2 solutions").arg(job.wallMs / 1000.0, 0, 'f', 1)
+                                                  .arg(job.numSolutions);
+        break;
+      default:
+        state = job.error.empty() ? "cancelled" : "failed";
+        break;
+    }
+
+    return QString("#%1  K=%2  priority %3%4  -  %5")
+               .arg(job.id).arg(job.K).arg(job.priority)
+               .arg(job.toView ? "  (view)" : "").arg(state);
+}
+
+
+void ReflectiveCirclesUI::ShowJobs()
+{
+    mJobsMenu->clear();  // Deletes the job actions
+    mJobActions.clear();
+
+    mJobsMenu->addAction(mJobsCancelAll);
+    mJobsMenu->addSeparator();
+
+    const std::list<RenderJob>& jobs = mRenderFrame->Jobs()->Jobs();
+    for ( std::list<RenderJob>::const_iterator job=jobs.begin(); job != jobs.end(); ++job )
+    {
+        // Clicking a job cancels it.
+        QAction* action = mJobsMenu->addAction(JobText(*job));
+        action->setEnabled((JS_QUEUED == job->state) || (JS_RUNNING == job->state));
+        mJobActions[action] = job->id;
+    }
+}
+
+
+void ReflectiveCirclesUI::CancelJob(QAction* action)
+{
+    std::map<QAction*, int>::const_iterator job = mJobActions.find(action);
+    if ( job != mJobActions.end() )
+        mRenderFrame->Jobs()->Cancel(job->second);
+}
+
+
+void ReflectiveCirclesUI::CancelAllJobs()
+{
+    mRenderFrame->Jobs()->CancelAll();
+}
+
+
+void ReflectiveCirclesUI::UpdateJobs()
+{
+    const RenderQueue* jobs = mRenderFrame->Jobs();
+    statusBar()->showMessage(tr("Jobs: %1 running, %2 queued, %3 workers")
+                                 .arg(jobs->NumRunning()).arg(jobs->NumQueued())
+                                 .arg(jobs->NumWorkers()));
+
+    if ( ! mJobsMenu->isVisible() )
+        return;
+
+    for ( std::map<QAction*, int>::const_iterator action=mJobActions.begin();
+          action != mJobActions.end(); ++action )
+    {
+        const RenderJob* job = jobs->Job(action->second);
+        if ( NULL == job )
+            continue;
+        action->first->setText(JobText(*job));
+        action->first->setEnabled((JS_QUEUED == job->state) || (JS_RUNNING == job->state));
+    }
+}
+
+
+void ReflectiveCirclesUI::SetProgress(int percent, int etaMs)
+{
+    if ( percent < 0 )
+    {
+        mProgressBar->reset();
+        mEtaLabel->clear();
+        return;
+    }
+
+    mProgressBar->setValue(percent);
+    if ( etaMs < 0 )
+        mEtaLabel->setText(tr("ETA unknown"));
+    else
+        mEtaLabel->setText(tr("ETA %1 s").arg(etaMs / 1000.0, 0, 'f', 1));
+}
+
+
 void ReflectiveCirclesUI::on_mRenderButton_clicked()
 {
-    if ( mRenderFrame->RenderingInProgress() )
+    if ( mDensityCheckBox->isChecked() )
     {
-        QMessageBox::warning(this, "ERROR", "Rendering is in progress");
+        // Only A is needed. K limits the reflections.
+        mRenderFrame->RenderDensity();
         return;
     }
 
@@ -190,7 +517,7 @@ void ReflectiveCirclesUI::on_mRenderButton_clicked()
 
     // TODO: Disable scene controls? Need to re-enable them in render finish callback...
 
-    // Render scene
+    // Render scene, or queue it after the running one
     mRenderFrame->Render();
 }
 
@@ -210,24 +537,39 @@ void ReflectiveCirclesUI::on_mStopButton_clicked()
 
 void ReflectiveCirclesUI::on_mClearButton_clicked()
 {
-    if ( mRenderFrame->RenderingInProgress() )
-    {
-        QMessageBox::warning(this, "ERROR", "Rendering is in progress");
-        return;
-    }
-
     mRenderFrame->Reset();
 
     mRenderFrame->update();
 }
 
 
+void ReflectiveCirclesUI::on_mKSpinBox_valueChanged(int k)
+{
+    Q_UNUSED(k);
+    mRenderFrame->NotifyLiveTracker();
+}
+
+
+void ReflectiveCirclesUI::on_mLiveCheckBox_toggled(bool on)
+{
+    mRenderFrame->SetLiveTracking(on);
+}
+
+
+void ReflectiveCirclesUI::on_mHeatmapCheckBox_toggled(bool on)
+{
+    mRenderFrame->SetHeatmap(on);
+}
+
+
 DrawingMode ReflectiveCirclesUI::GetDrawingMode() const
 {
     if ( mRBPointA->isChecked() )
         return DM_POINTA;
     else if ( mRBPointB->isChecked() )
         return DM_POINTB;
+    else if ( mRBMove->isChecked() )
+        return DM_MOVE;
     else
         return DM_CIRCLE;
 }
@@ -13,6 +13,8 @@
     #include <QtGui>
 #endif  // QT_VERSION
 
+#include <map>
+
 #include "renderer.h"
 
 
@@ -22,7 +24,8 @@ namespace circles
 typedef enum {
     DM_POINTA,
     DM_POINTB,
-    DM_CIRCLE
+    DM_CIRCLE,
+    DM_MOVE
 } DrawingMode;
 
 
@@ -40,13 +43,32 @@ class ReflectiveCirclesUI : public QMainWindow
     int GetMinR() const;
     int GetRenderHeight() const;
     int GetRenderWidth() const;
+    // Percent of the search done and the estimated time left, -1 if not
+    // known. A negative percent clears the progress.
+    void SetProgress(int percent, int etaMs);
+    // Shows the number of jobs running and queued, and their state in the
+    // "Jobs" menu if it is open.
+    void UpdateJobs();
 
   private slots:
     void on_mRenderButton_clicked();
     void on_mStopButton_clicked();
     void on_mClearButton_clicked();
+    void on_mKSpinBox_valueChanged(int k);
+    void on_mLiveCheckBox_toggled(bool on);
+    void on_mHeatmapCheckBox_toggled(bool on);
     void LoadScene();
     void SaveScene();
+    void StreamSolutions(bool on);
+    void ExportImage();
+    void SetBudget();
+    void SetSearchMode(QAction* action);
+    void FitView();
+    void ResetView();
+    void QueueJobs();
+    void ShowJobs();
+    void CancelJob(QAction* action);
+    void CancelAllJobs();
 
   private:
     void SetupUi();
@@ -60,19 +82,40 @@ class ReflectiveCirclesUI : public QMainWindow
     QRadioButton   *mRBPointA;
     QRadioButton   *mRBPointB;
     QRadioButton   *mRBCircle;
+    QRadioButton   *mRBMove;
     QButtonGroup   *mRBGroup;
     QSpinBox       *mKSpinBox;
     QLabel         *mKLabel;
     QPushButton    *mRenderButton;
     QPushButton    *mStopButton;
     QPushButton    *mClearButton;
+    QProgressBar   *mProgressBar;
+    QLabel         *mEtaLabel;
     QLabel         *mOptionsLabel;
     QSpinBox       *mMinRSpinBox;
     QLabel         *mMinRLabel;
+    QCheckBox      *mLiveCheckBox;
+    QCheckBox      *mDensityCheckBox;
+    QCheckBox      *mHeatmapCheckBox;
     QMenuBar       *mMenuBar;
     QMenu          *mFileMenu;
     QAction        *mFileOpen;
     QAction        *mFileSave;
+    QAction        *mFileStream;
+    QAction        *mFileExport;
+    QMenu          *mSearchMenu;
+    QAction        *mSearchBudget;
+    QActionGroup   *mSearchModes;
+    QAction        *mSearchRays;
+    QAction        *mSearchLatency;
+    QAction        *mSearchBeams;
+    QMenu          *mViewMenu;
+    QAction        *mViewFit;
+    QAction        *mViewReset;
+    QAction        *mSearchQueue;
+    QMenu          *mJobsMenu;
+    QAction        *mJobsCancelAll;
+    std::map<QAction*, int> mJobActions;  // Of the jobs in mJobsMenu, by id
 };
 
 }  // namespace
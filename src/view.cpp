@@ -0,0 +1,228 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <cmath>
+#include <algorithm>
+#include "view.h"
+
+
+namespace circles
+{
+
+const float VIEW_ZOOM_STEP    = 1.25f;   // Per wheel step
+const float VIEW_MIN_ZOOM     = 1e-4f;
+const float VIEW_MAX_ZOOM     = 1e4f;
+const float VIEW_DOT_SIZE     = 1.0f;    // Circles with a smaller radius on the screen are dots
+const float GRID_CELL_FIGURES = 4.0f;    // Average figures per grid cell
+const int   GRID_MAX_SIDE     = 4096;    // Cells per grid side, at most
+
+
+bool Overlap( const QRectF& a, const QRectF& b )
+{
+    return (a.left() <= b.right()) && (b.left() <= a.right()) &&
+           (a.top() <= b.bottom()) && (b.top() <= a.bottom());
+}
+
+
+/********************************* SceneView **********************************/
+
+void SceneView::Reset()
+{
+    mZoom = 1.0f;
+    mOffsetX = mOffsetY = 0.0f;
+}
+
+
+void SceneView::Fit( const SceneInfo& info, int width, int height )
+{
+    if ( info.minX > info.maxX )
+    {
+        Reset();
+        return;
+    }
+
+    int margin;
+    FitScene(info, width, height, &mZoom, &margin);
+    mZoom = std::min(std::max(mZoom, VIEW_MIN_ZOOM), VIEW_MAX_ZOOM);
+    mOffsetX = margin - info.minX * mZoom;
+    mOffsetY = margin - info.minY * mZoom;
+}
+
+
+void SceneView::ZoomAt( float factor, const QPointF& pos )
+{
+    Point at = ToScene(pos);
+    mZoom = std::min(std::max(mZoom * factor, VIEW_MIN_ZOOM), VIEW_MAX_ZOOM);
+    mOffsetX = pos.x() - at.x * mZoom;
+    mOffsetY = pos.y() - at.y * mZoom;
+}
+
+
+void SceneView::Pan( float dx, float dy )
+{
+    mOffsetX += dx;
+    mOffsetY += dy;
+}
+
+
+Point SceneView::ToScene( const QPointF& pos ) const
+{
+    return Point( (pos.x() - mOffsetX) / mZoom, (pos.y() - mOffsetY) / mZoom );
+}
+
+
+QRectF SceneView::Visible( int width, int height ) const
+{
+    Point topLeft = ToScene(QPointF(0, 0));
+    return QRectF(topLeft.x, topLeft.y, width / mZoom, height / mZoom);
+}
+
+
+QTransform SceneView::Transform() const
+{
+    QTransform t;
+    t.translate(mOffsetX, mOffsetY);
+    t.scale(mZoom, mZoom);
+    return t;
+}
+
+
+/********************************* FigureGrid *********************************/
+
+FigureGrid::FigureGrid() :
+        mX0(0.0f),
+        mY0(0.0f),
+        mCell(1.0f),
+        mCols(0),
+        mRows(0),
+        mStart(),
+        mItems(),
+        mBoxes()
+{
+}
+
+
+void FigureGrid::Clear()
+{
+    mCols = mRows = 0;
+    mStart.clear();
+    mItems.clear();
+    mBoxes.clear();
+}
+
+
+void FigureGrid::Build( const std::vector<Figure*>& figures )
+{
+    Clear();
+    if ( figures.empty() )
+        return;
+
+    SceneInfo info;
+    SceneBounds(figures, &info);
+
+    mBoxes.reserve(figures.size());
+    for ( std::vector<Figure*>::const_iterator fig=figures.begin();
+          fig != figures.end(); ++fig )
+    {
+        // TODO Replace dynamic_cast<>
+        const Circle *crp = dynamic_cast<const Circle*>(*fig);
+        const Point *ptp = dynamic_cast<const Point*>(*fig);
+        if ( NULL != crp )
+            mBoxes.push_back(QRectF(crp->C.x - crp->R, crp->C.y - crp->R, 2*crp->R, 2*crp->R));
+        else if ( NULL != ptp )
+            mBoxes.push_back(QRectF(ptp->x, ptp->y, 0, 0));
+        else
+            mBoxes.push_back(QRectF(info.minX, info.minY,  // Anywhere
+                                    info.maxX - info.minX, info.maxY - info.minY));
+    }
+
+    // About GRID_CELL_FIGURES figures per cell, if they are spread evenly.
+    const float w = std::max(info.maxX - info.minX, 1.0f);
+    const float h = std::max(info.maxY - info.minY, 1.0f);
+    mCell = sqrt(w * h * GRID_CELL_FIGURES / figures.size());
+    mX0 = info.minX;
+    mY0 = info.minY;
+    mCols = std::min(static_cast<int>(w / mCell) + 1, GRID_MAX_SIDE);
+    mRows = std::min(static_cast<int>(h / mCell) + 1, GRID_MAX_SIDE);
+    mCell = std::max(w / mCols, h / mRows);
+
+    // Count the figures per cell, then place them.
+    mStart.assign(static_cast<size_t>(mCols) * mRows + 1, 0);
+    for ( unsigned int f=0; f<mBoxes.size(); ++f )
+    {
+        int col0, row0, col1, row1;
+        Cells(mBoxes[f], &col0, &row0, &col1, &row1);
+        for ( int r=row0; r<=row1; ++r )
+            for ( int c=col0; c<=col1; ++c )
+                ++mStart[r*mCols + c + 1];
+    }
+    for ( unsigned int i=1; i<mStart.size(); ++i )
+        mStart[i] += mStart[i-1];
+
+    mItems.resize(mStart.back());
+    std::vector<unsigned int> next(mStart.begin(), mStart.end() - 1);
+    for ( unsigned int f=0; f<mBoxes.size(); ++f )
+    {
+        int col0, row0, col1, row1;
+        Cells(mBoxes[f], &col0, &row0, &col1, &row1);
+        for ( int r=row0; r<=row1; ++r )
+            for ( int c=col0; c<=col1; ++c )
+                mItems[next[r*mCols + c]++] = f;
+    }
+}
+
+
+void FigureGrid::Query( const QRectF& area, std::vector<unsigned int>* found ) const
+{
+    if ( Empty() )
+        return;
+
+    const size_t first = found->size();
+
+    int col0, row0, col1, row1;
+    Cells(area, &col0, &row0, &col1, &row1);
+    for ( int r=row0; r<=row1; ++r )
+    {
+        for ( int c=col0; c<=col1; ++c )
+        {
+            const unsigned int cell = r*mCols + c;
+            for ( unsigned int i=mStart[cell]; i<mStart[cell+1]; ++i )
+            {
+                const QRectF& box = mBoxes[mItems[i]];
+                if ( ! Overlap(box, area) )
+                    continue;
+
+                // Found once: in the cell of the top left corner of the
+                // overlap.
+                int c0, r0, c1, r1;
+                Cells(QRectF(std::max(box.left(), area.left()),
+                             std::max(box.top(), area.top()), 0, 0),
+                      &c0, &r0, &c1, &r1);
+                if ( (c0 == c) && (r0 == r) )
+                    found->push_back(mItems[i]);
+            }
+        }
+    }
+
+    std::sort(found->begin() + first, found->end());
+}
+
+
+// The cell of the coordinate, clamped to 0 .. n-1.
+static int CellOf( double v, int n )
+{
+    return static_cast<int>( std::min(std::max(floor(v), 0.0), n - 1.0) );
+}
+
+
+void FigureGrid::Cells( const QRectF& box, int* col0, int* row0,
+                        int* col1, int* row1 ) const
+{
+    *col0 = CellOf((box.left() - mX0) / mCell, mCols);
+    *row0 = CellOf((box.top() - mY0) / mCell, mRows);
+    *col1 = CellOf((box.right() - mX0) / mCell, mCols);
+    *row1 = CellOf((box.bottom() - mY0) / mCell, mRows);
+}
+
+}  // namespace
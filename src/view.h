@@ -0,0 +1,109 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef VIEW_H
+#define VIEW_H
+
+#include <vector>
+
+#include "qglobal.h"
+#include <QPointF>
+#include <QRectF>
+#include <QTransform>
+
+#include "geometry.h"
+#include "scene.h"
+
+
+namespace circles
+{
+
+extern const float VIEW_ZOOM_STEP;
+extern const float VIEW_MIN_ZOOM;
+extern const float VIEW_MAX_ZOOM;
+extern const float VIEW_DOT_SIZE;
+extern const float GRID_CELL_FIGURES;
+extern const int   GRID_MAX_SIDE;
+
+
+// True if the rectangles overlap or touch. Unlike QRectF::intersects() also
+// for the empty ones of points and of horizontal or vertical segments.
+bool Overlap(const QRectF& a, const QRectF& b);
+
+
+/********************************* SceneView **********************************/
+
+/* Where the scene is shown in a widget: x' = x*zoom + offsetX, the same for y.
+ * The scene coordinates are never changed by it. */
+class SceneView
+{
+  public:
+    SceneView() : mZoom(1.0f), mOffsetX(0.0f), mOffsetY(0.0f) {}
+
+    // Shows the scene coordinates as pixels.
+    void Reset();
+
+    // Fits the bounding box in width x height, like ScaleScene() would.
+    void Fit(const SceneInfo& info, int width, int height);
+
+    // Zooms by the factor, keeping the scene point under pos (in the widget)
+    // in place.
+    void ZoomAt(float factor, const QPointF& pos);
+
+    // Moves the scene by dx, dy pixels.
+    void Pan(float dx, float dy);
+
+    Point ToScene(const QPointF& pos) const;
+
+    // The part of the scene, which is in the width x height widget.
+    QRectF Visible(int width, int height) const;
+
+    // From the scene to the widget.
+    QTransform Transform() const;
+
+    float Zoom() const { return mZoom; }
+
+  private:
+    float mZoom;
+    float mOffsetX;
+    float mOffsetY;
+};
+
+
+/********************************* FigureGrid *********************************/
+
+/* A uniform grid over the bounding boxes of the figures, so the ones in an area
+ * are found without going over the whole scene. A figure is put in every cell
+ * its box overlaps, and the cells are made about as big as GRID_CELL_FIGURES
+ * average figures, so a query takes time in proportion to what it finds. */
+class FigureGrid
+{
+  public:
+    FigureGrid();
+
+    void Build(const std::vector<Figure*>& figures);
+    void Clear();
+    bool Empty() const { return mBoxes.empty(); }
+
+    // Appends the indexes (into the figures given to Build()) of the figures,
+    // whose bounding boxes intersect the area, in increasing order.
+    void Query(const QRectF& area, std::vector<unsigned int>* found) const;
+
+  private:
+    // The cell range covered by a box, clamped to the grid.
+    void Cells(const QRectF& box, int* col0, int* row0, int* col1, int* row1) const;
+
+    float                     mX0;     // Top left corner of the grid
+    float                     mY0;
+    float                     mCell;   // Cell size
+    int                       mCols;
+    int                       mRows;
+    std::vector<unsigned int> mStart;  // Of each cell in mItems, and the end
+    std::vector<unsigned int> mItems;  // Figure indexes, by cell
+    std::vector<QRectF>       mBoxes;  // Of the figures
+};
+
+}  // namespace
+
+#endif // VIEW_H
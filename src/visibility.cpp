@@ -0,0 +1,281 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#include <algorithm>
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMutex>
+#include <QMutexLocker>
+#include "visibility.h"
+#include "packet.h"
+
+
+namespace circles
+{
+
+const unsigned int VIS_MAX_CIRCLES = 2048;  // The graph is O(N^2) in memory
+
+
+/***************************** VisibilityGraph ********************************/
+
+// Builds a range of rows of the graph.
+class VisibilityTask : public QRunnable
+{
+  public:
+    VisibilityTask( VisibilityGraph* graph, const FlatScene& scene,
+                    const std::vector<int>& bySize, int begin, int end ) :
+        mGraph(graph), mScene(scene), mBySize(bySize), mBegin(begin), mEnd(end)
+    {
+    }
+
+    void run()
+    {
+        for ( int i=mBegin; i<mEnd; ++i )
+            mGraph->BuildRow(mScene, mBySize, i);
+    }
+
+  private:
+    VisibilityGraph*        mGraph;
+    const FlatScene&        mScene;
+    const std::vector<int>& mBySize;
+    int                     mBegin;
+    int                     mEnd;
+};
+
+
+// Sorts circle indexes by decreasing radius.
+struct BiggerCircle
+{
+    explicit BiggerCircle( const FlatScene& scene ) : mScene(scene) {}
+    bool operator()( int a, int b ) const { return mScene.r[a] > mScene.r[b]; }
+    const FlatScene& mScene;
+};
+
+
+void VisibilityGraph::Build( const FlatScene& scene )
+{
+    mRows.assign(scene.Size(), Row());
+
+    std::vector<int> bySize;
+    for ( unsigned int c=0; c<scene.Size(); ++c )
+    {
+        if ( static_cast<int>(c) != scene.target )
+            bySize.push_back(c);
+    }
+    std::sort(bySize.begin(), bySize.end(), BiggerCircle(scene));
+
+    QThreadPool pool;
+    int numTasks = 4 * QThread::idealThreadCount();
+    int rowsPerTask = (scene.Size() + numTasks - 1) / numTasks;
+
+    for ( int begin=0; begin<static_cast<int>(scene.Size()); begin+=rowsPerTask )
+    {
+        int end = std::min(begin + rowsPerTask, static_cast<int>(scene.Size()));
+        pool.start(new VisibilityTask(this, scene, bySize, begin, end));  // Auto-deleted
+    }
+
+    pool.waitForDone();
+}
+
+
+// True if one circle blocks all segments between the disks i and j. Only the
+// circles bigger than both can, so bySize is searched only down to them.
+static bool Occluded( const FlatScene& scene, const std::vector<int>& bySize,
+                      int i, int j )
+{
+    const float ri = scene.r[i];
+    const float rj = scene.r[j];
+    float ux = scene.cx[j] - scene.cx[i];
+    float uy = scene.cy[j] - scene.cy[i];
+    float d = Module(ux, uy);
+    ux /= d;
+    uy /= d;
+
+    // Circle k blocks all segments between the disks i and j, if it covers
+    // a whole cross-section of their convex hull. The hull is narrower
+    // than the bigger of the two.
+    const float w = std::max(ri, rj);
+
+    for ( std::vector<int>::const_iterator k=bySize.begin();
+          (k != bySize.end()) && (scene.r[*k] > w); ++k )
+    {
+        if ( (*k == i) || (*k == j) )
+            continue;
+
+        float kx = scene.cx[*k] - scene.cx[i];
+        float ky = scene.cy[*k] - scene.cy[i];
+        float sk = kx*ux + ky*uy;     // Along the axis
+        float ek = fabs(ky*ux - kx*uy);  // Across the axis
+        float s = std::min(std::max(sk, ri), d - rj);
+
+        if ( (s - sk)*(s - sk) + (ek + w)*(ek + w) <= scene.r2[*k] )
+            return true;
+    }
+
+    return false;
+}
+
+
+void VisibilityGraph::BuildRow( const FlatScene& scene,
+                                const std::vector<int>& bySize, int i )
+{
+    Row& row = mRows[i];
+    std::fill(row.binStart, row.binStart + NUM_BINS + 1, 0);
+
+    if ( i == scene.target )
+        return;
+
+    for ( unsigned int j=0; j<scene.Size(); ++j )
+    {
+        if ( (static_cast<int>(j) == i) || (static_cast<int>(j) == scene.target) )
+            continue;
+
+        if ( ! Occluded(scene, bySize, i, j) )
+        {
+            float ux = scene.cx[j] - scene.cx[i];
+            float uy = scene.cy[j] - scene.cy[i];
+            float d = Module(ux, uy);
+            VisNeighbour n = { static_cast<int>(j), static_cast<float>(atan2(uy, ux)),
+                               static_cast<float>(asin(std::min(1.0f, (scene.r[i] + scene.r[j]) / d))) };
+            row.adj.push_back(n);
+        }
+    }
+
+    // Index the neighbours by the direction bins, which their ranges overlap.
+    const float binWidth = 2.0f * M_PI / NUM_BINS;
+    std::vector<int> first(row.adj.size()), last(row.adj.size());
+
+    for ( unsigned int n=0; n<row.adj.size(); ++n )
+    {
+        first[n] = static_cast<int>( floor((row.adj[n].phi - row.adj[n].halfW + M_PI) / binWidth) );
+        last[n]  = static_cast<int>( floor((row.adj[n].phi + row.adj[n].halfW + M_PI) / binWidth) );
+        if ( last[n] - first[n] + 1 >= NUM_BINS )
+        {
+            first[n] = 0;
+            last[n] = NUM_BINS - 1;
+        }
+
+        for ( int b=first[n]; b<=last[n]; ++b )
+            ++row.binStart[((b % NUM_BINS) + NUM_BINS) % NUM_BINS + 1];
+    }
+
+    for ( int b=0; b<NUM_BINS; ++b )
+        row.binStart[b+1] += row.binStart[b];
+
+    row.binList.resize(row.binStart[NUM_BINS]);
+    std::vector<unsigned int> fill(row.binStart, row.binStart + NUM_BINS);
+
+    for ( unsigned int n=0; n<row.adj.size(); ++n )
+    {
+        for ( int b=first[n]; b<=last[n]; ++b )
+            row.binList[fill[((b % NUM_BINS) + NUM_BINS) % NUM_BINS]++] = row.adj[n].circle;
+    }
+}
+
+
+QSharedPointer<const VisibilityGraph> VisibilityGraph::Cached( const FlatScene& scene )
+{
+    static QMutex mutex;
+    static QSharedPointer<const VisibilityGraph> cached;
+    static unsigned long long cachedHash = 0;
+
+    if ( scene.Size() > VIS_MAX_CIRCLES + 1 )
+        return QSharedPointer<const VisibilityGraph>();
+
+    unsigned long long hash = scene.Hash();
+
+    QMutexLocker lock(&mutex);  // Others wait for the build, if any.
+
+    if ( cached.isNull() || (hash != cachedHash) ||
+         (cached->Size() != scene.Size()) )
+    {
+        VisibilityGraph* graph = new VisibilityGraph();
+        graph->Build(scene);
+        cached = QSharedPointer<const VisibilityGraph>(graph);
+        cachedHash = hash;
+    }
+
+    return cached;
+}
+
+
+
+/******************************** ReachSets ***********************************/
+
+void ReachSets::Build( const FlatScene& scene, const VisibilityGraph& graph, int K )
+{
+    mNumCircles = scene.Size();
+    mMasks.assign(std::max(K, 0) * mNumCircles, 0);
+    if ( (K <= 0) || (scene.target < 0) )
+        return;
+
+    std::vector<int> bySize;
+    for ( unsigned int c=0; c<scene.Size(); ++c )
+    {
+        if ( static_cast<int>(c) != scene.target )
+            bySize.push_back(c);
+    }
+    std::sort(bySize.begin(), bySize.end(), BiggerCircle(scene));
+
+    const int t = scene.target;
+    for ( unsigned int c=0; c<mNumCircles; ++c )
+    {
+        if ( (static_cast<int>(c) == t) || Occluded(scene, bySize, c, t) )
+            continue;
+
+        // The directions from disk c to the target, as in the graph.
+        float ux = scene.cx[t] - scene.cx[c];
+        float uy = scene.cy[t] - scene.cy[c];
+        float d = Module(ux, uy);
+        float phi = atan2(uy, ux);
+        float halfW = asin(std::min(1.0f, (scene.r[c] + scene.r[t]) / d));
+        mMasks[c] = BinRange(phi - halfW, phi + halfW);
+    }
+
+    for ( int r=1; r<K; ++r )
+    {
+        const unsigned long long* prev = &mMasks[(r-1)*mNumCircles];
+        unsigned long long* level = &mMasks[r*mNumCircles];
+
+        for ( unsigned int c=0; c<mNumCircles; ++c )
+        {
+            const std::vector<VisNeighbour>& adj = graph.Neighbours(c);
+            for ( unsigned int n=0; n<adj.size(); ++n )
+            {
+                if ( 0 != prev[adj[n].circle] )
+                    level[c] |= BinRange(adj[n].phi - adj[n].halfW, adj[n].phi + adj[n].halfW);
+            }
+        }
+    }
+}
+
+
+unsigned int ReachSets::Count( int r ) const
+{
+    unsigned int count = 0;
+    for ( unsigned int c=0; c<mNumCircles; ++c )
+        count += (0 != mMasks[r*mNumCircles + c])? 1 : 0;
+    return count;
+}
+
+
+unsigned long long ReachSets::BinRange( float from, float to )
+{
+    const int numBins = VisibilityGraph::NUM_BINS;
+    const float binWidth = 2.0f * M_PI / numBins;
+    int first = static_cast<int>( floor((from + M_PI) / binWidth) );
+    int last  = static_cast<int>( floor((to + M_PI) / binWidth) );
+    if ( last < first )
+        last += numBins;  // Across PI
+    if ( last - first + 1 >= numBins )
+        return ~0ULL;
+
+    unsigned long long mask = 0;
+    for ( int b=first; b<=last; ++b )
+        mask |= 1ULL << (((b % numBins) + numBins) % numBins);
+    return mask;
+}
+
+}  // namespace
@@ -0,0 +1,130 @@
+/******************************************************************************
+ * Copyright: Assen Kirov                                                     *
+ ******************************************************************************/
+
+#ifndef VISIBILITY_H
+#define VISIBILITY_H
+
+#include <vector>
+#include <cmath>
+
+#include "qglobal.h"
+#include <QSharedPointer>
+
+
+namespace circles
+{
+
+struct FlatScene;
+
+extern const unsigned int VIS_MAX_CIRCLES;
+
+
+/***************************** VisibilityGraph ********************************/
+
+// Circle j can be hit by rays leaving circle i in directions phi +/- halfW.
+struct VisNeighbour
+{
+    int   circle;
+    float phi;
+    float halfW;
+};
+
+
+/* For every circle the circles, which may be hit next by a ray leaving it, and
+ * the directions to them. Both tests are conservative: a neighbour is dropped
+ * only if one circle blocks all segments between the two, and the direction
+ * ranges are the ones from the whole disk. The lookup is by direction bins.
+ * The target circle of the FlatScene is left out - test it separately. */
+class VisibilityGraph
+{
+  public:
+    static const int NUM_BINS = 64;
+
+    VisibilityGraph() : mRows() {}
+
+    // Builds the graph on all cores.
+    void Build(const FlatScene& scene);
+
+    // Returns the graph for this scene, building it only if the circles have
+    // changed since the last call. NULL for too big scenes.
+    static QSharedPointer<const VisibilityGraph> Cached(const FlatScene& scene);
+
+    unsigned int Size() const { return mRows.size(); }
+
+    const std::vector<VisNeighbour>& Neighbours(int c) const { return mRows[c].adj; }
+
+    // The circles, which may be hit by a ray leaving circle c in this direction.
+    const int* Candidates(int c, float angle, int* count) const
+    {
+        const Row& row = mRows[c];
+        int bin = static_cast<int>( (angle + M_PI) * (NUM_BINS / (2.0 * M_PI)) );
+        bin = (bin < 0)? 0 : ((bin >= NUM_BINS)? NUM_BINS-1 : bin);
+        *count = row.binStart[bin+1] - row.binStart[bin];
+        return row.binList.empty()? NULL : &row.binList[row.binStart[bin]];
+    }
+
+  private:
+    struct Row
+    {
+        std::vector<VisNeighbour> adj;
+        unsigned int              binStart[NUM_BINS+1];
+        std::vector<int>          binList;  // Neighbours by direction bin
+    };
+
+    friend class VisibilityTask;
+    void BuildRow(const FlatScene& scene, const std::vector<int>& bySize, int i);
+
+    std::vector<Row> mRows;
+};
+
+
+
+/******************************** ReachSets ***********************************/
+
+/* In which directions a ray may leave each circle and still reach the target
+ * of a FlatScene with r more reflections, by the direction bins of the graph.
+ * Level 0 has the directions from the circles, which see the target (the test
+ * of the graph with the target as the other disk), to it. Level r has the
+ * directions to the neighbours, which have any in level r-1. So it is
+ * conservative too - only rays, which can't make it, are stopped early. */
+class ReachSets
+{
+  public:
+    ReachSets() : mNumCircles(0), mMasks() {}
+
+    // Levels 0 to K-1. The graph must be built for the scene, which must have
+    // a target.
+    void Build(const FlatScene& scene, const VisibilityGraph& graph, int K);
+
+    bool Empty() const { return mMasks.empty(); }
+
+    // True if a ray leaving circle c in this direction may reach the target
+    // with r more reflections. r must be less than K.
+    bool Reaches( int c, int r, float angle ) const
+    {
+        int bin = static_cast<int>( (angle + M_PI) * (VisibilityGraph::NUM_BINS / (2.0 * M_PI)) );
+        bin = (bin < 0)? 0 : ((bin >= VisibilityGraph::NUM_BINS)? VisibilityGraph::NUM_BINS-1 : bin);
+        return 0 != (mMasks[r*mNumCircles + c] & (1ULL << bin));
+    }
+
+    // The same for any of the directions counterclockwise from 'from' to 'to'.
+    bool Reaches( int c, int r, float from, float to ) const
+    {
+        return 0 != (mMasks[r*mNumCircles + c] & BinRange(from, to));
+    }
+
+    // The circles with any direction in level r.
+    unsigned int Count(int r) const;
+
+  private:
+    // The mask of the bins from 'from' to 'to' counterclockwise.
+    static unsigned long long BinRange(float from, float to);
+
+    unsigned int                     mNumCircles;
+    std::vector<unsigned long long>  mMasks;  // K rows of mNumCircles, a bit per bin
+};
+
+}  // namespace
+
+#endif // VISIBILITY_H